@@ -0,0 +1,483 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+// A lookup benchmark for a generated RMI. It is compiled together with the
+// generated code (see bench/Makefile): RMI_HEADER names the generated
+// header, RMI_NAMESPACE its namespace, and RMI_DATA_TYPE the type of the keys
+// in the data file the RMI was trained on.
+//
+//   ./bench <data file> [--threads N] [--queries N] [--zipf theta] [--seed N]
+//
+// Each workload is run with one thread and with N threads (all cores by
+// default), once with `lookup` alone and once with `find`, which adds the
+// last-mile search. The workloads are
+//
+//   uniform     keys of the data, drawn uniformly
+//   zipf        keys of the data, drawn from a Zipf distribution over
+//               their ranks, with the hot keys spread over the data
+//   sequential  keys of the data, in order
+//   absent      keys between two consecutive keys of the data
+//
+// For each run, the benchmark reports the throughput (as ns per lookup on
+// each thread, and lookups per second over all threads), the percentiles of
+// the latency of single lookups (timed one at a time in a separate pass,
+// less the cost of reading the clock), and the cache and branch misses per
+// lookup, counted with perf_event where the kernel allows it.
+
+#include RMI_HEADER
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef RMI_DATA_TYPE
+#define RMI_DATA_TYPE uint64_t
+#endif
+
+typedef RMI_DATA_TYPE DataKey;
+
+namespace {
+
+// the number of lookups timed one at a time on each thread
+const size_t LATENCY_SAMPLES = 1 << 20;
+
+// the number of queries of each workload checked against std::lower_bound
+const size_t VERIFIED_QUERIES = 1 << 14;
+
+template <typename T>
+inline void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// RMIs generated with --no-errors have a lookup without the error
+template <typename K, typename = void>
+struct LookupReportsError : std::false_type {};
+
+template <typename K>
+struct LookupReportsError<K, std::void_t<decltype(
+  RMI_NAMESPACE::lookup(std::declval<K>(), (size_t*) nullptr))>> : std::true_type {};
+
+template <typename K>
+inline uint64_t rmi_lookup(K key) {
+  if constexpr (LookupReportsError<K>::value) {
+    size_t err;
+    return RMI_NAMESPACE::lookup(key, &err);
+  } else {
+    return RMI_NAMESPACE::lookup(key);
+  }
+}
+
+template <bool kFind>
+inline uint64_t query(const std::vector<DataKey>& data, DataKey key) {
+  if constexpr (kFind) {
+    return RMI_NAMESPACE::find(data.data(), data.size(), key);
+  } else {
+    return rmi_lookup(key);
+  }
+}
+
+// A hardware event counted over this thread and the threads it starts
+// while counting. Without perf_event (or without permission to use it),
+// the counter is unavailable.
+class PerfCounter {
+ public:
+  explicit PerfCounter(uint64_t event) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = event;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void) event;
+#endif
+  }
+
+  ~PerfCounter() {
+#ifdef __linux__
+    if (fd_ >= 0) close(fd_);
+#endif
+  }
+
+  PerfCounter(const PerfCounter&) = delete;
+  PerfCounter& operator=(const PerfCounter&) = delete;
+
+  bool available() const { return fd_ >= 0; }
+
+  void start() {
+#ifdef __linux__
+    if (fd_ < 0) return;
+    ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  // the count since `start`, once every thread started since has exited
+  uint64_t stop() {
+    uint64_t count = 0;
+#ifdef __linux__
+    if (fd_ < 0) return 0;
+    ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd_, &count, sizeof(count)) != sizeof(count)) return 0;
+#endif
+    return count;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+// Zipf distributed ranks in [0, n), where rank i is drawn with probability
+// proportional to 1 / (i + 1)^theta (Gray et al., "Quickly generating
+// billion-record synthetic databases").
+class ZipfGenerator {
+ public:
+  ZipfGenerator(uint64_t n, double theta) : n_(n), theta_(theta) {
+    zeta_n_ = zeta(n, theta);
+    alpha_ = 1.0 / (1.0 - theta);
+    eta_ = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zeta_n_);
+  }
+
+  uint64_t next(std::mt19937_64& rng) {
+    const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    const double uz = u * zeta_n_;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + std::pow(0.5, theta_)) return std::min<uint64_t>(1, n_ - 1);
+    const double rank = n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_);
+    return std::min<uint64_t>((uint64_t) rank, n_ - 1);
+  }
+
+ private:
+  // the sum of 1 / i^theta for i in [1, n]. Past the first terms, the sum is
+  // close enough to the integral.
+  static double zeta(uint64_t n, double theta) {
+    const uint64_t exact = std::min<uint64_t>(n, 1 << 16);
+    double sum = 0.0;
+    for (uint64_t i = 1; i <= exact; i++)
+      sum += std::pow((double) i, -theta);
+    if (n > exact)
+      sum += (std::pow(n + 0.5, 1.0 - theta) - std::pow(exact + 0.5, 1.0 - theta))
+        / (1.0 - theta);
+    return sum;
+  }
+
+  uint64_t n_;
+  double theta_;
+  double zeta_n_;
+  double alpha_;
+  double eta_;
+};
+
+std::vector<DataKey> load_data(const char* path) {
+  std::vector<DataKey> data;
+  std::ifstream in(path, std::ios::binary);
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  if (!in.good()) return data;
+  data.resize(size);
+  in.read(reinterpret_cast<char*>(data.data()), size * sizeof(DataKey));
+  if (!in.good()) data.clear();
+  return data;
+}
+
+// Generates `count` queries of `workload`, or none if the data has no keys
+// for it (absent keys need gaps between the keys).
+std::vector<DataKey> make_queries(const std::string& workload,
+                                  const std::vector<DataKey>& data,
+                                  size_t count, double zipf_theta, uint64_t seed) {
+  const size_t n = data.size();
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<size_t> index(0, n - 1);
+  std::vector<DataKey> queries;
+  queries.reserve(count);
+
+  if (workload == "uniform") {
+    for (size_t i = 0; i < count; i++)
+      queries.push_back(data[index(rng)]);
+  } else if (workload == "zipf") {
+    ZipfGenerator zipf(n, zipf_theta);
+    for (size_t i = 0; i < count; i++) {
+      // spread the hot ranks over the data
+      const uint64_t rank = zipf.next(rng);
+      queries.push_back(data[(rank * 0x9e3779b97f4a7c15ULL) % n]);
+    }
+  } else if (workload == "sequential") {
+    const size_t start = index(rng);
+    for (size_t i = 0; i < count; i++)
+      queries.push_back(data[(start + i) % n]);
+  } else if (workload == "absent") {
+    size_t misses = 0;
+    while (queries.size() < count && misses < 64 * count) {
+      const size_t i = index(rng) % (n - 1);
+      const DataKey key = data[i] + (data[i + 1] - data[i]) / 2;
+      if (data[i] < key && key < data[i + 1]) {
+        queries.push_back(key);
+      } else {
+        misses++;
+      }
+    }
+    if (queries.size() < count) queries.clear();
+  }
+  return queries;
+}
+
+struct RunResult {
+  double ns_per_lookup;
+  double lookups_per_sec;
+  std::vector<double> latency_percentiles;
+  // per lookup, or negative when the counter is unavailable
+  double cache_misses;
+  double branch_misses;
+};
+
+const double PERCENTILES[] = {50.0, 90.0, 99.0, 99.9};
+
+// the cost of reading the clock twice, which the latencies do not include
+double clock_overhead_ns() {
+  std::vector<double> samples(1 << 16);
+  for (auto& sample : samples) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto end = std::chrono::steady_clock::now();
+    sample = std::chrono::duration<double, std::nano>(end - start).count();
+  }
+  std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+  return samples[samples.size() / 2];
+}
+
+template <bool kFind>
+RunResult run(const std::vector<DataKey>& data, const std::vector<DataKey>& queries,
+              size_t num_threads, double clock_overhead) {
+  const size_t count = queries.size();
+  RunResult result;
+
+  // throughput: every thread runs all of the queries, each starting at a
+  // different one
+  PerfCounter cache_misses(PERF_COUNT_HW_CACHE_MISSES);
+  PerfCounter branch_misses(PERF_COUNT_HW_BRANCH_MISSES);
+  std::vector<double> thread_ns(num_threads);
+  std::atomic<size_t> ready(0);
+
+  cache_misses.start();
+  branch_misses.start();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      ready++;
+      while (ready.load() < num_threads) {}
+
+      const size_t first = t * count / num_threads;
+      uint64_t sum = 0;
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i = first; i < count; i++)
+        sum += query<kFind>(data, queries[i]);
+      for (size_t i = 0; i < first; i++)
+        sum += query<kFind>(data, queries[i]);
+      const auto end = std::chrono::steady_clock::now();
+      do_not_optimize(sum);
+      thread_ns[t] = std::chrono::duration<double, std::nano>(end - start).count();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  const uint64_t total_cache_misses = cache_misses.stop();
+  const uint64_t total_branch_misses = branch_misses.stop();
+
+  const double total_lookups = (double) count * num_threads;
+  const double wall_ns = *std::max_element(thread_ns.begin(), thread_ns.end());
+  result.ns_per_lookup = wall_ns / count;
+  result.lookups_per_sec = total_lookups / (wall_ns / 1e9);
+  result.cache_misses = (cache_misses.available()
+                         ? total_cache_misses / total_lookups : -1.0);
+  result.branch_misses = (branch_misses.available()
+                          ? total_branch_misses / total_lookups : -1.0);
+
+  // latency: time single lookups, on every thread at once
+  const size_t samples = std::min(count, LATENCY_SAMPLES);
+  std::vector<std::vector<double>> thread_latencies(num_threads);
+  ready = 0;
+  threads.clear();
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      std::vector<double>& latencies = thread_latencies[t];
+      latencies.reserve(samples);
+      ready++;
+      while (ready.load() < num_threads) {}
+
+      const size_t first = t * count / num_threads;
+      for (size_t i = 0; i < samples; i++) {
+        const DataKey key = queries[(first + i) % count];
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t pos = query<kFind>(data, key);
+        do_not_optimize(pos);
+        const auto end = std::chrono::steady_clock::now();
+        latencies.push_back(std::max(
+          0.0, std::chrono::duration<double, std::nano>(end - start).count() - clock_overhead));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  std::vector<double> latencies;
+  for (const auto& l : thread_latencies)
+    latencies.insert(latencies.end(), l.begin(), l.end());
+  for (double percentile : PERCENTILES) {
+    const size_t rank = std::min(latencies.size() - 1,
+                                 (size_t) (percentile / 100.0 * latencies.size()));
+    std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+    result.latency_percentiles.push_back(latencies[rank]);
+  }
+
+  return result;
+}
+
+// the number of queries whose result from find differs from std::lower_bound
+size_t verify(const std::vector<DataKey>& data, const std::vector<DataKey>& queries) {
+  size_t mismatches = 0;
+  for (size_t i = 0; i < std::min(queries.size(), VERIFIED_QUERIES); i++) {
+    const size_t expected = std::lower_bound(data.begin(), data.end(), queries[i]) - data.begin();
+    if (RMI_NAMESPACE::find(data.data(), data.size(), queries[i]) != expected)
+      mismatches++;
+  }
+  return mismatches;
+}
+
+void print_result(const std::string& workload, size_t num_threads,
+                  const char* search, const RunResult& result) {
+  std::cout << std::left << std::setw(12) << workload
+            << std::right << std::setw(8) << num_threads
+            << std::setw(8) << search
+            << std::fixed << std::setprecision(1)
+            << std::setw(11) << result.ns_per_lookup
+            << std::setw(12) << result.lookups_per_sec / 1e6;
+  std::cout << std::setprecision(0);
+  for (double latency : result.latency_percentiles)
+    std::cout << std::setw(8) << latency;
+  std::cout << std::setprecision(3);
+  for (double misses : {result.cache_misses, result.branch_misses}) {
+    if (misses < 0.0) {
+      std::cout << std::setw(14) << "n/a";
+    } else {
+      std::cout << std::setw(14) << misses;
+    }
+  }
+  std::cout << std::endl;
+}
+
+void usage(const char* name) {
+  std::cerr << "usage: " << name << " <data file> [--threads N] [--queries N]"
+            << " [--zipf theta] [--seed N]" << std::endl;
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) usage(argv[0]);
+  const char* data_path = argv[1];
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t num_queries = 10000000;
+  double zipf_theta = 0.99;
+  uint64_t seed = 42;
+  for (int i = 2; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (arg == "--threads") {
+      max_threads = std::max(1ul, strtoul(value, NULL, 10));
+    } else if (arg == "--queries") {
+      num_queries = std::max(1ul, strtoul(value, NULL, 10));
+    } else if (arg == "--zipf") {
+      zipf_theta = atof(value);
+      if (zipf_theta <= 0.0 || zipf_theta == 1.0) {
+        std::cerr << "The Zipf parameter must be positive and not 1" << std::endl;
+        return 1;
+      }
+    } else if (arg == "--seed") {
+      seed = strtoull(value, NULL, 10);
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  const std::vector<DataKey> data = load_data(data_path);
+  if (data.size() < 2) {
+    std::cerr << "Could not read the keys from " << data_path << std::endl;
+    return 1;
+  }
+  if (!RMI_NAMESPACE::load("rmi_data")) {
+    std::cerr << "Could not load the RMI parameters from rmi_data" << std::endl;
+    return 1;
+  }
+
+  std::cout << "RMI " << RMI_NAMESPACE::NAME << ": " << RMI_NAMESPACE::RMI_SIZE
+            << " bytes, " << data.size() << " keys, " << num_queries
+            << " queries per run" << std::endl;
+  const double clock_overhead = clock_overhead_ns();
+  std::cout << "latencies in ns, less " << std::fixed << std::setprecision(1)
+            << clock_overhead << " ns to read the clock; misses per lookup" << std::endl;
+
+  std::cout << std::left << std::setw(12) << "workload"
+            << std::right << std::setw(8) << "threads"
+            << std::setw(8) << "search"
+            << std::setw(11) << "ns/lookup"
+            << std::setw(12) << "Mlookups/s";
+  for (double percentile : PERCENTILES)
+    std::cout << std::setw(8) << ("p" + std::to_string(percentile).substr(0, percentile < 99.5 ? 2 : 4));
+  std::cout << std::setw(14) << "cache-misses" << std::setw(14) << "branch-misses" << std::endl;
+
+  std::vector<size_t> thread_counts = {1};
+  if (max_threads > 1) thread_counts.push_back(max_threads);
+
+  for (const std::string workload : {"uniform", "zipf", "sequential", "absent"}) {
+    const std::vector<DataKey> queries = make_queries(workload, data, num_queries,
+                                                      zipf_theta, seed);
+    if (queries.empty()) {
+      std::cout << std::left << std::setw(12) << workload
+                << "skipped, the data has no gaps between its keys" << std::endl;
+      continue;
+    }
+
+    const size_t mismatches = verify(data, queries);
+    if (mismatches > 0) {
+      std::cerr << "warning: find differs from std::lower_bound on " << mismatches
+                << " of the first " << std::min(queries.size(), VERIFIED_QUERIES)
+                << " " << workload << " queries" << std::endl;
+    }
+
+    for (size_t num_threads : thread_counts) {
+      print_result(workload, num_threads, "lookup",
+                   run<false>(data, queries, num_threads, clock_overhead));
+      print_result(workload, num_threads, "find",
+                   run<true>(data, queries, num_threads, clock_overhead));
+    }
+  }
+
+  RMI_NAMESPACE::cleanup();
+  return 0;
+}
@@ -0,0 +1,93 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+// Inserting keys into an RMI without training it again. The RMI indexes a
+// sorted base array that never changes, and inserted keys go into a small
+// sorted buffer instead. Lookups search both and report positions in the
+// merged order of the base keys and the inserted keys, so they return the
+// same results as an RMI trained on all of the keys.
+//
+// Each insertion moves the buffered keys after the new key, so the buffer
+// should be merged into the base array once it is a small fraction of it:
+// write out the keys from `merge`, update the RMI for them (see
+// `rmi_lib::update`, which only trains the leaves of the changed keys), and
+// start a new DeltaRMI over the merged keys. Appending keys in order never
+// moves any buffered keys.
+//
+// Usage:
+//   rmi_engine::RMI<uint64_t> rmi;
+//   rmi.load("rmi_data/v1_PARAMETERS");
+//   rmi_engine::DeltaRMI<uint64_t> index(rmi, data, n);
+//   index.insert(key);
+//   size_t idx = index.find(key);
+//
+// `Index` can be any type with the `find` of an RMI, such as a
+// SwappableRMI<KeyT>::Reader. Inserts must not run concurrently with
+// lookups.
+
+#ifndef RMI_DELTA_H
+#define RMI_DELTA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "rmi_engine.h"
+
+namespace rmi_engine {
+
+template <typename KeyT, typename Index = RMI<KeyT>>
+class DeltaRMI {
+public:
+  // `index` must have been trained on the `n` sorted keys of `base`, and
+  // both must outlive the DeltaRMI.
+  DeltaRMI(const Index& index, const KeyT* base, size_t n)
+    : index(index), base(base), n(n) {}
+
+  // Adds `key`, after any equal keys.
+  void insert(KeyT key) {
+    if (inserted.empty() || !(key < inserted.back())) {
+      inserted.push_back(key);
+      return;
+    }
+    inserted.insert(std::upper_bound(inserted.begin(), inserted.end(), key), key);
+  }
+
+  // the position of the first key not less than `key` among all keys (the
+  // result of `std::lower_bound` on the output of `merge`)
+  size_t find(KeyT key) const {
+    const size_t in_base = index.find(base, n, key);
+    if (inserted.empty()) return in_base;
+    return in_base + (std::lower_bound(inserted.begin(), inserted.end(), key) - inserted.begin());
+  }
+
+  // the number of keys not less than `lo` and less than `hi`
+  size_t count(KeyT lo, KeyT hi) const {
+    if (!(lo < hi)) return 0;
+    return find(hi) - find(lo);
+  }
+
+  // Writes all of the keys, in order, to `out`.
+  void merge(std::vector<KeyT>* out) const {
+    out->resize(size());
+    std::merge(base, base + n, inserted.begin(), inserted.end(), out->begin());
+  }
+
+  size_t size() const { return n + inserted.size(); }
+
+  // the keys inserted so far, in order
+  const std::vector<KeyT>& buffer() const { return inserted; }
+
+private:
+  const Index& index;
+  const KeyT* base;
+  const size_t n;
+  std::vector<KeyT> inserted;
+};
+
+} // namespace rmi_engine
+
+#endif
@@ -0,0 +1,780 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+// A header-only engine that evaluates the two-layer RMIs trained by the
+// `rmi` tool directly from their parameter file (`<namespace>_PARAMETERS`),
+// without the generated code. A service can load a newly trained RMI at
+// runtime, without recompiling or relinking.
+//
+// The lookup code is a template specialized for each supported pair of
+// (root model, leaf model) types. `load` matches the model names recorded
+// in the parameter file against these pairs once, so a lookup costs a
+// single indirect call into code that is as specialized as the generated
+// code (the batch lookup dispatches once per call). The leaf parameters are
+// used in place. Leaves in the generator's default layout get code with
+// constant record offsets; padded, narrowed, and quantized leaf records
+// are read through a layout decoded at load time.
+//
+// Supported root models are linear (which also covers robust_linear and
+// linear_spline), cubic, loglinear, normal, lognormal, radix, and bradix.
+// Supported leaf models are linear, cubic, loglinear, normal, and
+// lognormal. `load` rejects bounded (cache fix) RMIs, RMIs with more than
+// two layers, and the radix table and histogram models, because part of
+// their parameters is compiled into the generated code.
+//
+// The positions and errors match those of the generated code when both are
+// compiled with the same floating point flags. Like the generated
+// `lookup(key, &err)`, the engine reports the larger of the left and right
+// errors of a leaf, and `find` searches the symmetric window around the
+// prediction.
+//
+// Usage:
+//   rmi_engine::RMI<uint64_t> rmi;
+//   if (!rmi.load("rmi_data/my_rmi_PARAMETERS")) { ... }
+//   size_t err;
+//   uint64_t guess = rmi.lookup(key, &err);
+//   size_t idx = rmi.find(data, n, key);
+
+#ifndef RMI_ENGINE_H
+#define RMI_ENGINE_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rmi_engine {
+
+// The layout of the parameter file, see rmi_lib/src/container.rs.
+namespace container {
+const uint64_t MAGIC = 0x4d41524150494d52ULL; // "RMIPARAM"
+const uint32_t VERSION = 3;
+const size_t ALIGNMENT = 64;
+const size_t HEADER_SIZE = 64;
+const size_t LAYER_ENTRY_SIZE = 64;
+const size_t MODEL_NAME_SIZE = 24;
+const size_t MAX_PARAM_TYPES = 8;
+const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+const uint64_t FNV_PRIME = 0x00000100000001b3ULL;
+
+const uint32_t KEY_TYPE_U32 = 0;
+const uint32_t KEY_TYPE_U64 = 1;
+const uint32_t KEY_TYPE_F64 = 2;
+
+const uint32_t HEADER_FLAG_UNIFORM_ERROR = 1;
+
+const uint32_t LAYER_FLAG_ERRORS = 4;
+const uint32_t LAYER_FLAG_CACHE_FIX = 8;
+const uint32_t LAYER_FLAG_ERROR_OVERFLOW = 16;
+const uint32_t LAYER_FLAG_SPLIT_ERRORS = 32;
+
+const uint8_t PARAM_TYPE_U64 = 1;
+const uint8_t PARAM_TYPE_F64 = 2;
+const uint8_t PARAM_TYPE_F32 = 3;
+const uint8_t PARAM_TYPE_U16 = 4;
+const uint8_t PARAM_TYPE_U32 = 5;
+const uint8_t PARAM_TYPE_PADDING = 6;
+
+// a 16-bit leaf error with this value is stored in the overflow layer
+const uint64_t ERROR_OVERFLOW = 65535;
+} // namespace container
+
+namespace detail {
+
+// records are packed, so parameters may not be naturally aligned
+template <typename T>
+inline T read_as(const char* ptr) {
+  T val;
+  std::memcpy(&val, ptr, sizeof(T));
+  return val;
+}
+
+inline size_t param_type_size(uint8_t type) {
+  switch (type) {
+  case container::PARAM_TYPE_U64:
+  case container::PARAM_TYPE_F64:
+    return 8;
+  case container::PARAM_TYPE_F32:
+  case container::PARAM_TYPE_U32:
+    return 4;
+  case container::PARAM_TYPE_U16:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+inline size_t fclamp(double inp, double bound) {
+  if (inp < 0.0) return 0;
+  return (inp > bound ? bound : (size_t)inp);
+}
+
+inline double exp1(double x) {
+  x = 1.0 + x / 64.0;
+  x *= x; x *= x; x *= x; x *= x;
+  x *= x; x *= x;
+  return x;
+}
+
+inline double phi(double x) {
+  return 1.0 / (1.0 + exp1(- 1.65451 * x));
+}
+
+// the searches used by the generated `find` function
+template <typename KeyT>
+inline size_t bl_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key) {
+  size_t n = hi - lo;
+  if (n == 0) return lo;
+  const KeyT* base = data + lo;
+  while (n > 1) {
+    size_t half = n / 2;
+    base = (base[half] < key ? base + half : base);
+    n -= half;
+  }
+  return (base - data) + (*base < key);
+}
+
+template <typename KeyT>
+inline size_t lin_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key) {
+  size_t count = 0;
+  for (size_t i = lo; i < hi; i++)
+    count += (data[i] < key);
+  return lo + count;
+}
+
+template <typename KeyT>
+inline size_t exp_lower_bound(const KeyT* data, size_t n, size_t guess, KeyT key) {
+  if (n == 0) return 0;
+  if (guess >= n) guess = n - 1;
+
+  size_t lo, hi;
+  size_t bound = 1;
+  if (data[guess] < key) {
+    while (guess + bound < n && data[guess + bound] < key)
+      bound *= 2;
+    lo = guess + bound / 2 + 1;
+    hi = (guess + bound < n ? guess + bound : n);
+  } else {
+    while (bound <= guess && !(data[guess - bound] < key))
+      bound *= 2;
+    lo = (bound <= guess ? guess - bound + 1 : 0);
+    hi = guess - bound / 2;
+  }
+  return bl_lower_bound(data, lo, hi, key);
+}
+
+// Where the parameters of the models of one layer are. A model's record
+// holds its parameters, then its error (on the last layer), then padding.
+struct Layer {
+  const char* data = nullptr;
+  uint32_t flags = 0;
+  size_t num_models = 0;
+  size_t record_bytes = 0;
+  size_t num_params = 0;
+  uint8_t types[container::MAX_PARAM_TYPES] = {};
+  size_t offsets[container::MAX_PARAM_TYPES] = {};
+  uint8_t err_type = 0;
+  // the offsets of the error, or of the left and right errors
+  size_t num_errors = 0;
+  size_t err_offsets[2] = {};
+
+  // reads the layer table entry at `entry`, returning false if the
+  // entry does not describe a layer of fixed size records
+  bool init(const char* base, const char* entry) {
+    flags = read_as<uint32_t>(entry);
+    const size_t ppm = read_as<uint32_t>(entry + 4);
+    const uint64_t offset = read_as<uint64_t>(entry + 8);
+    const uint64_t size = read_as<uint64_t>(entry + 16);
+    num_models = read_as<uint64_t>(entry + 24);
+    std::memcpy(types, entry + 32 + container::MODEL_NAME_SIZE, sizeof(types));
+
+    if (num_models == 0 || size % num_models != 0) return false;
+    if (ppm == 0 || ppm > container::MAX_PARAM_TYPES) return false;
+    data = base + offset;
+    record_bytes = size / num_models;
+
+    size_t pos = 0;
+    size_t num_fields = ppm;
+    if (types[ppm - 1] == container::PARAM_TYPE_PADDING)
+      num_fields--;
+    for (size_t i = 0; i < num_fields; i++) {
+      const size_t field_size = param_type_size(types[i]);
+      if (field_size == 0) return false;
+      offsets[i] = pos;
+      pos += field_size;
+    }
+    if (pos > record_bytes || (pos != record_bytes && num_fields == ppm))
+      return false;
+
+    num_params = num_fields;
+    if (flags & container::LAYER_FLAG_ERRORS) {
+      num_errors = (flags & container::LAYER_FLAG_SPLIT_ERRORS) ? 2 : 1;
+      if (num_params < num_errors + 1) return false;
+      num_params -= num_errors;
+      err_type = types[num_params];
+      if (err_type != container::PARAM_TYPE_U64 && err_type != container::PARAM_TYPE_U32
+          && err_type != container::PARAM_TYPE_U16)
+        return false;
+      for (size_t i = 0; i < num_errors; i++) {
+        if (types[num_params + i] != err_type) return false;
+        err_offsets[i] = offsets[num_params + i];
+      }
+    }
+    return true;
+  }
+
+  // true if the records hold only double parameters and 64-bit errors
+  // (if the layer has errors), without padding
+  bool packed() const {
+    for (size_t i = 0; i < num_params; i++) {
+      if (types[i] != container::PARAM_TYPE_F64) return false;
+    }
+    if (num_errors > 0 && err_type != container::PARAM_TYPE_U64) return false;
+    return record_bytes == 8 * num_params + 8 * num_errors;
+  }
+
+  // true if the parameters of the models on this layer can be passed to M
+  template <typename M>
+  bool fits() const {
+    if (num_params != M::num_params) return false;
+    for (size_t i = 0; i < num_params; i++) {
+      const bool ok = (M::float_model
+                       ? types[i] == container::PARAM_TYPE_F64 || types[i] == container::PARAM_TYPE_F32
+                       : types[i] == container::PARAM_TYPE_U64);
+      if (!ok) return false;
+    }
+    return true;
+  }
+
+  const char* record(size_t model) const {
+    return data + model * record_bytes;
+  }
+
+  double float_param(const char* rec, size_t idx) const {
+    const char* ptr = rec + offsets[idx];
+    return (types[idx] == container::PARAM_TYPE_F32
+            ? (double) read_as<float>(ptr) : read_as<double>(ptr));
+  }
+
+  uint64_t int_param(const char* rec, size_t idx) const {
+    return read_as<uint64_t>(rec + offsets[idx]);
+  }
+
+  // the error of the record, or its left (0) or right (1) error
+  uint64_t error(const char* rec, size_t idx) const {
+    const char* ptr = rec + err_offsets[idx];
+    switch (err_type) {
+    case container::PARAM_TYPE_U16: return read_as<uint16_t>(ptr);
+    case container::PARAM_TYPE_U32: return read_as<uint32_t>(ptr);
+    default: return read_as<uint64_t>(ptr);
+    }
+  }
+};
+
+} // namespace detail
+
+// The models, with the same code as the functions the generator emits.
+namespace models {
+
+struct Linear {
+  static constexpr const char* name = "linear";
+  static constexpr size_t num_params = 2;
+  static constexpr bool float_model = true;
+  static constexpr bool bounds_check = true;
+  static double eval(const double* p, double inp) {
+    return std::fma(p[1], inp, p[0]);
+  }
+};
+
+struct Cubic {
+  static constexpr const char* name = "cubic";
+  static constexpr size_t num_params = 4;
+  static constexpr bool float_model = true;
+  static constexpr bool bounds_check = false;
+  static double eval(const double* p, double x) {
+    auto v1 = std::fma(p[0], x, p[1]);
+    auto v2 = std::fma(v1, x, p[2]);
+    auto v3 = std::fma(v2, x, p[3]);
+    return v3;
+  }
+};
+
+struct LogLinear {
+  static constexpr const char* name = "loglinear";
+  static constexpr size_t num_params = 2;
+  static constexpr bool float_model = true;
+  static constexpr bool bounds_check = true;
+  static double eval(const double* p, double inp) {
+    return detail::exp1(std::fma(p[1], inp, p[0]));
+  }
+};
+
+struct Normal {
+  static constexpr const char* name = "ncdf";
+  static constexpr size_t num_params = 3;
+  static constexpr bool float_model = true;
+  static constexpr bool bounds_check = true;
+  static double eval(const double* p, double inp) {
+    return detail::phi((inp - p[0]) / p[1]) * p[2];
+  }
+};
+
+struct LogNormal {
+  static constexpr const char* name = "lncdf";
+  static constexpr size_t num_params = 3;
+  static constexpr bool float_model = true;
+  static constexpr bool bounds_check = true;
+  static double eval(const double* p, double inp) {
+    return detail::phi((fmax(0.0, log(inp)) - p[0]) / p[1]) * p[2];
+  }
+};
+
+struct Radix {
+  static constexpr const char* name = "radix";
+  static constexpr size_t num_params = 2;
+  static constexpr bool float_model = false;
+  static constexpr bool bounds_check = false;
+  static uint64_t eval(const uint64_t* p, uint64_t inp) {
+    return (inp << p[0]) >> (64 - p[1]);
+  }
+};
+
+struct BalancedRadixHigh {
+  static constexpr const char* name = "bradix_clamp_high";
+  static constexpr size_t num_params = 3;
+  static constexpr bool float_model = false;
+  static constexpr bool bounds_check = false;
+  static uint64_t eval(const uint64_t* p, uint64_t inp) {
+    uint64_t tmp = (inp << p[0]) >> (64 - p[1]);
+    return (tmp > p[2] ? p[2] : tmp);
+  }
+};
+
+struct BalancedRadixLow {
+  static constexpr const char* name = "bradix_clamp_low";
+  static constexpr size_t num_params = 3;
+  static constexpr bool float_model = false;
+  static constexpr bool bounds_check = false;
+  static uint64_t eval(const uint64_t* p, uint64_t inp) {
+    uint64_t tmp = (inp << p[0]) >> (64 - p[1]);
+    return (tmp < p[2] ? 0 : tmp - p[2]);
+  }
+};
+
+template <typename... Models>
+struct ModelList {};
+
+using RootModels = ModelList<Linear, Cubic, LogLinear, Normal, LogNormal,
+                             Radix, BalancedRadixHigh, BalancedRadixLow>;
+using LeafModels = ModelList<Linear, Cubic, LogLinear, Normal, LogNormal>;
+
+} // namespace models
+
+// How the leaf records are laid out. The packed formats are the default
+// output of the generator.
+enum class LeafFormat {
+  Generic,
+  Packed,
+  PackedWithErrors,
+  PackedWithSplitErrors,
+};
+
+enum class LoadMode {
+  // read the whole file into memory and verify its checksum
+  Read,
+  // map the file read-only and use the parameters in place. The file
+  // must not be modified while it is mapped.
+  MMap,
+  // like MMap, but pre-fault the whole mapping during load
+  MMapPopulate,
+};
+
+template <typename KeyT>
+class RMI {
+  static_assert(std::is_same<KeyT, uint64_t>::value || std::is_same<KeyT, uint32_t>::value
+                || std::is_same<KeyT, double>::value,
+                "RMI keys must be uint64_t, uint32_t, or double");
+
+public:
+  RMI() = default;
+  RMI(const RMI&) = delete;
+  RMI& operator=(const RMI&) = delete;
+  ~RMI() { release(); }
+
+  // Loads the RMI stored in the parameter file at `path`, replacing the
+  // RMI loaded before (if any). Returns false, leaving nothing loaded, if
+  // the file cannot be read, is corrupt, does not have keys of type KeyT,
+  // or holds an RMI this engine cannot evaluate.
+  bool load(const std::string& path, LoadMode mode = LoadMode::Read) {
+    release();
+    if (!(mode == LoadMode::Read ? read_file(path) : map_file(path, mode))) {
+      release();
+      return false;
+    }
+    if (!parse(mode == LoadMode::Read)
+        || !bind_root(models::RootModels())) {
+      release();
+      return false;
+    }
+    return true;
+  }
+
+  bool loaded() const { return lookup_fn != nullptr; }
+
+  // The position of `key` in the indexed data is within `*err` of the
+  // returned position. Must only be called once `load` succeeded.
+  uint64_t lookup(KeyT key, size_t* err) const {
+    return lookup_fn(*this, key, err);
+  }
+
+  uint64_t lookup(KeyT key) const {
+    return lookup_fn(*this, key, nullptr);
+  }
+
+  // Looks up each of the `n` keys, writing the positions to `out` and, if
+  // `errs` is not null, the errors to `errs`. The leaf records of a group
+  // of keys are prefetched before any of them are used.
+  void lookup_batch(const KeyT* keys, size_t n, uint64_t* out, size_t* errs) const {
+    batch_fn(*this, keys, n, out, errs);
+  }
+
+  // The index of the first of the `n` sorted keys in `data` that is not
+  // less than `key` (std::lower_bound), where `data` is the data the RMI
+  // was trained on.
+  size_t find(const KeyT* data, size_t n, KeyT key) const {
+    size_t err;
+    const size_t guess = lookup(key, &err);
+    if (!has_errors) return detail::exp_lower_bound(data, n, guess, key);
+
+    const size_t hi = (guess + err + 1 < n ? guess + err + 1 : n);
+    size_t lo = (guess > err ? guess - err : 0);
+    if (lo > hi) lo = hi;
+    if (err <= 16)
+      return detail::lin_lower_bound(data, lo, hi, key);
+    return detail::bl_lower_bound(data, lo, hi, key);
+  }
+
+  uint64_t num_rows() const { return rows; }
+  size_t size_bytes() const { return file_size; }
+  const std::string& root_model() const { return root_name; }
+  const std::string& leaf_model() const { return leaf_name; }
+
+  // without error bounds, lookups report the whole data as their error
+  bool errors() const { return has_errors; }
+
+private:
+  typedef uint64_t (*LookupFn)(const RMI&, KeyT, size_t*);
+  typedef void (*BatchFn)(const RMI&, const KeyT*, size_t, uint64_t*, size_t*);
+
+  template <typename Root>
+  size_t leaf_index(KeyT key) const {
+    if (leaves.num_models == 1) return 0;
+    if constexpr (Root::float_model) {
+      const double fpred = Root::eval(root_fparams, (double)key);
+      return (Root::bounds_check ? detail::fclamp(fpred, (double)leaves.num_models - 1.0)
+              : (uint64_t) fpred);
+    } else {
+      const uint64_t ipred = Root::eval(root_iparams, (uint64_t)key);
+      return (Root::bounds_check && ipred > leaves.num_models - 1
+              ? leaves.num_models - 1 : ipred);
+    }
+  }
+
+  // the error of the leaf, which is the larger of its left and right
+  // errors if they are stored separately
+  size_t leaf_error(const char* rec, size_t leaf) const {
+    if (!per_leaf_errors) return uniform_error;
+    uint64_t err = 0;
+    for (size_t i = 0; i < leaves.num_errors; i++) {
+      const uint64_t e = stored_error(rec, leaves.num_errors * leaf + i, i);
+      if (e > err) err = e;
+    }
+    return err;
+  }
+
+  // the `idx`th error of the record `rec`, whose index among all of the
+  // leaf errors is `error_index`
+  uint64_t stored_error(const char* rec, size_t error_index, size_t idx) const {
+    const uint64_t e = leaves.error(rec, idx);
+    if (overflow_count == 0 || e != container::ERROR_OVERFLOW) return e;
+
+    // the overflow layer holds (error index, error) pairs, sorted by index
+    size_t lo = 0, hi = overflow_count;
+    while (lo < hi) {
+      const size_t mid = (lo + hi) / 2;
+      if (detail::read_as<uint64_t>(overflows + 16 * mid) < error_index) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return detail::read_as<uint64_t>(overflows + 16 * lo + 8);
+  }
+
+  template <typename Leaf, LeafFormat Format>
+  uint64_t leaf_position(size_t leaf, KeyT key, size_t* err) const {
+    const char* rec;
+    double params[Leaf::num_params];
+    if constexpr (Format == LeafFormat::Generic) {
+      rec = leaves.record(leaf);
+      for (size_t i = 0; i < Leaf::num_params; i++)
+        params[i] = leaves.float_param(rec, i);
+    } else {
+      constexpr size_t record_bytes = 8 * Leaf::num_params
+        + (Format == LeafFormat::PackedWithErrors ? 8 : 0)
+        + (Format == LeafFormat::PackedWithSplitErrors ? 16 : 0);
+      rec = leaves.data + leaf * record_bytes;
+      for (size_t i = 0; i < Leaf::num_params; i++)
+        params[i] = detail::read_as<double>(rec + 8 * i);
+    }
+
+    const double fpred = Leaf::eval(params, (double)key);
+    if (err) {
+      if constexpr (Format == LeafFormat::PackedWithErrors) {
+        *err = detail::read_as<uint64_t>(rec + 8 * Leaf::num_params);
+      } else if constexpr (Format == LeafFormat::PackedWithSplitErrors) {
+        const uint64_t lo = detail::read_as<uint64_t>(rec + 8 * Leaf::num_params);
+        const uint64_t hi = detail::read_as<uint64_t>(rec + 8 * Leaf::num_params + 8);
+        *err = (lo > hi ? lo : hi);
+      } else if constexpr (Format == LeafFormat::Packed) {
+        *err = uniform_error;
+      } else {
+        *err = leaf_error(rec, leaf);
+      }
+    }
+    return detail::fclamp(fpred, (double)rows - 1.0);
+  }
+
+  template <typename Root, typename Leaf, LeafFormat Format>
+  static uint64_t lookup_impl(const RMI& rmi, KeyT key, size_t* err) {
+    return rmi.leaf_position<Leaf, Format>(rmi.leaf_index<Root>(key), key, err);
+  }
+
+  template <typename Root, typename Leaf, LeafFormat Format>
+  static void batch_impl(const RMI& rmi, const KeyT* keys, size_t n,
+                         uint64_t* out, size_t* errs) {
+    const size_t batch_size = 16;
+    size_t leaf_indexes[batch_size];
+    const size_t record_bytes = rmi.leaves.record_bytes;
+    for (size_t start = 0; start < n; start += batch_size) {
+      const size_t len = (n - start < batch_size ? n - start : batch_size);
+      const KeyT* bkeys = keys + start;
+      for (size_t i = 0; i < len; i++) {
+        leaf_indexes[i] = rmi.leaf_index<Root>(bkeys[i]);
+        const char* rec = rmi.leaves.record(leaf_indexes[i]);
+        __builtin_prefetch(rec);
+        if (64 % record_bytes != 0)
+          __builtin_prefetch(rec + record_bytes - 1);
+      }
+      for (size_t i = 0; i < len; i++) {
+        out[start + i] = rmi.leaf_position<Leaf, Format>(leaf_indexes[i], bkeys[i],
+                                                         errs ? errs + start + i : nullptr);
+      }
+    }
+  }
+
+  template <typename Root, typename Leaf>
+  bool bind() {
+    if (!root.fits<Root>() || !leaves.fits<Leaf>()) return false;
+    const char* rec = root.record(0);
+    for (size_t i = 0; i < Root::num_params; i++) {
+      if (Root::float_model) {
+        root_fparams[i] = root.float_param(rec, i);
+      } else {
+        root_iparams[i] = root.int_param(rec, i);
+      }
+    }
+    if (!leaves.packed()) {
+      bind_format<Root, Leaf, LeafFormat::Generic>();
+    } else if (per_leaf_errors && leaves.num_errors == 2) {
+      bind_format<Root, Leaf, LeafFormat::PackedWithSplitErrors>();
+    } else if (per_leaf_errors) {
+      bind_format<Root, Leaf, LeafFormat::PackedWithErrors>();
+    } else {
+      bind_format<Root, Leaf, LeafFormat::Packed>();
+    }
+    return true;
+  }
+
+  template <typename Root, typename Leaf, LeafFormat Format>
+  void bind_format() {
+    lookup_fn = &lookup_impl<Root, Leaf, Format>;
+    batch_fn = &batch_impl<Root, Leaf, Format>;
+  }
+
+  template <typename Root, typename... Leaves>
+  bool bind_leaf(models::ModelList<Leaves...>) {
+    return ((leaf_name == Leaves::name && bind<Root, Leaves>()) || ...);
+  }
+
+  template <typename... Roots>
+  bool bind_root(models::ModelList<Roots...>) {
+    return ((root_name == Roots::name && bind_leaf<Roots>(models::LeafModels())) || ...);
+  }
+
+  bool read_file(const std::string& path) {
+    std::ifstream infile(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!infile.good()) return false;
+    const std::streamoff size = infile.tellg();
+    if (size < (std::streamoff) container::HEADER_SIZE
+        || size % container::ALIGNMENT != 0)
+      return false;
+    infile.seekg(0);
+
+    char* buf = (char*) aligned_alloc(container::ALIGNMENT, size);
+    if (buf == NULL) return false;
+    base = buf;
+    file_size = size;
+    mapped = false;
+    infile.read(buf, size);
+    return infile.good();
+  }
+
+  bool map_file(const std::string& path, LoadMode mode) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < container::HEADER_SIZE) {
+      close(fd);
+      return false;
+    }
+    const int flags = (mode == LoadMode::MMapPopulate ? MAP_PRIVATE | MAP_POPULATE : MAP_PRIVATE);
+    void* addr = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+    base = (char*) addr;
+    file_size = st.st_size;
+    mapped = true;
+    return true;
+  }
+
+  // checks the header and layer table, and finds the layers
+  bool parse(bool verify_checksum) {
+    const char* header = base;
+    if (detail::read_as<uint64_t>(header) != container::MAGIC) return false;
+    if (detail::read_as<uint32_t>(header + 8) != container::VERSION) return false;
+
+    const uint32_t key_type = detail::read_as<uint32_t>(header + 12);
+    const bool key_ok = (std::is_same<KeyT, double>::value
+                         ? key_type == container::KEY_TYPE_F64
+                         : key_type == container::KEY_TYPE_U64 || key_type == container::KEY_TYPE_U32);
+    if (!key_ok) return false;
+
+    const size_t num_layers = detail::read_as<uint32_t>(header + 16);
+    const uint32_t header_flags = detail::read_as<uint32_t>(header + 20);
+    rows = detail::read_as<uint64_t>(header + 24);
+    if (detail::read_as<uint64_t>(header + 32) != file_size) return false;
+    if (num_layers < 2 || num_layers > 3) return false;
+
+    const size_t data_start = container::HEADER_SIZE + num_layers * container::LAYER_ENTRY_SIZE;
+    if (data_start > file_size) return false;
+    for (size_t i = 0; i < num_layers; i++) {
+      const char* entry = header + container::HEADER_SIZE + i * container::LAYER_ENTRY_SIZE;
+      const uint64_t offset = detail::read_as<uint64_t>(entry + 8);
+      const uint64_t size = detail::read_as<uint64_t>(entry + 16);
+      if (offset < data_start || offset % container::ALIGNMENT != 0
+          || offset > file_size || size > file_size - offset)
+        return false;
+      if (detail::read_as<uint32_t>(entry) & container::LAYER_FLAG_CACHE_FIX) return false;
+    }
+
+    if (verify_checksum) {
+      const size_t checked_from = (data_start + container::ALIGNMENT - 1)
+        / container::ALIGNMENT * container::ALIGNMENT;
+      uint64_t hash = container::FNV_OFFSET_BASIS;
+      for (size_t i = checked_from; i < file_size; i += 8) {
+        hash ^= detail::read_as<uint64_t>(base + i);
+        hash *= container::FNV_PRIME;
+      }
+      if (hash != detail::read_as<uint64_t>(header + 40)) return false;
+    }
+
+    const char* root_entry = header + container::HEADER_SIZE;
+    const char* leaf_entry = root_entry + container::LAYER_ENTRY_SIZE;
+    if (!root.init(base, root_entry) || root.num_models != 1) return false;
+    if (!leaves.init(base, leaf_entry)) return false;
+    root_name = model_name(root_entry);
+    leaf_name = model_name(leaf_entry);
+
+    overflow_count = 0;
+    if (num_layers == 3) {
+      detail::Layer overflow;
+      const char* entry = leaf_entry + container::LAYER_ENTRY_SIZE;
+      if (!overflow.init(base, entry)
+          || !(overflow.flags & container::LAYER_FLAG_ERROR_OVERFLOW)
+          || overflow.record_bytes != 16
+          || leaves.err_type != container::PARAM_TYPE_U16)
+        return false;
+      overflows = overflow.data;
+      overflow_count = overflow.num_models;
+    }
+
+    per_leaf_errors = (leaves.flags & container::LAYER_FLAG_ERRORS) != 0;
+    if (per_leaf_errors) {
+      has_errors = true;
+    } else if (header_flags & container::HEADER_FLAG_UNIFORM_ERROR) {
+      has_errors = true;
+      uniform_error = detail::read_as<uint64_t>(header + 48);
+    } else {
+      has_errors = false;
+      uniform_error = rows;
+    }
+    return true;
+  }
+
+  static std::string model_name(const char* entry) {
+    const char* name = entry + 32;
+    return std::string(name, strnlen(name, container::MODEL_NAME_SIZE));
+  }
+
+  void release() {
+    if (base != nullptr) {
+      if (mapped) {
+        munmap(base, file_size);
+      } else {
+        free(base);
+      }
+    }
+    base = nullptr;
+    file_size = 0;
+    lookup_fn = nullptr;
+    batch_fn = nullptr;
+  }
+
+  char* base = nullptr;
+  size_t file_size = 0;
+  bool mapped = false;
+
+  LookupFn lookup_fn = nullptr;
+  BatchFn batch_fn = nullptr;
+
+  uint64_t rows = 0;
+  std::string root_name;
+  std::string leaf_name;
+  detail::Layer root;
+  detail::Layer leaves;
+  double root_fparams[container::MAX_PARAM_TYPES] = {};
+  uint64_t root_iparams[container::MAX_PARAM_TYPES] = {};
+
+  bool has_errors = false;
+  bool per_leaf_errors = false;
+  uint64_t uniform_error = 0;
+  const char* overflows = nullptr;
+  size_t overflow_count = 0;
+};
+
+} // namespace rmi_engine
+
+#endif
@@ -0,0 +1,212 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+// Replacing the RMI used by concurrent readers without locks. The current
+// RMI is published through an atomic pointer, and an RMI that has been
+// replaced is freed once every reader has passed a quiescent state after
+// the replacement (quiescent state based reclamation, a form of RCU).
+//
+// A lookup costs the reader a single acquire load of the pointer (a plain
+// load on x86) on top of the lookup itself. In exchange, each reader thread
+// must periodically call `quiescent()` at a point where it does not hold
+// on to the RMI, e.g. between requests, and must call `offline()` before
+// blocking for a long time. A replaced RMI stays allocated until then.
+//
+// Usage:
+//   rmi_engine::SwappableRMI<uint64_t> rmi;
+//   rmi.load("rmi_data/v1_PARAMETERS");
+//
+//   // in each reader thread
+//   rmi_engine::SwappableRMI<uint64_t>::Reader reader(rmi);
+//   while (...) {
+//     size_t idx = reader.find(data, n, key);
+//     reader.quiescent();
+//   }
+//
+//   // in any thread
+//   rmi.load("rmi_data/v2_PARAMETERS");
+
+#ifndef RMI_HOT_SWAP_H
+#define RMI_HOT_SWAP_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "rmi_engine.h"
+
+namespace rmi_engine {
+
+template <typename KeyT>
+class SwappableRMI {
+  // the epoch announced by a reader that holds no reference to any RMI
+  static const uint64_t OFFLINE = UINT64_MAX;
+
+  struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> seen{OFFLINE};
+    std::atomic<bool> used{false};
+  };
+
+public:
+  // At most `max_readers` Reader objects may exist at the same time.
+  explicit SwappableRMI(size_t max_readers = 64)
+    : slots(new ReaderSlot[max_readers]), num_slots(max_readers) {}
+
+  SwappableRMI(const SwappableRMI&) = delete;
+  SwappableRMI& operator=(const SwappableRMI&) = delete;
+
+  // No readers may remain when the SwappableRMI is destroyed.
+  ~SwappableRMI() {
+    delete current.load(std::memory_order_relaxed);
+    for (auto& r : retired) delete r.first;
+  }
+
+  // Loads the RMI in the parameter file at `path` and, if that succeeds,
+  // makes it the current RMI. If loading fails, the current RMI is kept
+  // and false is returned.
+  bool load(const std::string& path, LoadMode mode = LoadMode::Read) {
+    std::unique_ptr<RMI<KeyT>> next(new RMI<KeyT>());
+    if (!next->load(path, mode)) return false;
+    publish(std::move(next));
+    return true;
+  }
+
+  // Makes `next` the current RMI. The RMI it replaces is freed by this or
+  // a later call to `publish` or `reclaim` once no reader can use it.
+  void publish(std::unique_ptr<RMI<KeyT>> next) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    const RMI<KeyT>* old = current.exchange(next.release(), std::memory_order_acq_rel);
+    const uint64_t retired_at = epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if (old != nullptr) retired.push_back(std::make_pair(old, retired_at));
+    reclaim_locked();
+  }
+
+  // Frees every replaced RMI that no reader can still be using, and
+  // returns the number of replaced RMIs that are still allocated.
+  size_t reclaim() {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    return reclaim_locked();
+  }
+
+  // Waits until every replaced RMI has been freed. This requires every
+  // online reader to pass a quiescent state.
+  void synchronize() {
+    while (reclaim() > 0) std::this_thread::yield();
+  }
+
+  bool loaded() const {
+    return current.load(std::memory_order_acquire) != nullptr;
+  }
+
+  // A thread that reads the current RMI. Each reader thread needs its own
+  // Reader, which is online when it is constructed. A replaced RMI cannot
+  // be freed until every online reader has called `quiescent` after the
+  // replacement, so the RMI returned by `rmi` (or used by a lookup) stays
+  // valid until the reader's next call to `quiescent` or `offline`.
+  class Reader {
+  public:
+    explicit Reader(SwappableRMI& owner) : owner(owner), slot(owner.claim_slot()) {
+      online();
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    ~Reader() {
+      offline();
+      slot->used.store(false, std::memory_order_release);
+    }
+
+    // The current RMI. Must only be called once an RMI has been loaded.
+    const RMI<KeyT>& rmi() const {
+      return *owner.current.load(std::memory_order_acquire);
+    }
+
+    uint64_t lookup(KeyT key, size_t* err) const {
+      return rmi().lookup(key, err);
+    }
+
+    size_t find(const KeyT* data, size_t n, KeyT key) const {
+      return rmi().find(data, n, key);
+    }
+
+    // Announces that this reader no longer uses any RMI it obtained before.
+    void quiescent() {
+      slot->seen.store(owner.epoch.load(std::memory_order_acquire),
+                       std::memory_order_release);
+    }
+
+    // Announces that this reader will not use any RMI until `online` is
+    // called, so that it does not delay reclamation while it is idle.
+    void offline() {
+      slot->seen.store(OFFLINE, std::memory_order_release);
+    }
+
+    void online() {
+      slot->seen.store(owner.epoch.load(std::memory_order_acquire),
+                       std::memory_order_relaxed);
+      // the announcement must be visible before the pointer is read, or
+      // a writer could miss this reader and free an RMI it is about to use
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+  private:
+    SwappableRMI& owner;
+    ReaderSlot* slot;
+  };
+
+private:
+  ReaderSlot* claim_slot() {
+    for (size_t i = 0; i < num_slots; i++) {
+      bool expected = false;
+      if (!slots[i].used.load(std::memory_order_relaxed)
+          && slots[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        return &slots[i];
+    }
+    throw std::length_error("Too many concurrent readers for SwappableRMI");
+  }
+
+  size_t reclaim_locked() {
+    // pairs with the fence in Reader::online
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t min_seen = OFFLINE;
+    for (size_t i = 0; i < num_slots; i++) {
+      const uint64_t seen = slots[i].seen.load(std::memory_order_acquire);
+      if (seen < min_seen) min_seen = seen;
+    }
+
+    // a reader that announced epoch e loaded the current pointer after
+    // every RMI retired at or before e was replaced
+    size_t kept = 0;
+    for (auto& r : retired) {
+      if (r.second <= min_seen) {
+        delete r.first;
+      } else {
+        retired[kept++] = r;
+      }
+    }
+    retired.resize(kept);
+    return kept;
+  }
+
+  std::atomic<const RMI<KeyT>*> current{nullptr};
+  std::atomic<uint64_t> epoch{0};
+  std::unique_ptr<ReaderSlot[]> slots;
+  const size_t num_slots;
+
+  std::mutex writer_mutex;
+  std::vector<std::pair<const RMI<KeyT>*, uint64_t>> retired;
+};
+
+} // namespace rmi_engine
+
+#endif
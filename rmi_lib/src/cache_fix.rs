@@ -1,17 +1,56 @@
 use log::*;
-use crate::models::TrainingKey;
+use rayon::prelude::*;
+use crate::models::{TrainingKey, ModelParam};
 use crate::RMITrainingData;
 
+/// A key type that bounded RMIs can be built on.
+pub trait SplineKey: TrainingKey + PartialOrd {
+    /// the largest key below this one
+    fn predecessor(&self) -> Self;
+
+    /// the distance from `from` to this key, computed as the generated code
+    /// does: in the key type, then converted to a double
+    fn distance_from(&self, from: Self) -> f64;
+
+    /// the key as it is stored in the spline, which keeps the key type
+    fn to_param(&self) -> ModelParam;
+}
+
+impl SplineKey for u64 {
+    fn predecessor(&self) -> Self { *self - 1 }
+    fn distance_from(&self, from: Self) -> f64 { (*self - from) as f64 }
+    fn to_param(&self) -> ModelParam { ModelParam::Int(*self) }
+}
+
+impl SplineKey for u32 {
+    fn predecessor(&self) -> Self { *self - 1 }
+    fn distance_from(&self, from: Self) -> f64 { (*self - from) as f64 }
+    fn to_param(&self) -> ModelParam { ModelParam::Int32(*self) }
+}
+
+impl SplineKey for f64 {
+    fn predecessor(&self) -> Self {
+        // the next representable double towards negative infinity
+        if *self == 0.0 {
+            return -f64::from_bits(1);
+        }
+        let bits = self.to_bits();
+        return f64::from_bits(if *self > 0.0 { bits - 1 } else { bits + 1 });
+    }
+    fn distance_from(&self, from: Self) -> f64 { *self - from }
+    fn to_param(&self) -> ModelParam { ModelParam::Float(*self) }
+}
+
 #[derive(Debug)]
-pub struct Spline {
-    from_x: u64,
+pub struct Spline<K: SplineKey> {
+    from_x: K,
     from_y: usize,
-    to_x: u64,
+    to_x: K,
     to_y: usize
 }
 
-impl Spline {
-    fn from(pt1: (u64, usize), pt2: (u64, usize)) -> Spline {
+impl<K: SplineKey> Spline<K> {
+    fn from(pt1: (K, usize), pt2: (K, usize)) -> Spline<K> {
         assert!(pt1.0 <= pt2.0,
                 "Cannot construct spline from {:?} to {:?}", pt1, pt2);
         assert!(pt1.1 <= pt2.1,
@@ -20,126 +59,127 @@ impl Spline {
                         to_x: pt2.0, to_y: pt2.1 };
     }
 
-    fn with_new_dest(&self, dest: (u64, usize)) -> Spline {
-        assert!(dest.0 >= self.from_x,
-                "When source x is {}, cannot set dest x to {}",
-                self.from_x, dest.0);
-        assert!(dest.1 >= self.from_y);
-        return Spline { from_x: self.from_x, from_y: self.from_y,
-                        to_x: dest.0, to_y: dest.1 };
-    }
-    
-    fn end(&self) -> (u64, usize) {
-        return (self.to_x, self.to_y);
-    }
-
-    fn predict(&self, inp: u64) -> usize {
+    fn predict(&self, inp: K) -> usize {
         let v0 = self.from_y as f64;
         let v1 = self.to_y as f64;
-        let t = ((inp - self.from_x) as f64) / (self.to_x - self.from_x) as f64;
+        let t = inp.distance_from(self.from_x) / self.to_x.distance_from(self.from_x);
 
         return (1.0 - t).mul_add(v0, t * v1) as usize;
     }
 }
 
-struct SplineFit {
-    spline: Option<Spline>,
-    curr_pts: Vec<(u64, usize)>,
-    line_size: usize
-}
-
-impl SplineFit {
+// the number of keys fit together, at most. Each chunk is fit on its own
+// (in parallel) and ends with a spline point, so the spline is the same for
+// any number of threads.
+const CHUNK_SIZE: usize = 1 << 20;
+
+// how far outside of its line the cone lets a point be predicted. Points
+// that fall right on the edge of their line are common (the offsets are
+// integers), and whether they are predicted in the line is up to rounding,
+// so the cone leaves them to the exact check.
+const CONE_TOLERANCE: f64 = 1e-6;
+
+// Fits an error-bounded spline to `pts`, which are sorted by their distinct
+// keys. Each segment starts at the end of the last one and extends greedily
+// until a point it passes over would be predicted in the wrong line. The
+// slopes from the start of the segment that keep a point in its line form an
+// interval, so instead of checking every point passed for each new end, the
+// intersection of their intervals (a cone that only shrinks) decides in
+// constant time whether the next point can end the segment. Each finished segment is then checked with the same arithmetic as
+// the generated code, and ends at the first point it predicts in the wrong
+// line, if any.
+fn fit_spline<K: SplineKey>(pts: &[(K, usize)], line_size: usize) -> Vec<(K, usize)> {
+    let mut spline = Vec::new();
+    if pts.is_empty() { return spline; }
 
-    pub fn new(line_size: usize) -> SplineFit {
-        return SplineFit {
-            spline: None,
-            curr_pts: Vec::new(),
-            line_size
-        };
-    }
+    let in_line = |segment: &Spline<K>, pt: &(K, usize)| {
+        segment.predict(pt.0) / line_size == pt.1 / line_size
+    };
 
-    pub fn add_point(&mut self, point: (u64, usize)) -> Option<(u64, usize)> {
-        if self.spline.is_none() {
-            self.spline = Some(Spline::from(point, point));
-            return Some(point);
-        }
-        
-        // check to see if the current spline can include this point
-        let last_spline = self.spline.as_ref().unwrap();
-        let proposed_spline = last_spline.with_new_dest(point);
-
-        self.curr_pts.push(last_spline.end());
-        if self.check_spline(&proposed_spline) {
-            // accept this proposal, it works.
-            self.spline = Some(proposed_spline);
-            return None;
-        } else {
-            // reject this proposal, start a new spline.
-            let prev_pt = last_spline.end();
-            assert!(point.0 > prev_pt.0,
-                    "new point: {:?} prev point: {:?}",
-                    point, prev_pt);
-
-            self.spline = Some(Spline::from(prev_pt, point));
-            self.curr_pts.clear();
-            self.curr_pts.push(point);
-            return Some(prev_pt);
+    spline.push(pts[0]);
+    let mut start = 0;
+    while start + 1 < pts.len() {
+        let (x0, y0) = pts[start];
+        let mut min_slope = std::f64::NEG_INFINITY;
+        let mut max_slope = std::f64::INFINITY;
+
+        let mut end = start + 1;
+        while end + 1 < pts.len() {
+            // the current end becomes a point the segment passes over
+            let (x, y) = pts[end];
+            let dx = x.distance_from(x0);
+            let line_start = (y / line_size * line_size) as f64;
+            min_slope = f64::max(min_slope, (line_start - CONE_TOLERANCE - y0 as f64) / dx);
+            max_slope = f64::min(max_slope,
+                                 (line_start + line_size as f64 + CONE_TOLERANCE - y0 as f64) / dx);
+
+            let (next_x, next_y) = pts[end + 1];
+            let slope = (next_y - y0) as f64 / next_x.distance_from(x0);
+            if slope < min_slope || slope >= max_slope {
+                break;
+            }
+            end += 1;
         }
-    }
 
+        loop {
+            let segment = Spline::from(pts[start], pts[end]);
+            match pts[start + 1..end].iter().position(|pt| !in_line(&segment, pt)) {
+                None => break,
+                Some(offset) => end = start + 1 + offset
+            };
+        }
 
-    pub fn finish(self) -> Option<(u64, usize)> {
-        return self.spline.map(|s| s.end());
+        spline.push(pts[end]);
+        start = end;
     }
 
-    
-    fn check_spline(&self, spline: &Spline) -> bool {
-        return self.curr_pts.iter()
-            .all(|pt| {
-                let predicted_line: usize = spline.predict(pt.0) / self.line_size;
-                let correct_line: usize = pt.1 / self.line_size;
-                predicted_line == correct_line
-            });
+    return spline;
+}
+
+// The points the spline is fit to for the keys in [start, end): every
+// distinct key, preceded by the key just below it when that key is not in
+// the data, so that the keys between two data keys are predicted in the
+// line of the larger one, which is their lower bound.
+fn spline_points<K: SplineKey>(data: &RMITrainingData<K>,
+                               start: usize, end: usize) -> Vec<(K, usize)> {
+    let mut last_key = if start == 0 { None } else { Some(data.get_key(start - 1)) };
+    let mut pts = Vec::with_capacity(2 * (end - start));
+    for (key, offset) in data.iter_range(start, end) {
+        match last_key {
+            Some(last_key) if key == last_key => {
+                // a duplicate, which is at the offset of its first copy
+                continue;
+            },
+            Some(last_key) => {
+                assert!(key.predecessor() >= last_key,
+                        "key: {:?} last key: {:?}, key - e: {:?}",
+                        key, last_key, key.predecessor());
+                if key.predecessor() != last_key {
+                    pts.push((key.predecessor(), offset));
+                }
+            },
+            // the point before the first key, unless it is the smallest key
+            None if key != K::zero_value() => pts.push((key.predecessor(), offset)),
+            None => {}
+        };
+        pts.push((key, offset));
+        last_key = Some(key);
     }
+    return pts;
 }
 
-pub fn cache_fix(data: &RMITrainingData<u64>, line_size: usize) -> Vec<(u64, usize)> {
+pub fn cache_fix<K: SplineKey>(data: &RMITrainingData<K>, line_size: usize) -> Vec<(K, usize)> {
     assert!(data.len() > line_size,
             "Cannot apply a cachefix with fewer items than the line size");
     info!("Fitting cachefix spline to {} datapoints", data.len());
-    
-    let mut fit = SplineFit::new(line_size);
-    let mut spline = Vec::new();
-
-    // Potential speedup here by carefully building a spline over the first
-    // and last element of each cache line. Requires careful handling of duplicates,
-    // especially when they cross cache lines.
-    let mut last_key = 0;
-    for (key, offset) in data.iter_unique() {
-        assert!(key.minus_epsilon() >= last_key,
-                "key: {:?} last key: {:?}, key - e: {:?}",
-                key, last_key, key.minus_epsilon());
-        
-        if key.minus_epsilon() != last_key {
-            match fit.add_point((key.minus_epsilon(), offset)) {
-                None => {},
-                Some(p) => spline.push(p)
-            };
-        }
-        
-        match fit.add_point((key, offset)) {
-            None => {},
-            Some(p) => spline.push(p)
-        };
-        
-        last_key = key;
-    }
 
-
-    match fit.finish() {
-        None => {},
-        Some(p) => spline.push(p)
-    };
+    // the last point of a chunk and the first point of the next one are
+    // consecutive, so the segment between them passes over no points
+    let chunks = data.chunk_bounds((data.len() + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    let spline: Vec<(K, usize)> = chunks.par_iter()
+        .map(|&(start, end)| fit_spline(&spline_points(data, start, end), line_size))
+        .collect::<Vec<Vec<(K, usize)>>>()
+        .concat();
     
     info!("Bounded spline compressed data to {}% of original ({} points, constructed from {} points).",
           ((spline.len() as f64 / data.len() as f64)*100.0).round(),
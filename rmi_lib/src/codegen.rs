@@ -14,7 +14,9 @@ use log::*;
 use std::collections::HashSet;
 use std::io::Write;
 use std::str;
-use crate::train::TrainedRMI;
+use crate::train::{TrainedRMI, EstimatedRMI};
+use crate::container;
+use crate::string_keys::StringKeyEncoding;
 use std::fs::File;
 use std::io::BufWriter;
 use std::path::Path;
@@ -40,6 +42,213 @@ macro_rules! array_name {
     }
 }
 
+// with quantized errors, leaf errors that are at least this are marked
+// with this value and stored in the overflow table.
+const ERROR_OVERFLOW: u64 = std::u16::MAX as u64;
+
+// leaves whose left and right errors add up to at most twice this are
+// searched with a linear scan when the search strategy is `auto`. The
+// whole window (33 keys) spans only a few cache lines, and the scan has no
+// branch mispredictions.
+const LINEAR_SEARCH_MAX_ERR: u64 = 16;
+
+// the most NUMA nodes the parameters are copied to, one for each bit of the
+// node mask passed to `mbind`
+const MAX_NUMA_NODES: usize = 64;
+
+/// The search used by the generated `find` function to locate a key inside
+/// the error window around the RMI's prediction.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum SearchStrategy {
+    /// branchless binary search over the whole window
+    Binary,
+
+    /// gallop outward from the prediction, ignoring the error bound
+    Exponential,
+
+    /// count the keys in the window smaller than the lookup key
+    Linear,
+
+    /// interpolation steps inside the window, finished by binary search
+    Interpolation,
+
+    /// linear search on leaves with a small error, binary search otherwise
+    Auto,
+}
+
+impl SearchStrategy {
+    pub fn from_name(name: &str) -> Option<SearchStrategy> {
+        return match name {
+            "binary" => Some(SearchStrategy::Binary),
+            "exponential" => Some(SearchStrategy::Exponential),
+            "linear" => Some(SearchStrategy::Linear),
+            "interpolation" => Some(SearchStrategy::Interpolation),
+            "auto" => Some(SearchStrategy::Auto),
+            _ => None
+        };
+    }
+
+    fn standard_functions(&self) -> Vec<StdFunctions> {
+        return match self {
+            SearchStrategy::Binary => vec![StdFunctions::BranchlessLowerBound],
+            SearchStrategy::Exponential => vec![StdFunctions::BranchlessLowerBound,
+                                                StdFunctions::ExponentialLowerBound],
+            SearchStrategy::Linear => vec![StdFunctions::LinearLowerBound],
+            SearchStrategy::Interpolation => vec![StdFunctions::BranchlessLowerBound,
+                                                  StdFunctions::InterpolationLowerBound],
+            SearchStrategy::Auto => vec![StdFunctions::BranchlessLowerBound,
+                                         StdFunctions::LinearLowerBound],
+        };
+    }
+}
+
+/// The layout of the spline points of a bounded RMI, which its lookups
+/// search for the spline segment holding the key.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum CacheFixLayout {
+    /// (key, offset) pairs, binary searched inside the window predicted
+    /// by the RMI
+    Packed,
+
+    /// the keys and offsets in separate arrays, so the search only touches
+    /// keys. Small windows are scanned linearly, larger ones binary
+    /// searched without branches.
+    Soa,
+
+    /// the keys and offsets in Eytzinger (breadth first) order, searched
+    /// from the root without branches. The RMI's window is not used, but
+    /// the top levels of the tree stay cached and each step prefetches
+    /// the nodes three levels down.
+    Eytzinger,
+}
+
+impl CacheFixLayout {
+    pub fn from_name(name: &str) -> Option<CacheFixLayout> {
+        return match name {
+            "packed" => Some(CacheFixLayout::Packed),
+            "soa" => Some(CacheFixLayout::Soa),
+            "eytzinger" => Some(CacheFixLayout::Eytzinger),
+            _ => None
+        };
+    }
+}
+
+/// The pages that hold the parameters copied into memory by `load`.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum HugePages {
+    /// memory from `aligned_alloc`
+    None,
+
+    /// anonymous memory that the kernel is asked to back with transparent
+    /// huge pages
+    Transparent,
+
+    /// explicit 2 MB huge pages (`MAP_HUGETLB`), from the pool reserved in
+    /// `/sys/kernel/mm/hugepages`, or transparent huge pages if there are
+    /// not enough of them
+    Explicit2M,
+
+    /// explicit 1 GB huge pages, like `Explicit2M`
+    Explicit1G,
+}
+
+impl HugePages {
+    pub fn from_name(name: &str) -> Option<HugePages> {
+        return match name {
+            "thp" => Some(HugePages::Transparent),
+            "2mb" => Some(HugePages::Explicit2M),
+            "1gb" => Some(HugePages::Explicit1G),
+            _ => None
+        };
+    }
+
+    // the size that allocations of the parameters are rounded up to, and
+    // the log2 of the size of an explicit huge page
+    fn page_size(&self) -> (usize, Option<u32>) {
+        return match self {
+            HugePages::None => (4096, None),
+            HugePages::Transparent => (1 << 21, None),
+            HugePages::Explicit2M => (1 << 21, Some(21)),
+            HugePages::Explicit1G => (1 << 30, Some(30)),
+        };
+    }
+}
+
+/// Options controlling the shape of the generated C++ code.
+pub struct CodegenOptions {
+    /// report the maximum error of each lookup (the `err` parameter)
+    pub include_errors: bool,
+
+    /// number of keys whose leaf parameters are prefetched together
+    /// by `lookup_prefetch`
+    pub prefetch_batch_size: usize,
+
+    /// the search used by `find` to finish a lookup
+    pub search: SearchStrategy,
+
+    /// write all parameter arrays into a single file, which `load` maps
+    /// read-only instead of copying into memory
+    pub mmap: bool,
+
+    /// pre-fault the whole mapping at load time (`MAP_POPULATE`)
+    pub mmap_populate: bool,
+
+    /// ask the kernel to back the mapping with transparent huge pages
+    pub mmap_huge_pages: bool,
+
+    /// without `mmap`, the pages to copy the parameters into
+    pub huge_pages: HugePages,
+
+    /// without `mmap`, copy the parameters to every NUMA node, so that each
+    /// thread looks them up in the copy on the node it first ran a lookup on
+    pub numa_replicate: bool,
+
+    /// pad each last-layer record (the leaf parameters and error) to a
+    /// multiple of this many bytes so that no record straddles a cache
+    /// line, or 0 for no padding
+    pub leaf_alignment: usize,
+
+    /// store last-layer errors in the narrowest integer type that can
+    /// represent all of them exactly
+    pub narrow_errors: bool,
+
+    /// store last-layer errors in 16 bits, moving the errors that do not
+    /// fit into a side table
+    pub quantize_errors: bool,
+
+    /// the encoding of string keys, which must be set for an RMI over
+    /// strings (see `string_keys`)
+    pub string_keys: Option<StringKeyEncoding>,
+
+    /// the layout of the spline points of a bounded RMI
+    pub cache_fix_layout: CacheFixLayout,
+
+    /// count, on each thread, the leaves, errors, clamped predictions, and
+    /// spline search windows of every lookup (see `generate_instrumentation`)
+    pub instrument: bool,
+}
+
+impl Default for CodegenOptions {
+    fn default() -> CodegenOptions {
+        return CodegenOptions {
+            include_errors: true,
+            prefetch_batch_size: 16,
+            search: SearchStrategy::Auto,
+            mmap: false,
+            mmap_populate: false,
+            mmap_huge_pages: false,
+            huge_pages: HugePages::None,
+            numa_replicate: false,
+            leaf_alignment: 0,
+            narrow_errors: false,
+            quantize_errors: false,
+            string_keys: None,
+            cache_fix_layout: CacheFixLayout::Packed,
+            instrument: false,
+        };
+    }
+}
+
 impl LayerParams {
 
     fn new(idx: usize,
@@ -112,8 +321,7 @@ impl LayerParams {
         }; 
     }
 
-    fn pointer_type(&self) -> &'static str {
-        assert!(self.requires_malloc());
+    fn element_type(&self) -> &'static str {
         return match self {
             LayerParams::Array(_, _, params) => params[0].c_type(),
             LayerParams::MixedArray(_, _, _) => "char",
@@ -121,46 +329,6 @@ impl LayerParams {
         };
     }
     
-    fn to_decl<T: Write>(&self, target: &mut T) -> Result<(), std::io::Error> {
-        match self {
-            LayerParams::Constant(_, _) => {
-                panic!("Cannot forward-declare constants");
-            }
-
-            LayerParams::Array(idx, _, params) => {
-                if !self.requires_malloc()  {
-                    let num_items: usize = params.iter().map(|p| p.len()).sum();
-                    writeln!(
-                        target,
-                        "{} {}[{}];",
-                        params[0].c_type(),
-                        array_name!(idx),
-                        num_items
-                    )?;
-                } else { 
-                    writeln!(
-                        target,
-                        "{}* {};",
-                        params[0].c_type(),
-                        array_name!(idx)
-                    )?;
-                }
-            },
-
-            LayerParams::MixedArray(idx, _, _) => {
-                assert!(self.requires_malloc());
-                writeln!(
-                    target,
-                    "char* {};",
-                    array_name!(idx)
-                )?;
-            }
-        };
-
-        return Result::Ok(());
-    }
-
-
     fn write_to<T: Write>(&self, target: &mut T) -> Result<(), std::io::Error> {
         match self {   
             LayerParams::Array(_idx, _, params) |
@@ -176,8 +344,12 @@ impl LayerParams {
                 }
                 return Ok(());
             },
-            LayerParams::Constant(_, _) =>
-                panic!("Cannot write constant parameters to binary file.")
+            LayerParams::Constant(_, params) => {
+                for itm in params {
+                    itm.write_to(target)?;
+                }
+                return Ok(());
+            }
         };
     }
 
@@ -212,6 +384,30 @@ impl LayerParams {
         return self.params().iter().map(|p| p.size()).sum();
     }
 
+    // size in bytes of the parameters of one model on this layer
+    fn bytes_per_model(&self) -> usize {
+        return self.params().iter().take(self.params_per_model())
+            .map(|p| p.size()).sum();
+    }
+
+    // an expression for the address of the parameters of the model at
+    // `model_index`, or None if the parameters are not stored per-model
+    // in memory (constants, or a single array parameter).
+    fn address_of(&self, model_index: &str) -> Option<String> {
+        if self.params()[0].is_array() {
+            return None;
+        }
+        
+        return match self {
+            LayerParams::Constant(_, _) => None,
+            LayerParams::Array(idx, params_per_model, _) =>
+                Some(format!("&{}[{}*{}]", array_name!(idx), params_per_model, model_index)),
+            LayerParams::MixedArray(idx, _, _) =>
+                Some(format!("{} + ({} * {})", array_name!(idx),
+                             model_index, self.bytes_per_model()))
+        };
+    }
+
 
     fn access_by_const<T: Write>(
         &self,
@@ -285,21 +481,35 @@ impl LayerParams {
         return Result::Ok(());
     }
 
-    fn with_zipped_errors(&self, lle: &[u64]) -> LayerParams {
+    fn with_zipped_errors(&self, lle: &[Vec<u64>], options: &CodegenOptions) -> LayerParams {
         
         let params = self.params();
         // integrate the errors into the model parameters of the last
-        // layer to save a cache miss.
+        // layer to save a cache miss. The records are padded as requested,
+        // and the layer itself is 64-byte aligned in the parameter file.
+        // TODO a lot of unneeded copying going on here...
+        let num_errors = lle.first().map_or(1, |errs| errs.len());
+        let max_err = lle.iter().flatten().copied().max().unwrap_or(0);
+        let (record_bytes, err_bytes) = leaf_record_size(self.bytes_per_model(), max_err,
+                                                         num_errors, options);
+        let padding = record_bytes - self.bytes_per_model() - num_errors * err_bytes;
         
-        // TODO we should add padding to make sure each of these are
-        // cache-aligned. Also a lot of unneeded copying going on here...
         let combined_lle_params: Vec<ModelParam> =
             params.chunks(self.params_per_model())
             .zip(lle)
-            .flat_map(|(mod_params, err)| {
+            .flat_map(|(mod_params, errs)| {
                 let mut to_r: Vec<ModelParam> = Vec::new();
                 to_r.extend_from_slice(mod_params);
-                to_r.push(ModelParam::Int(*err));
+                for err in errs {
+                    to_r.push(match err_bytes {
+                        2 => ModelParam::Short(u64::min(*err, ERROR_OVERFLOW) as u16),
+                        4 => ModelParam::Int32(*err as u32),
+                        _ => ModelParam::Int(*err)
+                    });
+                }
+                if padding > 0 {
+                    to_r.push(ModelParam::Padding(padding));
+                }
                 to_r
             }).collect();
 
@@ -309,7 +519,9 @@ impl LayerParams {
             false
         };
         
-        return LayerParams::new(self.index(), is_constant, self.params_per_model() + 1,
+        let params_per_model = self.params_per_model() + num_errors
+            + if padding > 0 { 1 } else { 0 };
+        return LayerParams::new(self.index(), is_constant, params_per_model,
                                 combined_lle_params);
                                 
     }
@@ -372,59 +584,806 @@ macro_rules! model_index_from_output {
     };
 }
 
+// the condition under which `model_index_from_output!` clamps a prediction
+// to `bound`, for instrumented lookups
+fn clamp_condition(from: &ModelDataType, bound: usize) -> String {
+    return match from {
+        ModelDataType::Float => format!("fpred < 0.0 || fpred > {}.0 - 1.0", bound),
+        ModelDataType::Int => format!("ipred > {} - 1", bound),
+        ModelDataType::Int128 => format!("i128pred > {} - 1", bound),
+    };
+}
+
+// Returns the size in bytes of one last-layer record (the leaf's parameters,
+// its `num_errors` errors, and any padding) along with the size of each
+// error. With padding, records are at least `leaf_alignment` bytes and
+// either evenly divide a cache line or are a multiple of it, so a record
+// never straddles two lines.
+fn leaf_record_size(model_bytes: usize, max_err: u64, num_errors: usize,
+                    options: &CodegenOptions) -> (usize, usize) {
+    let err_bytes = if options.quantize_errors {
+        2
+    } else if !options.narrow_errors || max_err > u64::from(std::u32::MAX) {
+        8
+    } else if max_err > u64::from(std::u16::MAX) {
+        4
+    } else {
+        2
+    };
+
+    let unpadded = model_bytes + num_errors * err_bytes;
+    let align = options.leaf_alignment;
+    if align == 0 {
+        return (unpadded, err_bytes);
+    }
+    
+    assert!(align.is_power_of_two() && align <= 64,
+            "Leaf alignment must be 16, 32, or 64 bytes, not {}", align);
+    let mut padded = (unpadded + align - 1) / align * align;
+    while 64 % padded != 0 && padded % 64 != 0 {
+        padded += align;
+    }
+    return (padded, err_bytes);
+}
+
+// The errors stored for each leaf: its left and right errors, or just the
+// larger of the two for bounded RMIs, whose errors are the width of the
+// search over the spline points.
+fn stored_errors(rmi: &TrainedRMI) -> Vec<Vec<u64>> {
+    return rmi.last_layer_max_l1s.iter()
+        .map(|&(left, right)| if rmi.cache_fix.is_none() {
+            vec![left, right]
+        } else {
+            vec![u64::max(left, right)]
+        }).collect();
+}
+
 pub fn rmi_size(rmi: &TrainedRMI) -> u64 {
+    return rmi_size_for(rmi, &CodegenOptions::default());
+}
+
+/// The size of the RMI when generated with `options`, including the
+/// padding of the last layer records.
+pub fn rmi_size_for(rmi: &TrainedRMI, options: &CodegenOptions) -> u64 {
     // compute the RMI size (used in the header, compute here before consuming)
     let mut num_total_bytes = 0;
-    for layer in rmi.rmi.iter() {
+    let (last_layer, inner_layers) = rmi.rmi.split_last().unwrap();
+    for layer in inner_layers.iter() {
         let model_on_this_layer_size: usize = layer[0].params().iter().map(|p| p.size()).sum();
         
         // assume all models on this layer have the same size
         num_total_bytes += model_on_this_layer_size * layer.len();
     }
 
-    if !rmi.last_layer_max_l1s.is_empty() {
-        num_total_bytes += rmi.rmi.last().unwrap().len() * 8;
+    let leaf_size: usize = last_layer[0].params().iter().map(|p| p.size()).sum();
+    let lle = stored_errors(rmi);
+    let num_errors = lle.first().map_or(0, |errs| errs.len());
+    if lle.len() > 1 {
+        let max_err = lle.iter().flatten().copied().max().unwrap();
+        num_total_bytes += leaf_record_size(leaf_size, max_err, num_errors, options).0
+            * last_layer.len();
+        if options.quantize_errors {
+            num_total_bytes += lle.iter().flatten().filter(|e| **e >= ERROR_OVERFLOW).count() * 16;
+        }
+    } else {
+        num_total_bytes += (leaf_size + num_errors * 8) * last_layer.len();
     }
 
     if rmi.cache_fix.is_some() {
-        num_total_bytes += rmi.cache_fix.as_ref().unwrap().1.len() * 16;
+        num_total_bytes += rmi.cache_fix.as_ref().unwrap().1.iter()
+            .map(|(key, _)| key.size() + 8)
+            .sum::<usize>();
+        if options.cache_fix_layout == CacheFixLayout::Eytzinger {
+            // the unused root slot of both arrays
+            num_total_bytes += rmi.cache_fix.as_ref().unwrap().1[0].0.size() + 8;
+        }
     }
     
     return num_total_bytes as u64;
 }
 
+/// The size an RMI estimated by `train::estimate` would have when generated
+/// with the default options.
+pub fn estimated_rmi_size(rmi: &EstimatedRMI) -> u64 {
+    let options = CodegenOptions::default();
+    let top_size: usize = rmi.top_model.params().iter().map(|p| p.size()).sum();
+    let leaf_size: usize = rmi.leaf_model.params().iter().map(|p| p.size()).sum();
+    let record_size = leaf_record_size(leaf_size, rmi.model_max_error, 2, &options).0;
+    return (top_size + record_size * rmi.branching_factor as usize) as u64;
+}
+
+fn pred_var_name(output: ModelDataType) -> &'static str {
+    return match output {
+        ModelDataType::Int => "ipred",
+        ModelDataType::Float => "fpred",
+        ModelDataType::Int128 => "i128pred"
+    };
+}
+
+// Whether the model index computed from the output of a model on layer
+// `layer_idx` must be clamped to the size of the next layer. A model below
+// the root is only trained on part of the keys, so it can extrapolate past
+// the next layer for keys routed to it from outside of that part, even if
+// its type never does so for the keys it was trained on.
+fn index_needs_bounds_check(layer_idx: usize, layer: &[Box<dyn Model>]) -> bool {
+    return layer_idx > 0 || layer[0].needs_bounds_check();
+}
+
+// writes the call to the model function of a single RMI layer, storing the
+// result in the output variable for the layer (ipred, fpred, or i128pred).
+// Layers with more than one model read their parameters at `modelIndex`.
+fn write_layer_eval<T: Write>(
+    target: &mut T,
+    indent: &str,
+    layer: &[Box<dyn Model>],
+    layer_param: &LayerParams,
+    key_type: KeyType,
+    key_expr: &str) -> Result<(), std::io::Error> {
+
+    write!(
+        target,
+        "{}{} = {}(",
+        indent,
+        pred_var_name(layer[0].output_type()),
+        layer[0].function_name()
+    )?;
+
+    let num_parameters = layer[0].params().len();
+    for pidx in 0..num_parameters {
+        if layer.len() == 1 {
+            // use constant indexing, only one model
+            layer_param.access_by_const(target, pidx)?;
+        } else {
+            layer_param.access_by_ref(target, "modelIndex", pidx)?;
+        }
+        write!(target, ", ")?;
+    }
+    writeln!(target, "{});", model_input_expr(layer[0].input_type(), key_type, key_expr))?;
+    return Ok(());
+}
+
+// the key as the input type of a model. Integer models see the high word
+// of a 128-bit key (matching `ModelInput::as_int`).
+fn model_input_expr(input_type: ModelDataType, key_type: KeyType, key_expr: &str) -> String {
+    return match (input_type, key_type) {
+        (ModelDataType::Int, KeyType::U128) => format!("(uint64_t)({} >> 64)", key_expr),
+        (input_type, _) => format!("({}){}", input_type.c_type(), key_expr)
+    };
+}
+
+// Generates a lookup function that processes an entire array of keys, one
+// RMI layer at a time. Each block of keys first goes through the root model,
+// then the model indexes for the whole block are used to evaluate the next
+// layer, and so on. None of the loops carry a dependency between keys, so
+// the compiler can vectorize the model evaluations (using gathers on AVX2 /
+// AVX-512 targets for the parameter loads) and the CPU can overlap the cache
+// misses of different keys.
+//
+// If `prefetch` is set, a prefetch for the parameters of the next layer is
+// issued as soon as each model index is known, so all of the misses for the
+// block are in flight before any of them are needed (group prefetching).
+// `err_exprs` reads the error of the leaf, or its left and right errors, of
+// which the larger is reported. Returns the signature of the generated
+// function.
+fn generate_batch_lookup<T: Write>(
+    target: &mut T,
+    rmi: &TrainedRMI,
+    layer_params: &[LayerParams],
+    function_name: &str,
+    key_type: KeyType,
+    err_exprs: Option<&[String]>,
+    batch_size: usize,
+    prefetch: bool) -> Result<String, std::io::Error> {
+
+    assert!(batch_size > 0, "Batch size must be positive");
+
+    let batch_sig = if err_exprs.is_some() {
+        format!("void {}(const {}* keys, size_t n, uint64_t* out, size_t* errs)",
+                function_name, key_type.c_type())
+    } else {
+        format!("void {}(const {}* keys, size_t n, uint64_t* out)",
+                function_name, key_type.c_type())
+    };
+
+    writeln!(target, "{} {{", batch_sig)?;
+    writeln!(target, "  const size_t batch_size = {};", batch_size)?;
+    if rmi.rmi.len() > 1 {
+        writeln!(target, "  size_t modelIndexes[batch_size];")?;
+    }
+    if let KeyType::Str = key_type {
+        writeln!(target, "  uint64_t ekeys[batch_size];")?;
+    }
+    writeln!(target, "  for (size_t start = 0; start < n; start += batch_size) {{")?;
+    writeln!(target, "    const size_t len = (n - start < batch_size ? n - start : batch_size);")?;
+    writeln!(target, "    const {}* bkeys = keys + start;", key_type.c_type())?;
+
+    // string keys are encoded once, before the first layer
+    let (model_key_type, model_key) = match key_type {
+        KeyType::Str => {
+            writeln!(target, "    for (size_t i = 0; i < len; i++)")?;
+            writeln!(target, "      ekeys[i] = _encode_key(bkeys[i]);")?;
+            (KeyType::U64, "ekeys[i]")
+        },
+        _ => (key_type, "bkeys[i]")
+    };
+
+    let num_layers = rmi.rmi.len();
+    for (layer_idx, layer) in rmi.rmi.iter().enumerate() {
+        writeln!(target, "    for (size_t i = 0; i < len; i++) {{")?;
+        if layer_idx > 0 && layer.len() > 1 {
+            writeln!(target, "      const size_t modelIndex = modelIndexes[i];")?;
+        }
+        writeln!(target, "      {} {};",
+                 layer[0].output_type().c_type(), pred_var_name(layer[0].output_type()))?;
+        write_layer_eval(target, "      ", layer, &layer_params[layer_idx],
+                         model_key_type, model_key)?;
+
+        if layer_idx + 1 < num_layers {
+            let next_layer = &rmi.rmi[layer_idx + 1];
+            if next_layer.len() > 1 {
+                writeln!(target, "      modelIndexes[i] = {};",
+                         model_index_from_output!(layer[0].output_type(), next_layer.len(),
+                                                  index_needs_bounds_check(layer_idx, layer)))?;
+
+                let next_params = &layer_params[layer_idx + 1];
+                if let (true, Some(addr)) = (prefetch, next_params.address_of("modelIndexes[i]")) {
+                    writeln!(target, "      __builtin_prefetch({});", addr)?;
+                    if 64 % next_params.bytes_per_model() != 0 {
+                        // the parameters may straddle two cache lines
+                        writeln!(target, "      __builtin_prefetch((const char*)({}) + {});",
+                                 addr, next_params.bytes_per_model() - 1)?;
+                    }
+                }
+            }
+        } else {
+            match err_exprs {
+                Some([err]) => writeln!(target, "      errs[start + i] = {};", err)?,
+                Some([err_lo, err_hi]) => {
+                    writeln!(target, "      const size_t errLo = {};", err_lo)?;
+                    writeln!(target, "      const size_t errHi = {};", err_hi)?;
+                    writeln!(target, "      errs[start + i] = (errLo > errHi ? errLo : errHi);")?;
+                },
+                Some(_) => unreachable!(),
+                None => {}
+            };
+            // always bounds check the last level
+            writeln!(target, "      out[start + i] = {};",
+                     model_index_from_output!(layer[0].output_type(), rmi.num_rmi_rows, true))?;
+        }
+        writeln!(target, "    }}")?;
+    }
+    writeln!(target, "  }}")?;
+    writeln!(target, "}}")?;
+
+    return Ok(batch_sig);
+}
+
+// Generates `_leaf_index`, which evaluates every layer above the leaves
+// for a key (of the type that the models see) and returns the index of its
+// leaf, exactly like `lookup` does.
+fn generate_leaf_index<T: Write>(
+    target: &mut T,
+    rmi: &TrainedRMI,
+    layer_params: &[LayerParams],
+    model_key_type: KeyType) -> Result<(), std::io::Error> {
+
+    let (leaves, upper_layers) = rmi.rmi.split_last().unwrap();
+    writeln!(target, "inline size_t _leaf_index({} key) {{", model_key_type.c_type())?;
+    if upper_layers.len() > 1 {
+        writeln!(target, "  size_t modelIndex;")?;
+    }
+    let mut pred_types = HashSet::new();
+    for layer in upper_layers.iter() {
+        let output_type = layer[0].output_type();
+        if pred_types.insert(output_type.c_type()) {
+            writeln!(target, "  {} {};", output_type.c_type(), pred_var_name(output_type))?;
+        }
+    }
+
+    let mut last_model_output = model_key_type.to_model_data_type();
+    let mut needs_bounds_check = true;
+    for (layer_idx, layer) in upper_layers.iter().enumerate() {
+        if layer.len() > 1 {
+            writeln!(target, "  modelIndex = {};",
+                     model_index_from_output!(last_model_output, layer.len(), needs_bounds_check))?;
+        }
+        write_layer_eval(target, "  ", layer, &layer_params[layer_idx], model_key_type, "key")?;
+        last_model_output = layer[0].output_type();
+        needs_bounds_check = index_needs_bounds_check(layer_idx, layer);
+    }
+    writeln!(target, "  return {};",
+             model_index_from_output!(last_model_output, leaves.len(), needs_bounds_check))?;
+    writeln!(target, "}}")?;
+    return Ok(());
+}
+
+// Generates a lookup for a batch of keys in ascending order. Consecutive
+// keys often reach the same leaf, so the parameters and errors of a leaf
+// are only read again when the leaf changes. If the RMI has two layers and
+// its root is monotonic, every key between two keys routed to the same
+// leaf is routed to it too, so instead of evaluating the root for every
+// key, the run of keys in the current leaf is extended in doubling steps
+// (and the root is evaluated again at its end).
+//
+// With `ranges`, the window [lo, hi) of positions holding the lower bound
+// of each key is written instead of its position and error (otherwise the
+// results are the same as `lookup_batch`). `_leaf_index` must have been
+// generated if the RMI has more than one leaf. Returns the signature of
+// the generated function.
+fn generate_sorted_batch_lookup<T: Write>(
+    target: &mut T,
+    rmi: &TrainedRMI,
+    layer_params: &[LayerParams],
+    function_name: &str,
+    key_type: KeyType,
+    err_exprs: Option<&[String]>,
+    ranges: bool) -> Result<String, std::io::Error> {
+
+    let sig = if ranges {
+        format!("void {}(const {}* keys, size_t n, size_t* lo, size_t* hi)",
+                function_name, key_type.c_type())
+    } else if err_exprs.is_some() {
+        format!("void {}(const {}* keys, size_t n, uint64_t* out, size_t* errs)",
+                function_name, key_type.c_type())
+    } else {
+        format!("void {}(const {}* keys, size_t n, uint64_t* out)",
+                function_name, key_type.c_type())
+    };
+    writeln!(target, "{} {{", sig)?;
+
+    let num_rows = rmi.num_rmi_rows;
+    let leaves = rmi.rmi.last().unwrap();
+    if leaves.len() == 1 {
+        // there is no leaf to route the keys to
+        writeln!(target, "  for (size_t i = 0; i < n; i++) {{")?;
+        if ranges {
+            writeln!(target, "    size_t errLo, errHi;")?;
+            writeln!(target, "    const uint64_t guess = lookup(keys[i], &errLo, &errHi);")?;
+        } else if err_exprs.is_some() {
+            writeln!(target, "    out[i] = lookup(keys[i], &errs[i]);")?;
+        } else {
+            writeln!(target, "    out[i] = lookup(keys[i]);")?;
+        }
+    } else {
+        let (model_key_type, model_key) = match key_type {
+            KeyType::Str => (KeyType::U64, "ekey"),
+            _ => (key_type, "keys[i]")
+        };
+        let key_at = |idx: &str| match key_type {
+            KeyType::Str => format!("_encode_key(keys[{}])", idx),
+            _ => format!("keys[{}]", idx)
+        };
+        let monotonic = rmi.rmi.len() == 2 && rmi.rmi[0][0].is_monotonic();
+
+        // the parameters of the current leaf, unless they are an array
+        let leaf_params = &layer_params[rmi.rmi.len() - 1];
+        let num_leaf_params = leaves[0].params().len();
+        let cached = !leaf_params.params()[0].is_array();
+
+        writeln!(target, "  // no leaf has been read yet")?;
+        writeln!(target, "  size_t modelIndex = {};", leaves.len())?;
+        if monotonic {
+            writeln!(target, "  // the keys before runEnd are routed to the leaf at modelIndex, and")?;
+            writeln!(target, "  // keys[after] to the leaf at afterIndex")?;
+            writeln!(target, "  size_t runEnd = 0, after = n, afterIndex = 0;")?;
+        }
+        if cached {
+            for pidx in 0..num_leaf_params {
+                writeln!(target, "  {} leafParam{} = 0;", leaf_params.params()[pidx].c_type(), pidx)?;
+            }
+        }
+        if err_exprs.is_some() {
+            writeln!(target, "  size_t errLo = 0, errHi = 0;")?;
+        }
+        writeln!(target, "  {} {};", leaves[0].output_type().c_type(), pred_var_name(leaves[0].output_type()))?;
+
+        writeln!(target, "  for (size_t i = 0; i < n; i++) {{")?;
+        if let KeyType::Str = key_type {
+            writeln!(target, "    const uint64_t ekey = _encode_key(keys[i]);")?;
+        }
+
+        // reads the parameters and errors of the leaf when it changes
+        let mut reload = Vec::new();
+        reload.push("if (leaf != modelIndex) {".to_string());
+        reload.push("  modelIndex = leaf;".to_string());
+        if cached {
+            for pidx in 0..num_leaf_params {
+                let mut access = Vec::new();
+                leaf_params.access_by_ref(&mut access, "modelIndex", pidx)?;
+                reload.push(format!("  leafParam{} = {};", pidx, String::from_utf8(access).unwrap()));
+            }
+        }
+        match err_exprs {
+            Some([err_lo, err_hi]) => {
+                reload.push(format!("  errLo = {};", err_lo));
+                reload.push(format!("  errHi = {};", err_hi));
+            },
+            Some(_) => unreachable!(),
+            None => {}
+        };
+        reload.push("}".to_string());
+
+        let reload_indent = if monotonic {
+            writeln!(target, "    if (i == runEnd) {{")?;
+            writeln!(target, "      const size_t leaf = (i == after ? afterIndex : _leaf_index({}));",
+                     model_key)?;
+            writeln!(target, "      runEnd = i + 1;")?;
+            writeln!(target, "      for (size_t step = 1; runEnd < n; step *= 2) {{")?;
+            writeln!(target, "        const size_t probe = (n - runEnd > step ? runEnd + step : n) - 1;")?;
+            writeln!(target, "        const size_t probeIndex = _leaf_index({});", key_at("probe"))?;
+            writeln!(target, "        if (probeIndex != leaf) {{")?;
+            writeln!(target, "          after = probe;")?;
+            writeln!(target, "          afterIndex = probeIndex;")?;
+            writeln!(target, "          break;")?;
+            writeln!(target, "        }}")?;
+            writeln!(target, "        runEnd = probe + 1;")?;
+            writeln!(target, "      }}")?;
+            "      "
+        } else {
+            writeln!(target, "    const size_t leaf = _leaf_index({});", model_key)?;
+            "    "
+        };
+        for ln in reload {
+            writeln!(target, "{}{}", reload_indent, ln)?;
+        }
+        if monotonic {
+            writeln!(target, "    }}")?;
+        }
+
+        if cached {
+            let args: Vec<String> = (0..num_leaf_params).map(|pidx| format!("leafParam{}", pidx)).collect();
+            writeln!(target, "    {} = {}({}, {});", pred_var_name(leaves[0].output_type()), leaves[0].function_name(),
+                     args.join(", "), model_input_expr(leaves[0].input_type(), model_key_type, model_key))?;
+        } else {
+            write_layer_eval(target, "    ", leaves, leaf_params, model_key_type, model_key)?;
+        }
+        writeln!(target, "    const uint64_t guess = {};",
+                 model_index_from_output!(leaves[0].output_type(), num_rows, true))?;
+        if !ranges {
+            writeln!(target, "    out[i] = guess;")?;
+            if err_exprs.is_some() {
+                writeln!(target, "    errs[i] = (errLo > errHi ? errLo : errHi);")?;
+            }
+        }
+    }
+    if ranges {
+        writeln!(target, "    lo[i] = (guess > errLo ? guess - errLo : 0);")?;
+        writeln!(target, "    hi[i] = (guess + errHi + 1 < {0} ? guess + errHi + 1 : {0});", num_rows)?;
+    }
+    writeln!(target, "  }}")?;
+    writeln!(target, "}}")?;
+
+    return Ok(sig);
+}
+
+// Picks the search that `find` will actually use. Without error bounds,
+// only an exponential search is possible. With `auto`, if every leaf falls
+// on the same side of the linear search threshold, the runtime check on
+// the width of the window is dropped.
+fn resolve_search_strategy(rmi: &TrainedRMI, requested: SearchStrategy) -> SearchStrategy {
+    // the sum of the left and right errors
+    let widths: Vec<u64> = match &rmi.cache_fix {
+        Some((line_size, _)) => vec![2 * *line_size as u64],
+        None => rmi.last_layer_max_l1s.iter().map(|(left, right)| left + right).collect()
+    };
+
+    if widths.is_empty() {
+        if requested != SearchStrategy::Exponential && requested != SearchStrategy::Auto {
+            warn!("No last-level errors are available, find will use exponential search \
+                   instead of {:?}", requested);
+        }
+        return SearchStrategy::Exponential;
+    }
+
+    if requested != SearchStrategy::Auto {
+        return requested;
+    }
+
+    if widths.iter().all(|w| *w <= 2 * LINEAR_SEARCH_MAX_ERR) {
+        return SearchStrategy::Linear;
+    }
+
+    if widths.iter().all(|w| *w > 2 * LINEAR_SEARCH_MAX_ERR) {
+        return SearchStrategy::Binary;
+    }
+
+    return SearchStrategy::Auto;
+}
+
+// Generates `_encode_key`, which maps a string key to the integer the RMI
+// was trained on (`StringKeyEncoding::encode`).
+fn generate_key_encoding<T: Write>(target: &mut T,
+                                   encoding: &StringKeyEncoding) -> Result<(), std::io::Error> {
+    let prefix = encoding.prefix();
+    let (min_encoded, max_encoded) = encoding.bounds();
+    let flag = encoding.not_in_alphabet_flag();
+    let num_bytes = encoding.num_bytes();
+
+    writeln!(target, "inline uint64_t _encode_key(std::string_view key) {{")?;
+    writeln!(target, "  static const uint16_t codes[{}][256] = {{", num_bytes)?;
+    for position_codes in encoding.codes() {
+        let codes: Vec<String> = position_codes.iter().map(|c| format!("{}", c)).collect();
+        writeln!(target, "    {{ {} }},", codes.join(", "))?;
+    }
+    writeln!(target, "  }};")?;
+    let bases: Vec<String> = encoding.bases().iter().map(|b| format!("{}", b)).collect();
+    writeln!(target, "  static const uint64_t bases[{}] = {{ {} }};", num_bytes, bases.join(", "))?;
+    writeln!(target, "  const size_t prefix_len = {};", prefix.len())?;
+    if !prefix.is_empty() {
+        let bytes: Vec<String> = prefix.iter().map(|b| format!("{}", *b as i8)).collect();
+        writeln!(target, "  static const char prefix[] = {{ {} }};", bytes.join(", "))?;
+        writeln!(target, "  const int cmp = key.substr(0, prefix_len)\
+                          .compare(std::string_view(prefix, prefix_len));")?;
+        writeln!(target, "  if (cmp < 0) return {}UL;", min_encoded)?;
+        writeln!(target, "  if (cmp > 0) return {}UL;", max_encoded)?;
+    }
+    writeln!(target, "
+  uint64_t encoded = 0;
+  for (size_t i = 0; i < {num_bytes}; i++) {{
+    uint64_t code = 0;
+    if (prefix_len + i < key.size()) {{
+      const uint16_t c = codes[i][(unsigned char)key[prefix_len + i]];
+      code = c & {mask};
+      if (c & {flag}) {{
+        // no key has this byte here, so the key falls after every key
+        // that starts with the bytes before it
+        encoded = encoded * bases[i] + code;
+        for (i++; i < {num_bytes}; i++)
+          encoded = encoded * bases[i] + bases[i] - 1;
+        break;
+      }}
+    }}
+    encoded = encoded * bases[i] + code;
+  }}
+  if (encoded < {min}UL) return {min}UL;
+  return (encoded > {max}UL ? {max}UL : encoded);
+}}",
+             num_bytes = num_bytes, flag = flag, mask = flag - 1,
+             min = min_encoded, max = max_encoded)?;
+    return Ok(());
+}
+
+// Generates the counters of an instrumented RMI and the functions that
+// report them. Each thread counts its lookups into its own `_LookupStats`:
+// how many keys reached each leaf, how many predictions of each layer had
+// to be clamped (layer i clamps the index of the model on layer i + 1, and
+// the last layer clamps the position), and histograms of the errors that
+// lookups return and of the spline search windows of a bounded RMI. Only
+// the thread itself writes its counters, so they are atomic only to let
+// `dump_stats` read them while lookups run, and cost no more than plain
+// increments.
+fn generate_instrumentation<T: Write>(
+    target: &mut T,
+    num_layers: usize,
+    num_leaves: usize) -> Result<(), std::io::Error> {
+
+    writeln!(target, "
+struct _LookupStats {{
+  std::atomic<uint64_t> lookups;
+  std::atomic<uint64_t> clamps[{num_layers}];
+  std::atomic<uint64_t> errors[65];
+  std::atomic<uint64_t> windows[65];
+  std::atomic<uint64_t> leaves[{num_leaves}];
+  _LookupStats* next;
+}};
+
+std::atomic<_LookupStats*> _all_stats(nullptr);
+thread_local _LookupStats* _thread_stats = nullptr;
+
+inline _LookupStats* _stats() {{
+  if (__builtin_expect(_thread_stats == nullptr, 0)) {{
+    // the counters outlive their thread, so that they are still reported
+    _thread_stats = new _LookupStats();
+    _thread_stats->next = _all_stats.load();
+    while (!_all_stats.compare_exchange_weak(_thread_stats->next, _thread_stats)) {{}}
+  }}
+  return _thread_stats;
+}}
+
+inline void _count(std::atomic<uint64_t>& counter) {{
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}}
+
+// the histogram bucket of v: 0 for 0, and b for 2^(b-1) <= v < 2^b
+inline size_t _bucket(uint64_t v) {{
+  return (v == 0 ? 0 : 64 - __builtin_clzll(v));
+}}
+
+inline void _sum_counters(const std::atomic<uint64_t>* counters, size_t n, uint64_t* sums) {{
+  for (size_t i = 0; i < n; i++)
+    sums[i] += counters[i].load(std::memory_order_relaxed);
+}}
+
+inline void _reset_counters(std::atomic<uint64_t>* counters, size_t n) {{
+  for (size_t i = 0; i < n; i++)
+    counters[i].store(0, std::memory_order_relaxed);
+}}
+
+inline void _dump_histogram(std::ofstream& out, const char* name, const uint64_t* buckets) {{
+  for (size_t b = 0; b < 65; b++) {{
+    if (buckets[b] == 0) continue;
+    const uint64_t lo = (b == 0 ? 0 : 1UL << (b - 1));
+    const uint64_t hi = (b == 0 ? 0 : (b == 64 ? ~0UL : (1UL << b) - 1));
+    out << name << \" \" << lo << \" \" << hi << \" \" << buckets[b] << \"\\n\";
+  }}
+}}
+
+bool dump_stats(char const* path) {{
+  uint64_t lookups = 0;
+  uint64_t clamps[{num_layers}] = {{ 0 }};
+  uint64_t errors[65] = {{ 0 }};
+  uint64_t windows[65] = {{ 0 }};
+  uint64_t* leaves = new uint64_t[{num_leaves}]();
+  for (_LookupStats* s = _all_stats.load(); s != nullptr; s = s->next) {{
+    lookups += s->lookups.load(std::memory_order_relaxed);
+    _sum_counters(s->clamps, {num_layers}, clamps);
+    _sum_counters(s->errors, 65, errors);
+    _sum_counters(s->windows, 65, windows);
+    _sum_counters(s->leaves, {num_leaves}, leaves);
+  }}
+
+  std::ofstream out(path);
+  out << \"lookups \" << lookups << \"\\n\";
+  for (size_t i = 0; i < {num_layers}; i++)
+    out << \"clamp \" << i << \" \" << clamps[i] << \"\\n\";
+  _dump_histogram(out, \"error\", errors);
+  _dump_histogram(out, \"window\", windows);
+  for (size_t i = 0; i < {num_leaves}; i++) {{
+    if (leaves[i] > 0)
+      out << \"leaf \" << i << \" \" << leaves[i] << \"\\n\";
+  }}
+  delete[] leaves;
+  out.close();
+  return out.good();
+}}
+
+void reset_stats() {{
+  for (_LookupStats* s = _all_stats.load(); s != nullptr; s = s->next) {{
+    s->lookups.store(0, std::memory_order_relaxed);
+    _reset_counters(s->clamps, {num_layers});
+    _reset_counters(s->errors, 65);
+    _reset_counters(s->windows, 65);
+    _reset_counters(s->leaves, {num_leaves});
+  }}
+}}", num_layers = num_layers, num_leaves = num_leaves)?;
+    return Ok(());
+}
+
+// Generates `find`, which returns the index of the first key in the sorted
+// data that is not less than the lookup key (std::lower_bound) by searching
+// the error window around the prediction of `lookup`. `data_c_type` is the
+// type of the sorted array, which can be narrower than the RMI's key type
+// (uint32 data is indexed with uint64 keys). With `split_errors`, the window
+// extends by the left and right error of the leaf on either side. Returns
+// the signature of the generated function.
+//
+// If keys can collide in the RMI (`colliding_keys`, for string keys), the
+// lower bound can lie past the end of the window when the window ends in
+// the run of keys at the end of the data, whose length is not part of the
+// error. The search then continues with an exponential search.
+fn generate_find<T: Write>(
+    target: &mut T,
+    data_c_type: &str,
+    has_errors: bool,
+    split_errors: bool,
+    strategy: SearchStrategy,
+    colliding_keys: bool) -> Result<String, std::io::Error> {
+
+    let find_sig = format!("size_t find(const {0}* data, size_t n, {0} key)", data_c_type);
+    writeln!(target, "{} {{", find_sig)?;
+
+    let (err_lo, err_hi) = if split_errors { ("err_lo", "err_hi") } else { ("err", "err") };
+    if split_errors {
+        writeln!(target, "  size_t err_lo, err_hi;")?;
+        writeln!(target, "  const size_t guess = lookup(key, &err_lo, &err_hi);")?;
+    } else if has_errors {
+        writeln!(target, "  size_t err;")?;
+        writeln!(target, "  const size_t guess = lookup(key, &err);")?;
+    } else {
+        writeln!(target, "  const size_t guess = lookup(key);")?;
+    }
+
+    if strategy == SearchStrategy::Exponential {
+        writeln!(target, "  return exp_lower_bound(data, n, guess, key);")?;
+        writeln!(target, "}}")?;
+        return Ok(find_sig);
+    }
+
+    writeln!(target, "  const size_t hi = (guess + {0} + 1 < n ? guess + {0} + 1 : n);", err_hi)?;
+    writeln!(target, "  size_t lo = (guess > {0} ? guess - {0} : 0);", err_lo)?;
+    writeln!(target, "  if (lo > hi) lo = hi;")?;
+
+    let result = if colliding_keys {
+        writeln!(target, "  size_t pos;")?;
+        "pos ="
+    } else {
+        "return"
+    };
+
+    match strategy {
+        SearchStrategy::Binary =>
+            writeln!(target, "  {} bl_lower_bound(data, lo, hi, key);", result)?,
+        SearchStrategy::Linear =>
+            writeln!(target, "  {} lin_lower_bound(data, lo, hi, key);", result)?,
+        SearchStrategy::Interpolation =>
+            writeln!(target, "  {} ip_lower_bound(data, lo, hi, key);", result)?,
+        SearchStrategy::Auto => {
+            if split_errors {
+                writeln!(target, "  if (err_lo + err_hi <= {})", 2 * LINEAR_SEARCH_MAX_ERR)?;
+            } else {
+                writeln!(target, "  if (err <= {})", LINEAR_SEARCH_MAX_ERR)?;
+            }
+            writeln!(target, "    {} lin_lower_bound(data, lo, hi, key);", result)?;
+            if colliding_keys {
+                writeln!(target, "  else")?;
+                writeln!(target, "    {} bl_lower_bound(data, lo, hi, key);", result)?;
+            } else {
+                writeln!(target, "  return bl_lower_bound(data, lo, hi, key);")?;
+            }
+        }
+        SearchStrategy::Exponential => unreachable!()
+    };
+
+    if colliding_keys {
+        writeln!(target, "  if (pos == hi && hi < n)")?;
+        writeln!(target, "    return exp_lower_bound(data, n, hi, key);")?;
+        writeln!(target, "  return pos;")?;
+    }
+    writeln!(target, "}}")?;
+
+    return Ok(find_sig);
+}
+
+// the statement that counts the size of the spline search window in an
+// instrumented RMI
+fn cache_fix_window_counter(options: &CodegenOptions) -> &'static str {
+    return if options.instrument {
+        "  _count(_stats()->windows[_bucket(upper - lower)]);\n"
+    } else {
+        ""
+    };
+}
+
+// Generates the lookups of a bounded RMI, which search the spline points
+// (stored in `arrays`, see `CacheFixLayout`) for the segment holding the key
+// and interpolate the key's position from its ends.
 fn generate_cache_fix_code<T: Write>(
     target: &mut T,
     rmi: &TrainedRMI,
-    array_name: String) -> Result<(), std::io::Error> {
+    arrays: &[String],
+    key_type: KeyType,
+    options: &CodegenOptions) -> Result<(), std::io::Error> {
 
     let num_splines = rmi.cache_fix.as_ref().unwrap().1.len();
     let line_size = rmi.cache_fix.as_ref().unwrap().0;
     let total_keys = rmi.num_data_rows;
+    let prefetch_batch_size = options.prefetch_batch_size;
+    let count_window = cache_fix_window_counter(options);
+
+    if options.cache_fix_layout != CacheFixLayout::Packed {
+        return generate_split_cache_fix_code(target, rmi, &arrays[0], &arrays[1],
+                                             key_type, options);
+    }
+    let array_name = &arrays[0];
 
     writeln!(target,
              "
 struct __attribute__((packed)) SplinePoint {{
-  uint64_t key;
+  {6} key;
   uint64_t value;
 }};
 
-uint64_t lookup(uint64_t key, size_t* err) {{
+inline uint64_t _cachefix_search({5} key, uint64_t start, size_t error_on_spline_search) {{
   const uint64_t num_spline_pts = {};
   const uint64_t total_keys = {};
-  size_t error_on_spline_search;
 
   struct SplinePoint* begin = (struct SplinePoint*) {};
 
-  *err = {};
-  uint64_t start = _rmi_lookup_pre_cachefix(key, &error_on_spline_search);
-
   size_t upper = (start + error_on_spline_search > num_spline_pts
                   ? num_spline_pts : start + error_on_spline_search);
   size_t lower = (error_on_spline_search > start
                   ? 0 : start - error_on_spline_search);
-                  
-  
+{7}
   struct SplinePoint* res = std::lower_bound(begin + lower,
                                              begin + upper,
                                              key,
@@ -441,12 +1400,532 @@ uint64_t lookup(uint64_t key, size_t* err) {{
   auto v1 = (double)pt2.value;
   auto t = ((double)(key - pt1.key)) / (double)(pt2.key - pt1.key);
   return (((uint64_t) std::fma(1.0 - t, v0, t * v1)) / {3}) * {3};
-}}", num_splines, total_keys, array_name, line_size)?;
+}}
+
+uint64_t lookup({5} key, size_t* err) {{
+  size_t error_on_spline_search;
+  *err = {3};
+  uint64_t start = _rmi_lookup_pre_cachefix(key, &error_on_spline_search);
+  return _cachefix_search(key, start, error_on_spline_search);
+}}
+
+void lookup_batch(const {5}* keys, size_t n, uint64_t* out, size_t* errs) {{
+  // compute all of the spline search windows first, then search each one.
+  _rmi_lookup_pre_cachefix_batch(keys, n, out, errs);
+  for (size_t i = 0; i < n; i++) {{
+    out[i] = _cachefix_search(keys[i], out[i], errs[i]);
+    errs[i] = {3};
+  }}
+}}
+
+void lookup_prefetch(const {5}* keys, size_t n, uint64_t* out, size_t* errs) {{
+  const size_t batch_size = {4};
+  struct SplinePoint* begin = (struct SplinePoint*) {2};
+  for (size_t start = 0; start < n; start += batch_size) {{
+    const size_t len = (n - start < batch_size ? n - start : batch_size);
+    _rmi_lookup_pre_cachefix_prefetch(keys + start, len, out + start, errs + start);
+    for (size_t i = start; i < start + len; i++)
+      __builtin_prefetch(begin + out[i]);
+    for (size_t i = start; i < start + len; i++) {{
+      out[i] = _cachefix_search(keys[i], out[i], errs[i]);
+      errs[i] = {3};
+    }}
+  }}
+}}", num_splines, total_keys, array_name, line_size, prefetch_batch_size, key_type.c_type(),
+             rmi.cache_fix.as_ref().unwrap().1[0].0.c_type(), count_window)?;
+
+    return Ok(());
+}
+
+// The lookups of a bounded RMI whose spline keys and offsets are stored in
+// separate arrays, sorted (`CacheFixLayout::Soa`) or in Eytzinger order.
+fn generate_split_cache_fix_code<T: Write>(
+    target: &mut T,
+    rmi: &TrainedRMI,
+    keys: &str,
+    offsets: &str,
+    key_type: KeyType,
+    options: &CodegenOptions) -> Result<(), std::io::Error> {
+
+    let num_splines = rmi.cache_fix.as_ref().unwrap().1.len();
+    let line_size = rmi.cache_fix.as_ref().unwrap().0;
+    let total_keys = rmi.num_data_rows;
+    let count_window = cache_fix_window_counter(options);
+
+    writeln!(target, "
+// the position of key on the spline segment from point lo to point hi
+inline uint64_t _cachefix_interpolate({3} key, size_t lo, size_t hi) {{
+  auto v0 = (double){1}[lo];
+  auto v1 = (double){1}[hi];
+  auto t = ((double)(key - {0}[lo])) / (double)({0}[hi] - {0}[lo]);
+  return (((uint64_t) std::fma(1.0 - t, v0, t * v1)) / {2}) * {2};
+}}", keys, offsets, line_size, key_type.c_type())?;
+
+    if options.cache_fix_layout == CacheFixLayout::Soa {
+        // the window searched is at most twice the error wide, so leaves
+        // are scanned linearly like `SearchStrategy::Auto` would
+        let spline_errors: Vec<u64> = rmi.last_layer_max_l1s.iter()
+            .map(|(left, right)| u64::max(*left, *right))
+            .collect();
+        // u32 keys are looked up as u64 keys (see `find`), but the search
+        // functions need the key to have the type of the spline keys
+        let spline_key_type = rmi.cache_fix.as_ref().unwrap().1[0].0.c_type();
+        let (narrow_check, search_key) = if spline_key_type != key_type.c_type() {
+            (format!("
+  if (key > std::numeric_limits<{0}>::max())
+    // we've searched for something past the last point
+    return total_keys - 1;
+", spline_key_type), format!("({}) key", spline_key_type))
+        } else {
+            (String::new(), String::from("key"))
+        };
+
+        let linear = format!("lin_lower_bound({}, lower, upper, {})", keys, search_key);
+        let binary = format!("bl_lower_bound({}, lower, upper, {})", keys, search_key);
+        let search = if spline_errors.iter().all(|e| *e <= LINEAR_SEARCH_MAX_ERR) {
+            linear
+        } else if spline_errors.iter().all(|e| *e > LINEAR_SEARCH_MAX_ERR) {
+            binary
+        } else {
+            format!("(upper - lower <= {} ? {} : {})",
+                    2 * LINEAR_SEARCH_MAX_ERR, linear, binary)
+        };
+
+        writeln!(target, "
+inline uint64_t _cachefix_search({7} key, uint64_t start, size_t error_on_spline_search) {{
+  const uint64_t num_spline_pts = {0};
+  const uint64_t total_keys = {1};
+{8}
+  size_t upper = (start + error_on_spline_search > num_spline_pts
+                  ? num_spline_pts : start + error_on_spline_search);
+  size_t lower = (error_on_spline_search > start
+                  ? 0 : start - error_on_spline_search);
+{9}
+  size_t res = {2};
+
+  if (res == num_spline_pts)
+    // we've searched for something past the last point
+    return total_keys - 1;
+
+  if (res == 0)
+    // the key is not after the first point
+    return ({3}[0] / {4}) * {4};
+
+  return _cachefix_interpolate(key, res - 1, res);
+}}
+
+uint64_t lookup({7} key, size_t* err) {{
+  size_t error_on_spline_search;
+  *err = {4};
+  uint64_t start = _rmi_lookup_pre_cachefix(key, &error_on_spline_search);
+  return _cachefix_search(key, start, error_on_spline_search);
+}}
+
+void lookup_batch(const {7}* keys, size_t n, uint64_t* out, size_t* errs) {{
+  // compute all of the spline search windows first, then search each one.
+  _rmi_lookup_pre_cachefix_batch(keys, n, out, errs);
+  for (size_t i = 0; i < n; i++) {{
+    out[i] = _cachefix_search(keys[i], out[i], errs[i]);
+    errs[i] = {4};
+  }}
+}}
+
+void lookup_prefetch(const {7}* keys, size_t n, uint64_t* out, size_t* errs) {{
+  const size_t batch_size = {5};
+  for (size_t start = 0; start < n; start += batch_size) {{
+    const size_t len = (n - start < batch_size ? n - start : batch_size);
+    _rmi_lookup_pre_cachefix_prefetch(keys + start, len, out + start, errs + start);
+    for (size_t i = start; i < start + len; i++)
+      __builtin_prefetch({6} + out[i]);
+    for (size_t i = start; i < start + len; i++) {{
+      out[i] = _cachefix_search(keys[i], out[i], errs[i]);
+      errs[i] = {4};
+    }}
+  }}
+}}", num_splines, total_keys, search, offsets, line_size, options.prefetch_batch_size, keys,
+             key_type.c_type(), narrow_check, count_window)?;
+    } else {
+        writeln!(target, "
+inline uint64_t _cachefix_search({5} key) {{
+  const uint64_t num_spline_pts = {0};
+  const uint64_t total_keys = {1};
+
+  // descend to a leaf, going right at every point smaller than the key. The
+  // root is node 1, so the eight nodes three levels below a node share a
+  // cache line.
+  size_t k = 1;
+  while (k <= num_spline_pts) {{
+    __builtin_prefetch({2} + 8 * k);
+    k = 2 * k + ({2}[k] < key);
+  }}
+
+  // the lower bound is the last node where the search turned left, and the
+  // point before it the last node where it turned right
+  const size_t hi = k >> __builtin_ffsll(~k);
+  const size_t lo = k >> __builtin_ffsll(k);
+
+  if (hi == 0)
+    // we've searched for something past the last point
+    return total_keys - 1;
+
+  if (lo == 0)
+    // the key is not after the first point
+    return ({3}[hi] / {4}) * {4};
+
+  return _cachefix_interpolate(key, lo, hi);
+}}
+
+uint64_t lookup({5} key, size_t* err) {{
+{6}  *err = {4};
+  return _cachefix_search(key);
+}}
+
+void lookup_batch(const {5}* keys, size_t n, uint64_t* out, size_t* errs) {{
+  // the spline search does not need the RMI's prediction
+  for (size_t i = 0; i < n; i++) {{
+    out[i] = _cachefix_search(keys[i]);
+    errs[i] = {4};
+  }}
+}}
+
+void lookup_prefetch(const {5}* keys, size_t n, uint64_t* out, size_t* errs) {{
+  // the spline search already prefetches as it descends
+  lookup_batch(keys, n, out, errs);
+}}", num_splines, total_keys, keys, offsets, line_size, key_type.c_type(),
+             // the lookup skips the RMI, so it only counts itself
+             if options.instrument { "  _count(_stats()->lookups);\n" } else { "" })?;
+    }
+
+    return Ok(());
+}
+
+// The order of `n` sorted points in an Eytzinger layout: the index of the
+// point at each node of a complete binary search tree whose nodes are
+// numbered breadth first from the root at 1, for nodes 1 to `n`.
+fn eytzinger_order(n: usize) -> Vec<usize> {
+    fn visit(node: usize, n: usize, next: &mut usize, order: &mut Vec<usize>) {
+        if node > n { return; }
+        visit(2 * node, n, next, order);
+        order[node - 1] = *next;
+        *next += 1;
+        visit(2 * node + 1, n, next, order);
+    }
+
+    let mut order = vec![0; n];
+    let mut next = 0;
+    visit(1, n, &mut next, &mut order);
+    return order;
+}
+
+// Writes every layer into the parameter container `{ns}_PARAMETERS` (see
+// container.rs), and generates a `load` that brings the whole container into
+// memory at once and points the layer arrays into it. By default, the file
+// is read into a single allocation and its checksum is verified. In mmap
+// mode, the file is mapped read-only instead and the parameters are used in
+// place: loading costs a page table setup instead of a copy, and every
+// process using the same file shares one page cache copy. The checksum is
+// not verified in mmap mode, since that would read the entire file.
+fn generate_container_load<T: Write>(
+    data_output: &mut T,
+    read_code: &mut Vec<String>,
+    free_code: &mut Vec<String>,
+    rmi: &TrainedRMI,
+    layer_params: &[LayerParams],
+    error_overflow_idx: Option<usize>,
+    namespace: &str,
+    data_dir: &str,
+    key_type: KeyType,
+    options: &CodegenOptions) -> Result<(), std::io::Error> {
+
+    let lle = &rmi.last_layer_max_l1s;
+    let mut layers = Vec::new();
+    for lp in layer_params.iter() {
+        let mut flags = 0;
+        match lp {
+            LayerParams::Constant(_, _) => flags |= container::LAYER_FLAG_CONSTANT,
+            LayerParams::MixedArray(_, _, _) => flags |= container::LAYER_FLAG_MIXED,
+            LayerParams::Array(_, _, _) => {}
+        };
+
+        let (model_name, num_models) = if lp.index() < rmi.rmi.len() {
+            let models = &rmi.rmi[lp.index()];
+            (models[0].function_name(), models.len())
+        } else if Some(lp.index()) == error_overflow_idx {
+            flags |= container::LAYER_FLAG_ERROR_OVERFLOW;
+            (String::from("error_overflow"), lp.params().len() / 2)
+        } else {
+            flags |= container::LAYER_FLAG_CACHE_FIX;
+            (String::from("cache_fix"), lp.params().len() / lp.params_per_model())
+        };
+
+        if lp.index() == rmi.rmi.len() - 1 && lle.len() > 1 {
+            flags |= container::LAYER_FLAG_ERRORS;
+            if rmi.cache_fix.is_none() {
+                flags |= container::LAYER_FLAG_SPLIT_ERRORS;
+            }
+        }
+
+        // layers with more parameters per model than fit in the layer
+        // table (no model currently has that many) only record their size
+        let param_types = if lp.params_per_model() <= container::MAX_PARAM_TYPES {
+            lp.params().iter().take(lp.params_per_model())
+                .map(container::param_type_id).collect()
+        } else {
+            Vec::new()
+        };
+
+        let mut data = Vec::with_capacity(lp.size());
+        lp.write_to(&mut data)?;
+        layers.push(container::ContainerLayer {
+            flags, model_name,
+            num_models: num_models as u64,
+            params_per_model: lp.params_per_model() as u32,
+            param_types,
+            data
+        });
+    }
+
+    let uniform_error = if lle.len() == 1 { Some(u64::max(lle[0].0, lle[0].1)) } else { None };
+    
+    let data_path = Path::new(&data_dir)
+        .join(format!("{}_PARAMETERS", namespace));
+    let f = File::create(data_path)
+        .expect("Could not write data file to RMI directory");
+    let mut bw = BufWriter::new(f);
+    let (entries, total_size) = container::write_container(
+        &mut bw, key_type, rmi.num_rmi_rows, uniform_error, &layers
+    )?;
+
+    // constant layers are still compiled into the code
+    for lp in layer_params.iter() {
+        if let LayerParams::Constant(_, _) = lp {
+            lp.to_code(data_output)?;
+        }
+    }
+
+    let has_arrays = layer_params.iter().any(|lp| !matches!(lp, LayerParams::Constant(_, _)));
+    if !has_arrays {
+        read_code.push("bool load(char const* dataPath) {".to_string());
+        return Ok(());
+    }
     
+    // each thread finds the arrays in the copy of the parameters on its
+    // own NUMA node
+    let replicate = options.numa_replicate && !options.mmap;
+    writeln!(data_output, "char* PARAMETERS_BASE = NULL;")?;
+    writeln!(data_output, "const size_t PARAMETERS_SIZE = {};", total_size)?;
+    if replicate {
+        writeln!(data_output, "const size_t MAX_NUMA_NODES = {};", MAX_NUMA_NODES)?;
+        writeln!(data_output, "char* PARAMETERS_REPLICAS[MAX_NUMA_NODES];")?;
+    }
+    for (lp, entry) in layer_params.iter().zip(entries.iter()) {
+        if let LayerParams::Constant(_, _) = lp { continue; }
+        if replicate {
+            writeln!(data_output, "#define {} (({}*) (PARAMETERS_REPLICAS[LOCAL_NODE] + {}))",
+                     array_name!(lp.index()), lp.element_type(), entry.offset)?;
+        } else {
+            writeln!(data_output, "{}* {};", lp.element_type(), array_name!(lp.index()))?;
+        }
+    }
+
+    // make sure the container on disk is the one this code was generated for
+    let magic = u64::from_le_bytes(*container::CONTAINER_MAGIC);
+    read_code.push("static bool check_parameters(const char* base, bool verify_checksum) {".to_string());
+    read_code.push("  const uint64_t* header = (const uint64_t*) base;".to_string());
+    read_code.push("  const uint32_t* header32 = (const uint32_t*) base;".to_string());
+    read_code.push(format!("  if (header[0] != 0x{:016x}ULL) return false;", magic));
+    read_code.push(format!("  if (header32[2] != {} || header32[3] != {} || header32[4] != {}) return false;",
+                           container::CONTAINER_VERSION,
+                           container::key_type_id(key_type),
+                           layers.len()));
+    read_code.push("  if (header[4] != PARAMETERS_SIZE) return false;".to_string());
+    for (idx, entry) in entries.iter().enumerate() {
+        read_code.push(format!("  if (((const uint64_t*) (base + {}))[1] != {} || \
+                                ((const uint64_t*) (base + {}))[2] != {}) return false;",
+                               container::HEADER_SIZE + idx * container::LAYER_ENTRY_SIZE,
+                               entry.offset,
+                               container::HEADER_SIZE + idx * container::LAYER_ENTRY_SIZE,
+                               entry.size));
+    }
+    read_code.push("  if (verify_checksum) {".to_string());
+    read_code.push(format!("    uint64_t hash = 0x{:016x}ULL;", container::FNV_OFFSET_BASIS));
+    read_code.push(format!("    for (size_t i = {}; i < PARAMETERS_SIZE; i += 8) {{",
+                           entries[0].offset));
+    read_code.push("      hash ^= *((const uint64_t*) (base + i));".to_string());
+    read_code.push(format!("      hash *= 0x{:016x}ULL;", container::FNV_PRIME));
+    read_code.push("    }".to_string());
+    read_code.push("    if (hash != header[5]) return false;".to_string());
+    read_code.push("  }".to_string());
+    read_code.push("  return true;".to_string());
+    read_code.push("}".to_string());
 
+    let placed = !options.mmap && (options.huge_pages != HugePages::None || replicate);
+    if placed {
+        generate_placed_alloc(read_code, options.huge_pages, replicate);
+    }
+    read_code.push("bool load(char const* dataPath) {".to_string());
+    if options.mmap {
+        let map_flags = if options.mmap_populate {
+            "MAP_PRIVATE | MAP_POPULATE"
+        } else {
+            "MAP_PRIVATE"
+        };
+
+        read_code.push(format!("  int fd = open((std::filesystem::path(dataPath) / \"{}_PARAMETERS\").c_str(), O_RDONLY);",
+                               namespace));
+        read_code.push("  if (fd < 0) return false;".to_string());
+        read_code.push("  struct stat st;".to_string());
+        read_code.push("  if (fstat(fd, &st) != 0 || (size_t)st.st_size != PARAMETERS_SIZE) {".to_string());
+        read_code.push("    close(fd);".to_string());
+        read_code.push("    return false;".to_string());
+        read_code.push("  }".to_string());
+        read_code.push(format!("  void* base = mmap(NULL, PARAMETERS_SIZE, PROT_READ, {}, fd, 0);",
+                               map_flags));
+        read_code.push("  close(fd);".to_string());
+        read_code.push("  if (base == MAP_FAILED) return false;".to_string());
+        if options.mmap_huge_pages {
+            read_code.push("  // only a hint, the load still succeeds without huge pages".to_string());
+            read_code.push("  madvise(base, PARAMETERS_SIZE, MADV_HUGEPAGE);".to_string());
+        }
+        read_code.push("  if (!check_parameters((const char*) base, false)) {".to_string());
+        read_code.push("    munmap(base, PARAMETERS_SIZE);".to_string());
+        read_code.push("    return false;".to_string());
+        read_code.push("  }".to_string());
+        read_code.push("  PARAMETERS_BASE = (char*) base;".to_string());
+
+        free_code.push("  if (PARAMETERS_BASE != NULL) munmap(PARAMETERS_BASE, PARAMETERS_SIZE);".to_string());
+    } else if !placed {
+        read_code.push(format!("  std::ifstream infile(std::filesystem::path(dataPath) / \"{}_PARAMETERS\", std::ios::in | std::ios::binary);",
+                               namespace));
+        read_code.push("  if (!infile.good()) return false;".to_string());
+        read_code.push(format!("  char* base = (char*) aligned_alloc({}, PARAMETERS_SIZE);",
+                               container::CONTAINER_ALIGNMENT));
+        read_code.push("  if (base == NULL) return false;".to_string());
+        read_code.push("  infile.read(base, PARAMETERS_SIZE);".to_string());
+        read_code.push("  if (!infile.good() || !check_parameters(base, true)) {".to_string());
+        read_code.push("    free(base);".to_string());
+        read_code.push("    return false;".to_string());
+        read_code.push("  }".to_string());
+        read_code.push("  PARAMETERS_BASE = base;".to_string());
+
+        free_code.push("  free(PARAMETERS_BASE);".to_string());
+    } else {
+        generate_placed_load(read_code, free_code, namespace, replicate);
+    }
+    free_code.push("  PARAMETERS_BASE = NULL;".to_string());
+
+    for (lp, entry) in layer_params.iter().zip(entries.iter()) {
+        if let LayerParams::Constant(_, _) = lp { continue; }
+        if replicate { continue; }
+        read_code.push(format!("  {} = ({}*) (PARAMETERS_BASE + {});",
+                               array_name!(lp.index()), lp.element_type(), entry.offset));
+    }
+    
     return Ok(());
 }
 
+// Generates the functions used by a `load` that copies the parameters into
+// memory placed for lookups (see `generate_placed_load`).
+fn generate_placed_alloc(read_code: &mut Vec<String>,
+                         huge_pages: HugePages,
+                         replicate: bool) {
+    let (page_size, explicit_bits) = huge_pages.page_size();
+    read_code.push(format!("const size_t PARAMETERS_ALLOC_SIZE = (PARAMETERS_SIZE + {0} - 1) / {0} * {0};",
+                           page_size));
+    read_code.push("// memory for a copy of the parameters, on the NUMA node `node` unless it".to_string());
+    read_code.push("// is negative".to_string());
+    read_code.push("static char* alloc_parameters(long node) {".to_string());
+    let anonymous = "mmap(NULL, PARAMETERS_ALLOC_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS";
+    if let Some(bits) = explicit_bits {
+        read_code.push(format!("  // MAP_HUGE_{}, or transparent huge pages if none are reserved",
+                               if bits == 30 { "1GB" } else { "2MB" }));
+        read_code.push(format!("  void* p = {} | MAP_HUGETLB | ({} << 26), -1, 0);", anonymous, bits));
+        read_code.push(format!("  if (p == MAP_FAILED) p = {}, -1, 0);", anonymous));
+    } else {
+        read_code.push(format!("  void* p = {}, -1, 0);", anonymous));
+    }
+    read_code.push("  if (p == MAP_FAILED) return NULL;".to_string());
+    if huge_pages != HugePages::None {
+        read_code.push("  // only a hint, which fails harmlessly for explicit huge pages".to_string());
+        read_code.push("  madvise(p, PARAMETERS_ALLOC_SIZE, MADV_HUGEPAGE);".to_string());
+    }
+    if replicate {
+        read_code.push("  if (node >= 0) {".to_string());
+        read_code.push("    // MPOL_PREFERRED, so the copy is still made if the node is full".to_string());
+        read_code.push("    unsigned long mask = 1UL << node;".to_string());
+        read_code.push("    syscall(SYS_mbind, p, PARAMETERS_ALLOC_SIZE, 1, &mask, 8 * sizeof mask + 1, 0);".to_string());
+        read_code.push("  }".to_string());
+    }
+    read_code.push("  return (char*) p;".to_string());
+    read_code.push("}".to_string());
+
+    if replicate {
+        read_code.push("// the NUMA node of the CPU the thread is running on".to_string());
+        read_code.push("static size_t numa_node() {".to_string());
+        read_code.push("  unsigned cpu, node;".to_string());
+        read_code.push("  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= MAX_NUMA_NODES) return 0;".to_string());
+        read_code.push("  return node;".to_string());
+        read_code.push("}".to_string());
+        read_code.push("static thread_local const size_t LOCAL_NODE = numa_node();".to_string());
+        read_code.push("// the number of NUMA nodes, from the highest online node (the list of".to_string());
+        read_code.push("// online nodes is in order, e.g. \"0-1\" or \"0,2-3\")".to_string());
+        read_code.push("static size_t numa_nodes() {".to_string());
+        read_code.push("  std::ifstream online(\"/sys/devices/system/node/online\");".to_string());
+        read_code.push("  std::string nodes;".to_string());
+        read_code.push("  if (!(online >> nodes)) return 1;".to_string());
+        read_code.push("  const size_t last = nodes.find_last_of(\",-\");".to_string());
+        read_code.push("  const size_t highest = strtoul(nodes.c_str() + (last == std::string::npos ? 0 : last + 1), NULL, 10);".to_string());
+        read_code.push("  return highest < MAX_NUMA_NODES ? highest + 1 : MAX_NUMA_NODES;".to_string());
+        read_code.push("}".to_string());
+    }
+}
+
+// Generates the body of a `load` that copies the parameters into memory
+// placed for lookups: anonymous memory backed by `huge_pages`, and, to
+// `replicate` them, a copy on every NUMA node. The node of each thread is
+// found the first time it looks up a key (`LOCAL_NODE`), and selects the
+// copy that the arrays of the data header point into. The copy read from
+// the file stays on the node of the thread that called `load`, and the
+// other copies are bound to their nodes before they are written. Placement
+// is only a hint: when huge pages or memory on a node cannot be had, `load`
+// still succeeds with what it gets.
+fn generate_placed_load(read_code: &mut Vec<String>,
+                        free_code: &mut Vec<String>,
+                        namespace: &str,
+                        replicate: bool) {
+    read_code.push(format!("  std::ifstream infile(std::filesystem::path(dataPath) / \"{}_PARAMETERS\", std::ios::in | std::ios::binary);",
+                           namespace));
+    read_code.push("  if (!infile.good()) return false;".to_string());
+    read_code.push("  char* base = alloc_parameters(-1);".to_string());
+    read_code.push("  if (base == NULL) return false;".to_string());
+    read_code.push("  infile.read(base, PARAMETERS_SIZE);".to_string());
+    read_code.push("  if (!infile.good() || !check_parameters(base, true)) {".to_string());
+    read_code.push("    munmap(base, PARAMETERS_ALLOC_SIZE);".to_string());
+    read_code.push("    return false;".to_string());
+    read_code.push("  }".to_string());
+    read_code.push("  PARAMETERS_BASE = base;".to_string());
+    if replicate {
+        read_code.push("  // nodes without a copy of their own use the one read from the file".to_string());
+        read_code.push("  const size_t num_nodes = numa_nodes();".to_string());
+        read_code.push("  const size_t home_node = numa_node();".to_string());
+        read_code.push("  for (size_t node = 0; node < MAX_NUMA_NODES; node++) {".to_string());
+        read_code.push("    PARAMETERS_REPLICAS[node] = base;".to_string());
+        read_code.push("    if (node >= num_nodes || node == home_node) continue;".to_string());
+        read_code.push("    char* replica = alloc_parameters(node);".to_string());
+        read_code.push("    if (replica == NULL) continue;".to_string());
+        read_code.push("    memcpy(replica, base, PARAMETERS_SIZE);".to_string());
+        read_code.push("    PARAMETERS_REPLICAS[node] = replica;".to_string());
+        read_code.push("  }".to_string());
+
+        free_code.push("  for (size_t node = 0; node < MAX_NUMA_NODES; node++) {".to_string());
+        free_code.push("    if (PARAMETERS_REPLICAS[node] != PARAMETERS_BASE)".to_string());
+        free_code.push("      munmap(PARAMETERS_REPLICAS[node], PARAMETERS_ALLOC_SIZE);".to_string());
+        free_code.push("    PARAMETERS_REPLICAS[node] = NULL;".to_string());
+        free_code.push("  }".to_string());
+    }
+    free_code.push("  if (PARAMETERS_BASE != NULL) munmap(PARAMETERS_BASE, PARAMETERS_ALLOC_SIZE);".to_string());
+}
+
 fn generate_code<T: Write>(
     code_output: &mut T,
     data_output: &mut T,
@@ -454,7 +1933,8 @@ fn generate_code<T: Write>(
     namespace: &str,
     rmi: TrainedRMI,
     data_dir: &str,
-    key_type: KeyType
+    key_type: KeyType,
+    options: &CodegenOptions
 ) -> Result<(), std::io::Error> {
     // construct the code for the model parameters.
     let mut layer_params: Vec<LayerParams> = rmi.rmi
@@ -464,35 +1944,96 @@ fn generate_code<T: Write>(
         .collect();
     
     let report_last_layer_errors = !rmi.last_layer_max_l1s.is_empty();
-
-    let mut report_lle: Vec<u8> = Vec::new();
+    // lookups report the left and right errors of their leaf separately,
+    // except in bounded RMIs (see `stored_errors`)
+    let split_errors = report_last_layer_errors && rmi.cache_fix.is_none();
+
+    // the expressions used to read the errors of the current leaf, if any:
+    // the left and right errors, or the single error.
+    let mut err_exprs: Vec<String> = Vec::new();
+    // the layer index and length of the table of (leaf, error) pairs
+    // for errors that do not fit in a quantized leaf record.
+    let mut error_overflow = None;
     if report_last_layer_errors {
-        let lle = &rmi.last_layer_max_l1s;
+        let lle = stored_errors(&rmi);
+        let num_errors = lle[0].len();
         if lle.len() > 1 {
             let old_last = layer_params.pop().unwrap();
-            let new_last = old_last.with_zipped_errors(lle);
+            let new_last = old_last.with_zipped_errors(&lle, options);
             
-            write!(report_lle, "  *err = ")?;
-            new_last.access_by_ref(&mut report_lle, "modelIndex",
-                                   new_last.params_per_model() - 1)?;
-            writeln!(report_lle, ";")?;
+            // the errors follow the leaf's own parameters (and precede any padding)
+            let mut leaf_errs = Vec::new();
+            for err_idx in 0..num_errors {
+                let mut leaf_err = Vec::new();
+                new_last.access_by_ref(&mut leaf_err, "modelIndex",
+                                       old_last.params_per_model() + err_idx)?;
+                leaf_errs.push(String::from_utf8(leaf_err).unwrap());
+            }
             
             layer_params.push(new_last);
-            
+
+            // each overflowing error is looked up by its index in the
+            // flattened errors of all the leaves
+            let overflows: Vec<ModelParam> = lle.iter().flatten().enumerate()
+                .filter(|(_idx, err)| options.quantize_errors && **err >= ERROR_OVERFLOW)
+                .flat_map(|(idx, err)| vec![idx.into(), (*err).into()])
+                .collect();
+
+            for (err_idx, leaf_err) in leaf_errs.into_iter().enumerate() {
+                if overflows.is_empty() {
+                    err_exprs.push(leaf_err);
+                } else if num_errors == 1 {
+                    err_exprs.push(format!("({0} == {1} ? _error_overflow(modelIndex) : {0})",
+                                           leaf_err, ERROR_OVERFLOW));
+                } else {
+                    err_exprs.push(format!(
+                        "({0} == {1} ? _error_overflow({2} * modelIndex + {3}) : {0})",
+                        leaf_err, ERROR_OVERFLOW, num_errors, err_idx
+                    ));
+                }
+            }
+            if !overflows.is_empty() {
+                error_overflow = Some((layer_params.len(), overflows.len() / 2));
+                layer_params.push(LayerParams::new(layer_params.len(), true, 2, overflows));
+            }
         } else {
-            write!(report_lle, "  *err = {};", lle[0])?;
+            err_exprs.extend(lle[0].iter().map(|err| err.to_string()));
         }
     }
 
-    if rmi.cache_fix.is_some() {
-        let cfv: Vec<ModelParam> = rmi.cache_fix.as_ref().unwrap().1.iter()
-            .flat_map(|(mi, offset)| vec![(*mi).into(), (*offset).into()])
-            .collect();
-        let cache_fix_params = LayerParams::new(
-            layer_params.len(), true, 2, cfv
-        );
+    let mut cache_fix_arrays = Vec::new();
+    if let Some((_, spline)) = &rmi.cache_fix {
+        match options.cache_fix_layout {
+            CacheFixLayout::Packed => {
+                let cfv: Vec<ModelParam> = spline.iter()
+                    .flat_map(|(key, offset)| vec![key.clone(), (*offset).into()])
+                    .collect();
+                cache_fix_arrays.push(array_name!(layer_params.len()));
+                let cache_fix_params = LayerParams::new(
+                    layer_params.len(), true, 2, cfv
+                );
 
-        layer_params.push(cache_fix_params);
+                layer_params.push(cache_fix_params);
+            },
+            CacheFixLayout::Soa | CacheFixLayout::Eytzinger => {
+                let points: Vec<&(ModelParam, usize)> = if options.cache_fix_layout == CacheFixLayout::Soa {
+                    spline.iter().collect()
+                } else {
+                    // the root is at 1, and the unused slot 0 holds a copy
+                    // of the first point
+                    std::iter::once(&spline[0])
+                        .chain(eytzinger_order(spline.len()).into_iter().map(|idx| &spline[idx]))
+                        .collect()
+                };
+
+                let keys: Vec<ModelParam> = points.iter().map(|(key, _)| key.clone()).collect();
+                let offsets: Vec<ModelParam> = points.iter().map(|(_, offset)| (*offset).into()).collect();
+                for params in vec![keys, offsets] {
+                    cache_fix_arrays.push(array_name!(layer_params.len()));
+                    layer_params.push(LayerParams::new(layer_params.len(), true, 1, params));
+                }
+            }
+        };
     }
 
     trace!("Layer parameters:");
@@ -503,58 +2044,14 @@ fn generate_code<T: Write>(
     writeln!(data_output, "namespace {} {{", namespace)?;    
     
     let mut read_code = Vec::new();
-    read_code.push("bool load(char const* dataPath) {".to_string());
-            
-    for lp in layer_params.iter() {
-        match lp {
-            // constants are put directly in the header 
-            LayerParams::Constant(_idx, _) => lp.to_code(data_output)?,
-            
-            LayerParams::Array(idx, _, _) |
-            LayerParams::MixedArray(idx, _, _) => {
-                let data_path = Path::new(&data_dir)
-                    .join(format!("{}_{}", namespace, array_name!(idx)));
-                let f = File::create(data_path)
-                    .expect("Could not write data file to RMI directory");
-                let mut bw = BufWriter::new(f);
-                
-                lp.write_to(&mut bw)?; // write to data file
-                lp.to_decl(data_output)?; // write to source code
-                
-                read_code.push("  {".to_string());
-                read_code.push(format!("    std::ifstream infile(std::filesystem::path(dataPath) / \"{ns}_{fn}\", std::ios::in | std::ios::binary);",
-                                       ns=namespace, fn=array_name!(idx)));
-                read_code.push("    if (!infile.good()) return false;".to_string());
-                if lp.requires_malloc() {
-                    read_code.push(format!("    {} = ({}*) malloc({});",
-                                           array_name!(idx), lp.pointer_type(), lp.size()));
-                    read_code.push(format!("    if ({} == NULL) return false;",
-                                           array_name!(idx)));
-                }
-                read_code.push(format!("    infile.read((char*){fn}, {size});",
-                                       fn=array_name!(idx), size=lp.size()));
-                read_code.push("    if (!infile.good()) return false;".to_string());
-                read_code.push("  }".to_string());
-            }
-        }
-    }
-    read_code.push("  return true;".to_string());
-    read_code.push("}".to_string());
-
-
-
     let mut free_code = Vec::new();
     free_code.push("void cleanup() {".to_string());
-    // generate free code
-    for lp in layer_params.iter() {
-        if !lp.requires_malloc() { continue; }
-        if let LayerParams::Array(idx, _, _) | LayerParams::MixedArray(idx, _, _) = lp {
-            free_code.push(format!("    free({});", array_name!(idx)));
-            continue;
-        }
-        panic!();
-    }
-    
+
+    generate_container_load(data_output, &mut read_code, &mut free_code,
+                            &rmi, &layer_params, error_overflow.map(|(idx, _)| idx),
+                            namespace, data_dir, key_type, options)?;
+    read_code.push("  return true;".to_string());
+    read_code.push("}".to_string());
     free_code.push("}".to_string());
 
     writeln!(data_output, "}} // namespace")?;
@@ -570,15 +2067,55 @@ fn generate_code<T: Write>(
         }
     }
 
+    let search = resolve_search_strategy(&rmi, options.search);
+    // encoded string keys can collide, so find must be able to continue
+    // past its window (see generate_find)
+    let colliding_keys = match key_type {
+        KeyType::Str => {
+            assert!(search != SearchStrategy::Interpolation,
+                    "Interpolation search is not supported for string keys");
+            true
+        },
+        _ => false
+    };
+    let mut search_functions = search.standard_functions();
+    if colliding_keys {
+        search_functions.extend(SearchStrategy::Exponential.standard_functions());
+    }
+    if rmi.cache_fix.is_some() && options.cache_fix_layout == CacheFixLayout::Soa {
+        search_functions.extend(SearchStrategy::Auto.standard_functions());
+    }
+    for stdlib in search_functions {
+        decls.insert(stdlib.decl().to_string());
+        sigs.insert(stdlib.code().to_string());
+    }
+
     writeln!(code_output, "#include \"{}.h\"", namespace)?;
     writeln!(code_output, "#include \"{}_data.h\"", namespace)?;
     writeln!(code_output, "#include <math.h>")?;
     writeln!(code_output, "#include <cmath>")?;
+    writeln!(code_output, "#include <cstdlib>")?;
     writeln!(code_output, "#include <fstream>")?;
     writeln!(code_output, "#include <filesystem>")?;
     writeln!(code_output, "#include <iostream>")?;
     if rmi.cache_fix.is_some() {
         writeln!(code_output, "#include <algorithm>")?;
+        writeln!(code_output, "#include <limits>")?;
+    }
+    if options.instrument {
+        writeln!(code_output, "#include <atomic>")?;
+    }
+    if options.mmap {
+        writeln!(code_output, "#include <fcntl.h>")?;
+        writeln!(code_output, "#include <sys/mman.h>")?;
+        writeln!(code_output, "#include <sys/stat.h>")?;
+        writeln!(code_output, "#include <unistd.h>")?;
+    } else if options.huge_pages != HugePages::None || options.numa_replicate {
+        writeln!(code_output, "#include <cstring>")?;
+        writeln!(code_output, "#include <string>")?;
+        writeln!(code_output, "#include <sys/mman.h>")?;
+        writeln!(code_output, "#include <sys/syscall.h>")?;
+        writeln!(code_output, "#include <unistd.h>")?;
     }
 
     writeln!(code_output, "namespace {} {{", namespace)?;
@@ -618,13 +2155,51 @@ inline size_t FCLAMP(double inp, double bound) {{
 }}\n"
     )?;
 
+    let num_leaves = rmi.rmi.last().unwrap().len();
+    if options.instrument {
+        generate_instrumentation(code_output, rmi.rmi.len(), num_leaves)?;
+    }
+
+    if let KeyType::Str = key_type {
+        let encoding = options.string_keys.as_ref()
+            .expect("The encoding of the string keys is required");
+        generate_key_encoding(code_output, encoding)?;
+    }
+
+    if let Some((idx, num_overflows)) = error_overflow {
+        writeln!(
+            code_output,
+            "
+// binary search of the sorted (index, error) pairs of the leaf errors that
+// do not fit in their record. The index of a left (right) error is twice
+// the index of its leaf (plus one).
+inline uint64_t _error_overflow(size_t errorIndex) {{
+  const uint64_t* pairs = {};
+  size_t lo = 0;
+  size_t hi = {};
+  while (lo < hi) {{
+    size_t mid = (lo + hi) / 2;
+    if (pairs[2 * mid] < errorIndex) {{
+      lo = mid + 1;
+    }} else {{
+      hi = mid;
+    }}
+  }}
+  return pairs[2 * lo + 1];
+}}\n", array_name!(idx), num_overflows)?;
+    }
+
     let rmi_lookup_name = if rmi.cache_fix.is_none() {
         "lookup"
     } else {
         "_rmi_lookup_pre_cachefix"
     };
     
-    let lookup_sig = if report_last_layer_errors {
+    // with split errors, the lookup with a single error reports the larger
+    // of the two (see below)
+    let lookup_sig = if split_errors {
+        format!("uint64_t {}({} key, size_t* lo, size_t* hi)", rmi_lookup_name, key_type.c_type())
+    } else if report_last_layer_errors {
         format!("uint64_t {}({} key, size_t* err)", rmi_lookup_name, key_type.c_type())
     } else {
         format!("uint64_t {}({} key)", rmi_lookup_name, key_type.c_type())
@@ -648,40 +2223,31 @@ inline size_t FCLAMP(double inp, double bound) {{
     for var in needed_vars {
         writeln!(code_output, "  {}", var)?;
     }
+    if options.instrument {
+        writeln!(code_output, "  _LookupStats* stats = _stats();")?;
+        writeln!(code_output, "  _count(stats->lookups);")?;
+    }
 
-    let model_size_bytes = rmi_size(&rmi);
+    let model_size_bytes = rmi_size_for(&rmi, options);
     info!("Generated model size: {:?} ({} bytes)", ByteSize(model_size_bytes), model_size_bytes);
 
+    let (model_key_type, model_key) = match key_type {
+        KeyType::Str => {
+            writeln!(code_output, "  const uint64_t ekey = _encode_key(key);")?;
+            (KeyType::U64, "ekey")
+        },
+        _ => (key_type, "key")
+    };
+
     let mut last_model_output = key_type.to_model_data_type();
     let mut needs_bounds_check = true;
 
     for (layer_idx, layer) in rmi.rmi.iter().enumerate() {
-        let layer_param = &layer_params[layer_idx];
-        let required_type = layer[0].input_type();
-
-        let current_model_output = layer[0].output_type();
-
-        let var_name = match current_model_output {
-            ModelDataType::Int => "ipred",
-            ModelDataType::Float => "fpred",
-            ModelDataType::Int128 => "i128pred"
-        };
-
-        let num_parameters = layer[0].params().len();
-        if layer.len() == 1 {
-            // use constant indexing, only one model
-            write!(
-                code_output,
-                "  {} = {}(",
-                var_name,
-                layer[0].function_name()
-            )?;
-
-            for pidx in 0..num_parameters {
-                layer_param.access_by_const(code_output, pidx)?;
-                write!(code_output, ", ")?;
+        if layer.len() > 1 {
+            if options.instrument && needs_bounds_check {
+                writeln!(code_output, "  if ({}) _count(stats->clamps[{}]);",
+                         clamp_condition(&last_model_output, layer.len()), layer_idx - 1)?;
             }
-        } else {
             // we need to get the model index based on the previous
             // prediction, and then use ref accessing
             writeln!(
@@ -689,26 +2255,32 @@ inline size_t FCLAMP(double inp, double bound) {{
                 "  modelIndex = {};",
                 model_index_from_output!(last_model_output, layer.len(), needs_bounds_check)
             )?;
-
-            write!(
-                code_output,
-                "  {} = {}(",
-                var_name,
-                layer[0].function_name()
-            )?;
-
-            for pidx in 0..num_parameters {
-                layer_param.access_by_ref(code_output, "modelIndex", pidx)?;
-                write!(code_output, ", ")?;
-            }
         }
-        writeln!(code_output, "({})key);", required_type.c_type())?;
+        write_layer_eval(code_output, "  ", layer, &layer_params[layer_idx],
+                         model_key_type, model_key)?;
 
         last_model_output = layer[0].output_type();
-        needs_bounds_check = layer[0].needs_bounds_check();
+        needs_bounds_check = index_needs_bounds_check(layer_idx, layer);
+    }
+
+    if split_errors {
+        writeln!(code_output, "  *lo = {};", err_exprs[0])?;
+        writeln!(code_output, "  *hi = {};", err_exprs[1])?;
+    } else if report_last_layer_errors {
+        writeln!(code_output, "  *err = {};", err_exprs[0])?;
     }
 
-    writeln!(code_output, "{}", str::from_utf8(&report_lle).unwrap())?;
+    if options.instrument {
+        let leaf = if num_leaves > 1 { "modelIndex" } else { "0" };
+        writeln!(code_output, "  _count(stats->leaves[{}]);", leaf)?;
+        if split_errors {
+            writeln!(code_output, "  _count(stats->errors[_bucket(*lo > *hi ? *lo : *hi)]);")?;
+        } else if report_last_layer_errors {
+            writeln!(code_output, "  _count(stats->errors[_bucket(*err)]);")?;
+        }
+        writeln!(code_output, "  if ({}) _count(stats->clamps[{}]);",
+                 clamp_condition(&last_model_output, rmi.num_rmi_rows), rmi.rmi.len() - 1)?;
+    }
 
     writeln!(
         code_output,
@@ -717,8 +2289,61 @@ inline size_t FCLAMP(double inp, double bound) {{
     )?; // always bounds check the last level
     writeln!(code_output, "}}")?;
 
+    let err_lookup_sig = format!("uint64_t {}({} key, size_t* err)",
+                                 rmi_lookup_name, key_type.c_type());
+    if split_errors {
+        writeln!(code_output, "{} {{", err_lookup_sig)?;
+        writeln!(code_output, "  size_t lo, hi;")?;
+        writeln!(code_output, "  const uint64_t guess = {}(key, &lo, &hi);", rmi_lookup_name)?;
+        writeln!(code_output, "  *err = (lo > hi ? lo : hi);")?;
+        writeln!(code_output, "  return guess;")?;
+        writeln!(code_output, "}}")?;
+    }
+
+    let batch_err_expr = if report_last_layer_errors { Some(err_exprs.as_slice()) } else { None };
+    let batch_sig = generate_batch_lookup(
+        code_output, &rmi, &layer_params,
+        &format!("{}_batch", rmi_lookup_name), key_type,
+        batch_err_expr, 64, false
+    )?;
+    let prefetch_sig = generate_batch_lookup(
+        code_output, &rmi, &layer_params,
+        &format!("{}_prefetch", rmi_lookup_name), key_type,
+        batch_err_expr, options.prefetch_batch_size, true
+    )?;
+
+    // bounded RMIs predict positions with their spline instead
+    let mut sorted_sigs = Vec::new();
+    if rmi.cache_fix.is_none() {
+        if num_leaves > 1 {
+            let model_key_type = if let KeyType::Str = key_type { KeyType::U64 } else { key_type };
+            generate_leaf_index(code_output, &rmi, &layer_params, model_key_type)?;
+        }
+        sorted_sigs.push(generate_sorted_batch_lookup(
+            code_output, &rmi, &layer_params, "lookup_sorted_batch", key_type,
+            batch_err_expr, false
+        )?);
+        if split_errors {
+            sorted_sigs.push(generate_sorted_batch_lookup(
+                code_output, &rmi, &layer_params, "lookup_sorted_ranges", key_type,
+                batch_err_expr, true
+            )?);
+        }
+    }
+
     if rmi.cache_fix.is_some() {
-        generate_cache_fix_code(code_output, &rmi, array_name!(layer_params.len()-1))?;
+        generate_cache_fix_code(code_output, &rmi, &cache_fix_arrays, key_type, options)?;
+    }
+
+    let find_data_types = match key_type {
+        KeyType::U64 => vec!["uint64_t", "uint32_t"],
+        _ => vec![key_type.c_type()]
+    };
+    let mut find_sigs = Vec::new();
+    for data_type in find_data_types {
+        find_sigs.push(generate_find(code_output, data_type,
+                                     report_last_layer_errors || rmi.cache_fix.is_some(),
+                                     split_errors, search, colliding_keys)?);
     }
     
     writeln!(code_output, "}} // namespace")?;
@@ -726,6 +2351,11 @@ inline size_t FCLAMP(double inp, double bound) {{
     // write out our forward declarations
     writeln!(header_output, "#include <cstddef>")?;
     writeln!(header_output, "#include <cstdint>")?;
+    match key_type {
+        KeyType::U128 => writeln!(header_output, "typedef unsigned __int128 uint128_t;")?,
+        KeyType::Str => writeln!(header_output, "#include <string_view>")?,
+        _ => {}
+    };
     writeln!(header_output, "namespace {} {{", namespace)?;
 
     writeln!(header_output, "bool load(char const* dataPath);")?;
@@ -744,9 +2374,37 @@ inline size_t FCLAMP(double inp, double bound) {{
     )?;
     writeln!(header_output, "const char NAME[] = \"{}\";", namespace)?;
     if rmi.cache_fix.is_none() {
+        if split_errors {
+            writeln!(header_output, "{};", err_lookup_sig)?;
+            writeln!(header_output, "// the lower bound of the key is at most *lo positions before and *hi")?;
+            writeln!(header_output, "// positions after the returned position")?;
+        }
         writeln!(header_output, "{};", lookup_sig)?;
+        writeln!(header_output, "{};", batch_sig)?;
+        writeln!(header_output, "{};", prefetch_sig)?;
+        writeln!(header_output, "// lookup_batch for keys in ascending order, which mostly reads the")?;
+        writeln!(header_output, "// parameters of each leaf once")?;
+        writeln!(header_output, "{};", sorted_sigs[0])?;
+        if let Some(ranges_sig) = sorted_sigs.get(1) {
+            writeln!(header_output, "// for keys in ascending order, the window [lo, hi) of positions to search")?;
+            writeln!(header_output, "// for the lower bound of each key (which may be hi)")?;
+            writeln!(header_output, "{};", ranges_sig)?;
+        }
     } else {
-        writeln!(header_output, "uint64_t lookup(uint64_t key, size_t* err);")?;
+        writeln!(header_output, "uint64_t lookup({} key, size_t* err);", key_type.c_type())?;
+        writeln!(header_output, "void lookup_batch(const {}* keys, size_t n, \
+                                 uint64_t* out, size_t* errs);", key_type.c_type())?;
+        writeln!(header_output, "void lookup_prefetch(const {}* keys, size_t n, \
+                                 uint64_t* out, size_t* errs);", key_type.c_type())?;
+    }
+    for find_sig in find_sigs {
+        writeln!(header_output, "{};", find_sig)?;
+    }
+    if options.instrument {
+        writeln!(header_output, "// writes the statistics counted by lookup on every thread to path")?;
+        writeln!(header_output, "bool dump_stats(char const* path);")?;
+        writeln!(header_output, "// zeroes the statistics, while no thread is looking up keys")?;
+        writeln!(header_output, "void reset_stats();")?;
     }
     writeln!(header_output, "}}")?;
 
@@ -758,7 +2416,7 @@ pub fn output_rmi(namespace: &str,
                   mut trained_model: TrainedRMI,
                   data_dir: &str,
                   key_type: KeyType,
-                  include_errors: bool) -> Result<(), std::io::Error> {
+                  options: &CodegenOptions) -> Result<(), std::io::Error> {
     
     let f1 = File::create(format!("{}.cpp", namespace)).expect("Could not write RMI CPP file");
     let mut bw1 = BufWriter::new(f1);
@@ -770,7 +2428,7 @@ pub fn output_rmi(namespace: &str,
     let f3 = File::create(format!("{}.h", namespace)).expect("Could not write RMI header file");
     let mut bw3 = BufWriter::new(f3);
 
-    if !include_errors {
+    if !options.include_errors {
         trained_model.last_layer_max_l1s.clear();
     }
 
@@ -781,7 +2439,8 @@ pub fn output_rmi(namespace: &str,
         namespace,
         trained_model,
         data_dir,
-        key_type
+        key_type,
+        options
     );
         
     
@@ -0,0 +1,204 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+
+
+// The packed parameter container. All of the layers of an RMI are stored in
+// a single file, so the generated code can load them with one sequential
+// read (or one mmap). The layout, all little endian, is:
+//
+//   header (64 bytes)
+//     0   u64  magic ("RMIPARAM")
+//     8   u32  format version
+//     12  u32  key type (see `key_type_id`)
+//     16  u32  number of layers
+//     20  u32  flags (HEADER_FLAG_*)
+//     24  u64  number of rows the RMI indexes
+//     32  u64  total file size in bytes
+//     40  u64  checksum of everything after the layer table
+//     48  u64  error of every leaf, if HEADER_FLAG_UNIFORM_ERROR is set
+//     56  u64  reserved
+//
+//   layer table (64 bytes per layer)
+//     0   u32  flags (LAYER_FLAG_*)
+//     4   u32  parameters per model
+//     8   u64  offset of the layer's data from the start of the file
+//     16  u64  size of the layer's data in bytes
+//     24  u64  number of models in the layer
+//     32  24B  model function name, NUL padded
+//     56  8B   type of each parameter of a model (PARAM_TYPE_*), 0 padded
+//
+//   layer data, each layer starting on a 64-byte boundary
+//
+// Together with the model name, the parameter types are enough for a
+// program that was not generated for this RMI to evaluate it (see the
+// engine/ directory).
+//
+// The checksum is FNV-1a computed over 64-bit little endian words instead
+// of bytes, which is fast enough to verify on every load.
+
+use crate::models::{KeyType, ModelParam};
+use byteorder::{ByteOrder, LittleEndian, WriteBytesExt};
+use std::io::Write;
+
+pub const CONTAINER_MAGIC: &[u8; 8] = b"RMIPARAM";
+pub const CONTAINER_VERSION: u32 = 3;
+pub const CONTAINER_ALIGNMENT: usize = 64;
+pub const HEADER_SIZE: usize = 64;
+pub const LAYER_ENTRY_SIZE: usize = 64;
+pub const MODEL_NAME_SIZE: usize = 24;
+pub const MAX_PARAM_TYPES: usize = 8;
+
+pub const FNV_OFFSET_BASIS: u64 = 0xcbf2_9ce4_8422_2325;
+pub const FNV_PRIME: u64 = 0x0000_0100_0000_01b3;
+
+/// every leaf has the same error, stored in the header
+pub const HEADER_FLAG_UNIFORM_ERROR: u32 = 1;
+
+/// the layer is small enough to be compiled into the generated code
+pub const LAYER_FLAG_CONSTANT: u32 = 1;
+/// the parameters of a model are not all of the same type
+pub const LAYER_FLAG_MIXED: u32 = 2;
+/// the last parameter of each model is the model's maximum error
+pub const LAYER_FLAG_ERRORS: u32 = 4;
+/// the layer holds the (key, offset) pairs of the cache fix splines
+pub const LAYER_FLAG_CACHE_FIX: u32 = 8;
+/// the layer holds sorted (leaf, error) pairs for the leaf errors that did
+/// not fit in their 16-bit error field. With split errors, the leaf of a
+/// pair is twice the leaf index, plus one for its right error.
+pub const LAYER_FLAG_ERROR_OVERFLOW: u32 = 16;
+/// with `LAYER_FLAG_ERRORS`, the last two parameters of each model are the
+/// model's left and right errors
+pub const LAYER_FLAG_SPLIT_ERRORS: u32 = 32;
+
+pub const PARAM_TYPE_U64: u8 = 1;
+pub const PARAM_TYPE_F64: u8 = 2;
+pub const PARAM_TYPE_F32: u8 = 3;
+pub const PARAM_TYPE_U16: u8 = 4;
+pub const PARAM_TYPE_U32: u8 = 5;
+pub const PARAM_TYPE_PADDING: u8 = 6;
+pub const PARAM_TYPE_U16_ARRAY: u8 = 7;
+pub const PARAM_TYPE_U64_ARRAY: u8 = 8;
+pub const PARAM_TYPE_U32_ARRAY: u8 = 9;
+pub const PARAM_TYPE_F64_ARRAY: u8 = 10;
+
+pub struct ContainerLayer {
+    pub flags: u32,
+    pub model_name: String,
+    pub num_models: u64,
+    pub params_per_model: u32,
+    pub param_types: Vec<u8>,
+    pub data: Vec<u8>,
+}
+
+/// The location of one layer inside of a written container.
+pub struct ContainerEntry {
+    pub offset: usize,
+    pub size: usize,
+}
+
+pub fn key_type_id(key_type: KeyType) -> u32 {
+    return match key_type {
+        KeyType::U32 => 0,
+        KeyType::U64 => 1,
+        KeyType::F64 => 2,
+        KeyType::U128 => 3,
+        KeyType::Str => 4,
+    };
+}
+
+pub fn param_type_id(param: &ModelParam) -> u8 {
+    return match param {
+        ModelParam::Int(_) => PARAM_TYPE_U64,
+        ModelParam::Float(_) => PARAM_TYPE_F64,
+        ModelParam::Float32(_) => PARAM_TYPE_F32,
+        ModelParam::Short(_) => PARAM_TYPE_U16,
+        ModelParam::Int32(_) => PARAM_TYPE_U32,
+        ModelParam::Padding(_) => PARAM_TYPE_PADDING,
+        ModelParam::ShortArray(_) => PARAM_TYPE_U16_ARRAY,
+        ModelParam::IntArray(_) => PARAM_TYPE_U64_ARRAY,
+        ModelParam::Int32Array(_) => PARAM_TYPE_U32_ARRAY,
+        ModelParam::FloatArray(_) => PARAM_TYPE_F64_ARRAY,
+    };
+}
+
+fn align(offset: usize) -> usize {
+    return (offset + CONTAINER_ALIGNMENT - 1) / CONTAINER_ALIGNMENT * CONTAINER_ALIGNMENT;
+}
+
+pub fn checksum(data: &[u8]) -> u64 {
+    assert_eq!(data.len() % 8, 0, "Checksummed data must be a multiple of 8 bytes");
+    let mut hash = FNV_OFFSET_BASIS;
+    for word in data.chunks_exact(8) {
+        hash ^= LittleEndian::read_u64(word);
+        hash = hash.wrapping_mul(FNV_PRIME);
+    }
+    return hash;
+}
+
+/// Writes the container holding `layers` to `target`, and returns where
+/// each layer was placed along with the total size of the container.
+pub fn write_container<T: Write>(
+    target: &mut T,
+    key_type: KeyType,
+    num_rows: usize,
+    uniform_error: Option<u64>,
+    layers: &[ContainerLayer]) -> Result<(Vec<ContainerEntry>, usize), std::io::Error> {
+
+    let mut entries = Vec::new();
+    let mut offset = align(HEADER_SIZE + LAYER_ENTRY_SIZE * layers.len());
+    let data_start = offset;
+    for layer in layers.iter() {
+        entries.push(ContainerEntry { offset, size: layer.data.len() });
+        offset = align(offset + layer.data.len());
+    }
+    let total_size = offset;
+
+    let mut buf: Vec<u8> = Vec::with_capacity(total_size);
+    buf.write_all(CONTAINER_MAGIC)?;
+    buf.write_u32::<LittleEndian>(CONTAINER_VERSION)?;
+    buf.write_u32::<LittleEndian>(key_type_id(key_type))?;
+    buf.write_u32::<LittleEndian>(layers.len() as u32)?;
+    buf.write_u32::<LittleEndian>(
+        if uniform_error.is_some() { HEADER_FLAG_UNIFORM_ERROR } else { 0 })?;
+    buf.write_u64::<LittleEndian>(num_rows as u64)?;
+    buf.write_u64::<LittleEndian>(total_size as u64)?;
+    buf.write_u64::<LittleEndian>(0)?; // checksum, filled in below
+    buf.write_u64::<LittleEndian>(uniform_error.unwrap_or(0))?;
+    buf.write_u64::<LittleEndian>(0)?;
+    assert_eq!(buf.len(), HEADER_SIZE);
+
+    for (layer, entry) in layers.iter().zip(entries.iter()) {
+        let name = layer.model_name.as_bytes();
+        assert!(name.len() < MODEL_NAME_SIZE,
+                "Model name {} is too long for the container", layer.model_name);
+        assert!(layer.param_types.len() <= MAX_PARAM_TYPES,
+                "Too many parameter types for layer {}", layer.model_name);
+
+        buf.write_u32::<LittleEndian>(layer.flags)?;
+        buf.write_u32::<LittleEndian>(layer.params_per_model)?;
+        buf.write_u64::<LittleEndian>(entry.offset as u64)?;
+        buf.write_u64::<LittleEndian>(entry.size as u64)?;
+        buf.write_u64::<LittleEndian>(layer.num_models)?;
+        buf.write_all(name)?;
+        buf.write_all(&vec![0u8; MODEL_NAME_SIZE - name.len()])?;
+        buf.write_all(&layer.param_types)?;
+        buf.write_all(&vec![0u8; MAX_PARAM_TYPES - layer.param_types.len()])?;
+    }
+
+    for (layer, entry) in layers.iter().zip(entries.iter()) {
+        buf.resize(entry.offset, 0);
+        buf.write_all(&layer.data)?;
+    }
+    buf.resize(total_size, 0);
+
+    let hash = checksum(&buf[data_start..]);
+    LittleEndian::write_u64(&mut buf[40..48], hash);
+
+    target.write_all(&buf)?;
+    return Ok((entries, total_size));
+}
@@ -0,0 +1,275 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+
+
+// A model of how long a lookup in a two-layer RMI takes on this machine.
+// A lookup evaluates the root model, reads one leaf record, evaluates the
+// leaf model, and searches the predicted range of the data. The cost model
+// charges each step for the computation of its model type and for a random
+// read from an array of the size it reads from, so it captures both slow
+// models (e.g., `normal` and `lognormal`) and leaf layers or radix tables
+// that do not fit in cache.
+//
+// Both costs are measured by a micro-benchmark: reads are timed by chasing
+// pointers through a random cycle over arrays of increasing size, and
+// models are timed by evaluating each of them, trained on a synthetic data
+// set, on random keys. Since that takes a few seconds, the results are
+// stored in a file and only measured again if the file is missing (see
+// `CostModel::for_this_machine`).
+
+use crate::models::*;
+use crate::train::train_model;
+use json::{object, JsonValue};
+use log::*;
+use std::collections::BTreeMap;
+use std::hint::black_box;
+use std::time::Instant;
+
+const COST_MODEL_VERSION: u64 = 1;
+
+/// the model types the cost model knows the evaluation cost of
+pub const CALIBRATED_MODELS: &[&str] = &[
+    "linear", "robust_linear", "linear_spline", "cubic", "loglinear",
+    "normal", "lognormal", "radix", "radix18", "radix22"
+];
+
+// the sizes of the arrays that reads are timed on, from 4KB to 256MB
+const MIN_ARRAY_LOG2_BYTES: u32 = 12;
+const MAX_ARRAY_LOG2_BYTES: u32 = 28;
+const NUM_READS: usize = 1 << 21;
+
+const CALIBRATION_KEYS: usize = 1 << 16;
+const CALIBRATION_LEAVES: u64 = 1 << 16;
+const NUM_EVALUATIONS: usize = 1 << 22;
+
+const CACHE_LINE_BYTES: u64 = 64;
+
+pub struct CostModel {
+    // (array size in bytes, nanoseconds per random read), by size
+    read_ns: Vec<(u64, f64)>,
+    // nanoseconds per evaluation of each model type
+    eval_ns: BTreeMap<String, f64>,
+}
+
+// splitmix64, so that the benchmark does not need a random number crate
+struct SplitMix(u64);
+
+impl SplitMix {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e37_79b9_7f4a_7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+        return z ^ (z >> 31);
+    }
+
+    fn below(&mut self, bound: usize) -> usize {
+        return (self.next() % bound as u64) as usize;
+    }
+}
+
+// the time in nanoseconds of a random read from an array of `num_bytes`
+fn measure_read_ns(num_bytes: u64, rng: &mut SplitMix) -> f64 {
+    // each cache line of the array points to the next one in a random
+    // cycle (Sattolo's algorithm), so every read depends on the last one
+    let words_per_line = (CACHE_LINE_BYTES / 8) as usize;
+    let num_lines = (num_bytes / CACHE_LINE_BYTES) as usize;
+    let mut order: Vec<usize> = (0..num_lines).collect();
+    for idx in (1..num_lines).rev() {
+        let other = rng.below(idx);
+        order.swap(idx, other);
+    }
+
+    let mut array = vec![0u64; num_lines * words_per_line];
+    for idx in 0..num_lines {
+        array[order[idx] * words_per_line]
+            = (order[(idx + 1) % num_lines] * words_per_line) as u64;
+    }
+    std::mem::drop(order);
+
+    let mut pos = 0;
+    for _ in 0..usize::min(num_lines, NUM_READS) {
+        pos = array[pos] as usize;
+    }
+
+    let start = Instant::now();
+    for _ in 0..NUM_READS {
+        pos = array[pos] as usize;
+    }
+    let elapsed = start.elapsed().as_nanos() as f64;
+    black_box(pos);
+    return elapsed / NUM_READS as f64;
+}
+
+// the time in nanoseconds of evaluating a `model_type` model
+fn measure_eval_ns(model_type: &str, data: &RMITrainingData<u64>,
+                   inputs: &[ModelInput]) -> f64 {
+    let model = train_model(model_type, data);
+    let mask = inputs.len() - 1;
+    let mut total: u64 = 0;
+    let start = Instant::now();
+    for idx in 0..NUM_EVALUATIONS {
+        total = total.wrapping_add(model.predict_to_int(black_box(&inputs[idx & mask])));
+    }
+    let elapsed = start.elapsed().as_nanos() as f64;
+    black_box(total);
+    return elapsed / NUM_EVALUATIONS as f64;
+}
+
+impl CostModel {
+    /// Loads the cost model of this machine from the file named by the
+    /// `RMI_COST_MODEL` environment variable (by default
+    /// `~/.rmi_cost_model.json`), or calibrates it and saves it there if
+    /// the file does not exist.
+    pub fn for_this_machine() -> CostModel {
+        let path = match std::env::var_os("RMI_COST_MODEL") {
+            Some(p) => Some(std::path::PathBuf::from(p)),
+            None => std::env::var_os("HOME")
+                .map(|h| std::path::Path::new(&h).join(".rmi_cost_model.json"))
+        };
+
+        if let Some(p) = &path {
+            if let Ok(raw_json) = std::fs::read_to_string(p) {
+                match json::parse(raw_json.as_str()).ok().and_then(|j| CostModel::from_json(&j)) {
+                    Some(cost_model) => {
+                        info!("Read the cost model from {}", p.display());
+                        return cost_model;
+                    },
+                    None => warn!("Could not read the cost model in {}, calibrating it again",
+                                  p.display())
+                }
+            }
+        }
+
+        let cost_model = CostModel::calibrate();
+        if let Some(p) = &path {
+            match std::fs::write(p, cost_model.to_json().pretty(2)) {
+                Ok(()) => info!("Saved the cost model to {}", p.display()),
+                Err(e) => warn!("Could not save the cost model to {}: {}", p.display(), e)
+            };
+        }
+        return cost_model;
+    }
+
+    /// Measures the cost model of this machine.
+    pub fn calibrate() -> CostModel {
+        info!("Calibrating the lookup cost model...");
+        let mut rng = SplitMix(0x5eed);
+
+        let read_ns: Vec<(u64, f64)> = (MIN_ARRAY_LOG2_BYTES..=MAX_ARRAY_LOG2_BYTES)
+            .step_by(2)
+            .map(|log2_bytes| {
+                let num_bytes = 1u64 << log2_bytes;
+                let ns = measure_read_ns(num_bytes, &mut rng);
+                trace!("Random read from {} bytes: {:.2} ns", num_bytes, ns);
+                (num_bytes, ns)
+            }).collect();
+
+        let mut keys: Vec<u64> = (0..CALIBRATION_KEYS).map(|_| rng.next()).collect();
+        keys.sort();
+        let inputs: Vec<ModelInput> = (0..4096)
+            .map(|_| keys[rng.below(keys.len())].to_model_input())
+            .collect();
+        let mut data = RMITrainingData::new(Box::new(
+            keys.into_iter().enumerate().map(|(idx, key)| (key, idx)).collect::<Vec<(u64, usize)>>()
+        ));
+        data.set_scale(CALIBRATION_LEAVES as f64 / CALIBRATION_KEYS as f64);
+
+        let mut eval_ns = BTreeMap::new();
+        for model_type in CALIBRATED_MODELS {
+            let ns = measure_eval_ns(model_type, &data, &inputs);
+            trace!("Evaluating a {} model: {:.2} ns", model_type, ns);
+            eval_ns.insert(String::from(*model_type), ns);
+        }
+
+        return CostModel { read_ns, eval_ns };
+    }
+
+    fn from_json(value: &JsonValue) -> Option<CostModel> {
+        if value["version"].as_u64() != Some(COST_MODEL_VERSION) {
+            return None;
+        }
+
+        let mut read_ns = Vec::new();
+        for itm in value["read ns"].members() {
+            read_ns.push((itm["bytes"].as_u64()?, itm["ns"].as_f64()?));
+        }
+        if read_ns.is_empty() {
+            return None;
+        }
+        read_ns.sort_by_key(|(bytes, _)| *bytes);
+
+        let mut eval_ns = BTreeMap::new();
+        for model_type in CALIBRATED_MODELS {
+            eval_ns.insert(String::from(*model_type), value["eval ns"][*model_type].as_f64()?);
+        }
+
+        return Some(CostModel { read_ns, eval_ns });
+    }
+
+    fn to_json(&self) -> JsonValue {
+        let mut eval_ns = JsonValue::new_object();
+        for (model_type, ns) in self.eval_ns.iter() {
+            eval_ns[model_type.as_str()] = (*ns).into();
+        }
+
+        return object!(
+            "version" => COST_MODEL_VERSION,
+            "read ns" => self.read_ns.iter()
+                .map(|(bytes, ns)| object!("bytes" => *bytes, "ns" => *ns))
+                .collect::<Vec<JsonValue>>(),
+            "eval ns" => eval_ns
+        );
+    }
+
+    /// The time in nanoseconds of a random read from an array of
+    /// `num_bytes`, interpolated between the measured array sizes.
+    pub fn read_ns(&self, num_bytes: u64) -> f64 {
+        let (first_bytes, first_ns) = self.read_ns[0];
+        if num_bytes <= first_bytes {
+            return first_ns;
+        }
+
+        for window in self.read_ns.windows(2) {
+            let ((lo_bytes, lo_ns), (hi_bytes, hi_ns)) = (window[0], window[1]);
+            if num_bytes <= hi_bytes {
+                let frac = ((num_bytes as f64).log2() - (lo_bytes as f64).log2())
+                    / ((hi_bytes as f64).log2() - (lo_bytes as f64).log2());
+                return lo_ns + frac * (hi_ns - lo_ns);
+            }
+        }
+
+        return self.read_ns.last().unwrap().1;
+    }
+
+    /// The time in nanoseconds of evaluating a `model_type` model.
+    pub fn eval_ns(&self, model_type: &str) -> f64 {
+        return *self.eval_ns.get(model_type)
+            .unwrap_or_else(|| panic!("The cost model has no cost for model type {}", model_type));
+    }
+
+    /// The predicted time in nanoseconds of a lookup in a two-layer RMI with
+    /// a `root_model` root taking `root_bytes` and a leaf layer of
+    /// `leaf_model` models taking `leaf_bytes`, over `num_keys` keys of
+    /// `key_bytes` each. The last mile search is a binary search over
+    /// 2^`avg_log2_error` keys, which reads a new cache line of the data
+    /// for each halving until the range fits in a single line.
+    pub fn predict_ns(&self, root_model: &str, leaf_model: &str,
+                      root_bytes: u64, leaf_bytes: u64, avg_log2_error: f64,
+                      num_keys: u64, key_bytes: u64) -> f64 {
+        let root_ns = self.eval_ns(root_model) + self.read_ns(root_bytes);
+        let leaf_ns = self.eval_ns(leaf_model) + self.read_ns(leaf_bytes);
+
+        let keys_per_line = (CACHE_LINE_BYTES / key_bytes) as f64;
+        let lines_read = f64::max(0.0, avg_log2_error - keys_per_line.log2()) + 1.0;
+        let search_ns = lines_read * self.read_ns(num_keys * key_bytes)
+            + avg_log2_error * self.read_ns(0);
+
+        return root_ns + leaf_ns + search_ns;
+    }
+}
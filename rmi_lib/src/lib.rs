@@ -2,11 +2,18 @@ mod codegen;
 mod models;
 mod train;
 mod cache_fix;
+mod container;
+mod workload;
+mod cost_model;
+pub mod string_keys;
 
 pub mod optimizer;
 pub use models::{RMITrainingData, RMITrainingDataIteratorProvider, ModelInput};
-pub use models::KeyType;
+pub use models::{KeyType, TrainingKey};
 pub use optimizer::find_pareto_efficient_configs;
-pub use train::{train, train_for_size, train_bounded};
-pub use codegen::rmi_size;
-pub use codegen::output_rmi;
+pub use train::{train, train_for_workload, train_for_size, train_bounded, quantize_last_layer};
+pub use train::{update, TrainedRMI};
+pub use train::shard;
+pub use workload::QueryWorkload;
+pub use codegen::{rmi_size, rmi_size_for};
+pub use codegen::{output_rmi, CodegenOptions, SearchStrategy, CacheFixLayout, HugePages};
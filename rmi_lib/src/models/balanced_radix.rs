@@ -164,6 +164,10 @@ inline uint64_t bradix_clamp_low(uint64_t prefix_length,
     fn needs_bounds_check(&self) -> bool {
         return false;
     }
+    fn is_monotonic(&self) -> bool {
+        // keys that differ in the shifted out prefix can be routed out of order
+        return self.params.0 == 0;
+    }
     fn restriction(&self) -> ModelRestriction {
         return ModelRestriction::MustBeTop;
     }
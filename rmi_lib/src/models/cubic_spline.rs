@@ -102,12 +102,14 @@ fn cubic<T: TrainingKey>(data: &RMITrainingData<T>) -> (f64, f64, f64, f64) {
 
 pub struct CubicSplineModel {
     params: (f64, f64, f64, f64),
+    precision: ParamPrecision,
 }
 
 impl CubicSplineModel {
     pub fn new<T: TrainingKey>(data: &RMITrainingData<T>) -> CubicSplineModel {
         let cubic = CubicSplineModel {
             params: cubic(data),
+            precision: ParamPrecision::default(),
         };
 
         // check our error against a linear model --
@@ -129,6 +131,7 @@ impl CubicSplineModel {
             let lp = linear.params();
             return CubicSplineModel {
                 params: (0.0, 0.0, lp[1].as_float(), lp[0].as_float()),
+                precision: ParamPrecision::default(),
             };
         }
 
@@ -138,7 +141,10 @@ impl CubicSplineModel {
 
 impl Model for CubicSplineModel {
     fn predict_to_float(&self, inp: &ModelInput) -> f64 {
-        let (a, b, c, d) = self.params;
+        let a = self.precision.value(0, self.params.0);
+        let b = self.precision.value(1, self.params.1);
+        let c = self.precision.value(2, self.params.2);
+        let d = self.precision.value(3, self.params.3);
         let val = inp.as_float();
 
         // use mul_add here so we get the same FMA behavior as we do
@@ -159,10 +165,10 @@ impl Model for CubicSplineModel {
 
     fn params(&self) -> Vec<ModelParam> {
         return vec![
-            self.params.0.into(),
-            self.params.1.into(),
-            self.params.2.into(),
-            self.params.3.into(),
+            self.precision.param(0, self.params.0),
+            self.precision.param(1, self.params.1),
+            self.precision.param(2, self.params.2),
+            self.precision.param(3, self.params.3),
         ];
     }
 
@@ -188,7 +194,12 @@ inline double cubic(double a, double b, double c, double d, double x) {
     fn set_to_constant_model(&mut self, constant: u64) -> bool {
         self.params = (0.0, 0.0, 0.0, constant as f64);
         return true;
-    }    
+    }
+
+    fn quantize_params(&mut self, mask: &[bool]) -> bool {
+        self.precision.set(mask);
+        return true;
+    }
 }
 
 #[cfg(test)]
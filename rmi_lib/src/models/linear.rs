@@ -73,19 +73,21 @@ fn loglinear_slr<T: TrainingKey>(data: &RMITrainingData<T>) -> (f64, f64) {
 
 pub struct LinearModel {
     params: (f64, f64),
+    precision: ParamPrecision,
 }
 
 impl LinearModel {
     pub fn new<T: TrainingKey>(data: &RMITrainingData<T>) -> LinearModel {
         let params = slr(data.iter()
                          .map(|(inp, offset)| (inp.as_float(), offset as f64)));
-        return LinearModel { params };
+        return LinearModel { params, precision: ParamPrecision::default() };
     }
 }
 
 impl Model for LinearModel {
     fn predict_to_float(&self, inp: &ModelInput) -> f64 {
-        let (intercept, slope) = self.params;
+        let intercept = self.precision.value(0, self.params.0);
+        let slope = self.precision.value(1, self.params.1);
         return slope.mul_add(inp.as_float(), intercept);
     }
 
@@ -97,7 +99,8 @@ impl Model for LinearModel {
     }
 
     fn params(&self) -> Vec<ModelParam> {
-        return vec![self.params.0.into(), self.params.1.into()];
+        return vec![self.precision.param(0, self.params.0),
+                    self.precision.param(1, self.params.1)];
     }
 
     fn code(&self) -> String {
@@ -113,10 +116,20 @@ inline double linear(double alpha, double beta, double inp) {
         return String::from("linear");
     }
 
+    fn is_monotonic(&self) -> bool {
+        // fma rounds the exact (monotonic) value of the line
+        return self.params.1 >= 0.0;
+    }
+
     fn set_to_constant_model(&mut self, constant: u64) -> bool {
         self.params = (constant as f64, 0.0);
         return true;
     }
+
+    fn quantize_params(&mut self, mask: &[bool]) -> bool {
+        self.precision.set(mask);
+        return true;
+    }
 }
 
 #[cfg(test)]
@@ -232,6 +245,7 @@ mod loglin_tests {
 
 pub struct RobustLinearModel {
     params: (f64, f64),
+    precision: ParamPrecision,
 }
 
 
@@ -240,7 +254,8 @@ impl RobustLinearModel {
         let total_items = data.len();
         if data.len() == 0 {
             return RobustLinearModel {
-                params: (0.0, 0.0)
+                params: (0.0, 0.0),
+                precision: ParamPrecision::default()
             };
         }
         
@@ -255,14 +270,16 @@ impl RobustLinearModel {
                                 .map(|(inp, offset)| (inp.as_float(), offset as f64)));
         
         return RobustLinearModel {
-            params: robust_params
+            params: robust_params,
+            precision: ParamPrecision::default()
         };
     }
 }
 
 impl Model for RobustLinearModel {
     fn predict_to_float(&self, inp: &ModelInput) -> f64 {
-        let (alpha, beta) = self.params;
+        let alpha = self.precision.value(0, self.params.0);
+        let beta = self.precision.value(1, self.params.1);
         return beta.mul_add(inp.as_float(), alpha);
     }
 
@@ -274,7 +291,8 @@ impl Model for RobustLinearModel {
     }
 
     fn params(&self) -> Vec<ModelParam> {
-        return vec![self.params.0.into(), self.params.1.into()];
+        return vec![self.precision.param(0, self.params.0),
+                    self.precision.param(1, self.params.1)];
     }
 
     fn code(&self) -> String {
@@ -290,8 +308,18 @@ inline double linear(double alpha, double beta, double inp) {
         return String::from("linear");
     }
 
+    fn is_monotonic(&self) -> bool {
+        // fma rounds the exact (monotonic) value of the line
+        return self.params.1 >= 0.0;
+    }
+
     fn set_to_constant_model(&mut self, constant: u64) -> bool {
         self.params = (constant as f64, 0.0);
         return true;
     }
+
+    fn quantize_params(&mut self, mask: &[bool]) -> bool {
+        self.precision.set(mask);
+        return true;
+    }
 }
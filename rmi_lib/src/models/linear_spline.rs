@@ -36,19 +36,22 @@ fn linear_splines<T: TrainingKey>(data: &RMITrainingData<T>) -> (f64, f64) {
 
 pub struct LinearSplineModel {
     params: (f64, f64),
+    precision: ParamPrecision,
 }
 
 impl LinearSplineModel {
     pub fn new<T: TrainingKey>(data: &RMITrainingData<T>) -> LinearSplineModel {
         return LinearSplineModel {
             params: linear_splines(data),
+            precision: ParamPrecision::default(),
         };
     }
 }
 
 impl Model for LinearSplineModel {
     fn predict_to_float(&self, inp: &ModelInput) -> f64 {
-        let (alpha, beta) = self.params;
+        let alpha = self.precision.value(0, self.params.0);
+        let beta = self.precision.value(1, self.params.1);
         return beta.mul_add(inp.as_float(), alpha);
     }
 
@@ -60,7 +63,8 @@ impl Model for LinearSplineModel {
     }
 
     fn params(&self) -> Vec<ModelParam> {
-        return vec![self.params.0.into(), self.params.1.into()];
+        return vec![self.precision.param(0, self.params.0),
+                    self.precision.param(1, self.params.1)];
     }
 
     fn code(&self) -> String {
@@ -76,10 +80,20 @@ inline double linear(double alpha, double beta, double inp) {
         return String::from("linear");
     }
 
+    fn is_monotonic(&self) -> bool {
+        // fma rounds the exact (monotonic) value of the line
+        return self.params.1 >= 0.0;
+    }
+
     fn set_to_constant_model(&mut self, constant: u64) -> bool {
         self.params = (constant as f64, 0.0);
         return true;
     }
+
+    fn quantize_params(&mut self, mask: &[bool]) -> bool {
+        self.precision.set(mask);
+        return true;
+    }
 }
 
 #[cfg(test)]
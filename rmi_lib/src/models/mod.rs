@@ -41,6 +41,8 @@ pub enum KeyType {
     U64,
     F64,
     U128,
+    // strings, indexed by their encoding (see `string_keys`)
+    Str,
 }
 
 impl KeyType {
@@ -50,6 +52,7 @@ impl KeyType {
             KeyType::U64 => "uint64_t",
             KeyType::F64 => "double",
             KeyType::U128 => "uint128_t",
+            KeyType::Str => "std::string_view",
         }
     }
 
@@ -59,6 +62,7 @@ impl KeyType {
             KeyType::U64 => ModelDataType::Int,
             KeyType::U128 => ModelDataType::Int128,
             KeyType::F64 => ModelDataType::Float,
+            KeyType::Str => ModelDataType::Int,
         }
     }
 }
@@ -72,6 +76,11 @@ pub trait TrainingKey: PartialEq + Copy + Send + Sync + std::fmt::Debug + 'stati
     fn as_float(&self) -> f64;
     fn as_uint(&self) -> u64;
     fn to_model_input(&self) -> ModelInput;
+
+    // the bits of the key, and the key with the given bits, for the files
+    // written while training
+    fn to_key_bits(&self) -> u128;
+    fn from_key_bits(bits: u128) -> Self;
 }
 
 impl TrainingKey for u64 {
@@ -98,6 +107,13 @@ impl TrainingKey for u64 {
     fn to_model_input(&self) -> ModelInput {
         (*self).into()
     }
+
+    fn to_key_bits(&self) -> u128 {
+        *self as u128
+    }
+    fn from_key_bits(bits: u128) -> Self {
+        bits as u64
+    }
 }
 
 impl TrainingKey for u32 {
@@ -124,6 +140,49 @@ impl TrainingKey for u32 {
     fn to_model_input(&self) -> ModelInput {
         (*self).into()
     }
+
+    fn to_key_bits(&self) -> u128 {
+        *self as u128
+    }
+    fn from_key_bits(bits: u128) -> Self {
+        bits as u32
+    }
+}
+
+// A u128 key is seen by integer models (e.g., radix) through its high 64
+// bits, and by float models (e.g., linear) as the nearest double, so that
+// composite keys like (tenant, timestamp) keep their order and locality.
+impl TrainingKey for u128 {
+    fn minus_epsilon(&self) -> Self {
+        *self - 1
+    }
+    fn zero_value() -> Self {
+        0
+    }
+    fn plus_epsilon(&self) -> Self {
+        *self + 1
+    }
+    fn max_value() -> Self {
+        std::u128::MAX
+    }
+
+    fn as_float(&self) -> f64 {
+        *self as f64
+    }
+    fn as_uint(&self) -> u64 {
+        (*self >> 64) as u64
+    }
+
+    fn to_model_input(&self) -> ModelInput {
+        (*self).into()
+    }
+
+    fn to_key_bits(&self) -> u128 {
+        *self
+    }
+    fn from_key_bits(bits: u128) -> Self {
+        bits
+    }
 }
 
 impl TrainingKey for f64 {
@@ -150,6 +209,13 @@ impl TrainingKey for f64 {
     fn to_model_input(&self) -> ModelInput {
         (*self).into()
     }
+
+    fn to_key_bits(&self) -> u128 {
+        f64::to_bits(*self) as u128
+    }
+    fn from_key_bits(bits: u128) -> Self {
+        f64::from_bits(bits as u64)
+    }
 }
 
 pub trait RMITrainingDataIteratorProvider: Send + Sync {
@@ -160,6 +226,21 @@ pub trait RMITrainingDataIteratorProvider: Send + Sync {
     fn get(&self, idx: usize) -> Option<(Self::InpType, usize)> {
         return Some(self.cdf_iter().nth(idx).unwrap());
     }
+
+    // the items from `start` to `end`. Providers with random access should
+    // override this, so that iterating a range does not have to skip over
+    // the items before it.
+    fn cdf_iter_range(&self, start: usize, end: usize)
+                      -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
+        return Box::new(self.cdf_iter().skip(start).take(end - start));
+    }
+
+    // If the offset of every item is its index, providers that store their
+    // keys contiguously can return them here. Passes over the data then
+    // read the slice directly instead of calling `cdf_iter`.
+    fn keys(&self) -> Option<&[Self::InpType]> {
+        return None;
+    }
 }
 
 impl<K: TrainingKey> RMITrainingDataIteratorProvider for Vec<(K, usize)> {
@@ -184,6 +265,15 @@ impl<K: TrainingKey> RMITrainingDataIteratorProvider for Vec<(K, usize)> {
             .get(idx)
             .map(|(key, offset)| ((*key).into(), *offset))
     }
+
+    fn cdf_iter_range(&self, start: usize, end: usize)
+                      -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
+        return Box::new(
+            self[start..end].iter()
+                .cloned()
+                .map(|(key, offset)| (key.into(), offset)),
+        );
+    }
 }
 
 struct FixDupsIter<K, T: Iterator<Item = (K, usize)>> {
@@ -282,8 +372,42 @@ where
     }
 }
 
-pub struct RMITrainingData<T> {
-    iterable: Arc<Box<dyn RMITrainingDataIteratorProvider<InpType = T>>>,
+// Where the items of an `RMITrainingData` come from: either a provider
+// (owned, and shared between soft copies), or a slice borrowed from the
+// caller. Training a leaf on a slice needs no allocation at all, and
+// iterating over it needs no virtual calls.
+enum TrainingSource<'a, T> {
+    Provider(Arc<Box<dyn RMITrainingDataIteratorProvider<InpType = T>>>),
+    Slice(&'a [(T, usize)]),
+}
+
+// An iterator over any kind of training source.
+enum SourceIter<P, K, S> {
+    Provider(P),
+    Keys(K),
+    Slice(S),
+}
+
+impl<I, P, K, S> Iterator for SourceIter<P, K, S>
+where
+    P: Iterator<Item = I>,
+    K: Iterator<Item = I>,
+    S: Iterator<Item = I>,
+{
+    type Item = I;
+
+    #[inline]
+    fn next(&mut self) -> Option<I> {
+        match self {
+            SourceIter::Provider(it) => it.next(),
+            SourceIter::Keys(it) => it.next(),
+            SourceIter::Slice(it) => it.next(),
+        }
+    }
+}
+
+pub struct RMITrainingData<'a, T> {
+    iterable: TrainingSource<'a, T>,
     scale: f64,
 }
 
@@ -301,22 +425,61 @@ macro_rules! map_scale {
     }};
 }
 
-impl<T: TrainingKey> RMITrainingData<T> {
+impl<'a, T: TrainingKey> RMITrainingData<'a, T> {
     pub fn new(
         iterable: Box<dyn RMITrainingDataIteratorProvider<InpType = T>>,
-    ) -> RMITrainingData<T> {
+    ) -> RMITrainingData<'a, T> {
+        return RMITrainingData {
+            iterable: TrainingSource::Provider(Arc::new(iterable)),
+            scale: 1.0,
+        };
+    }
+
+    // Training data that borrows `items` instead of owning them.
+    pub fn from_slice(items: &'a [(T, usize)]) -> RMITrainingData<'a, T> {
         return RMITrainingData {
-            iterable: Arc::new(iterable),
+            iterable: TrainingSource::Slice(items),
             scale: 1.0,
         };
     }
 
-    pub fn empty() -> RMITrainingData<T> {
-        return RMITrainingData::<T>::new(Box::new(vec![]));
+    pub fn empty() -> RMITrainingData<'a, T> {
+        return RMITrainingData::<T>::from_slice(&[]);
+    }
+
+    fn raw_get(&self, idx: usize) -> Option<(T, usize)> {
+        return match &self.iterable {
+            TrainingSource::Provider(p) => p.get(idx),
+            TrainingSource::Slice(items) => items.get(idx).copied(),
+        };
+    }
+
+    fn raw_iter_range(&self, start: usize, end: usize)
+                      -> impl Iterator<Item = (T, usize)> + '_ {
+        return match &self.iterable {
+            TrainingSource::Provider(p) => match p.keys() {
+                Some(keys) => SourceIter::Keys(keys[start..end].iter().copied().zip(start..)),
+                None => SourceIter::Provider(p.cdf_iter_range(start, end)),
+            },
+            TrainingSource::Slice(items) => SourceIter::Slice(items[start..end].iter().copied()),
+        };
+    }
+
+    fn raw_iter(&self) -> impl Iterator<Item = (T, usize)> + '_ {
+        return match &self.iterable {
+            TrainingSource::Provider(p) => match p.keys() {
+                Some(keys) => SourceIter::Keys(keys.iter().copied().zip(0..)),
+                None => SourceIter::Provider(p.cdf_iter()),
+            },
+            TrainingSource::Slice(items) => SourceIter::Slice(items.iter().copied()),
+        };
     }
 
     pub fn len(&self) -> usize {
-        return self.iterable.len();
+        return match &self.iterable {
+            TrainingSource::Provider(p) => p.len(),
+            TrainingSource::Slice(items) => items.len(),
+        };
     }
 
     pub fn set_scale(&mut self, scale: f64) {
@@ -324,24 +487,64 @@ impl<T: TrainingKey> RMITrainingData<T> {
     }
 
     pub fn get(&self, idx: usize) -> (T, usize) {
-        return map_scale!(self, self.iterable.get(idx)).unwrap();
+        return map_scale!(self, self.raw_get(idx)).unwrap();
     }
 
     pub fn get_key(&self, idx: usize) -> T {
-        return map_scale!(self, self.iterable.get(idx)).unwrap().0;
+        return map_scale!(self, self.raw_get(idx)).unwrap().0;
     }
 
     pub fn iter(&self) -> impl Iterator<Item = (T, usize)> + '_ {
-        map_scale!(self, FixDupsIter::new(self.iterable.cdf_iter()))
+        map_scale!(self, FixDupsIter::new(self.raw_iter()))
     }
 
     pub fn iter_model_input(&self) -> impl Iterator<Item = (ModelInput, usize)> + '_ {
-        return map_scale!(self, FixDupsIter::new(self.iterable.cdf_iter()))
+        return map_scale!(self, FixDupsIter::new(self.raw_iter()))
             .map(|(k, o)| (k.to_model_input(), o));
     }
 
+    // Iterates over the items from `start` to `end` like `iter` does. The
+    // item at `start` must be the first one with its key (see `run_start`).
+    pub fn iter_range(&self, start: usize, end: usize) -> impl Iterator<Item = (T, usize)> + '_ {
+        map_scale!(self, FixDupsIter::new(self.raw_iter_range(start, end))
+                   .take(end - start))
+    }
+
+    pub fn iter_model_input_range(&self, start: usize, end: usize)
+                                  -> impl Iterator<Item = (ModelInput, usize)> + '_ {
+        return self.iter_range(start, end)
+            .map(|(k, o)| (k.to_model_input(), o));
+    }
+
+    // the index of the first item with the same key as the item at `idx`
+    pub fn run_start(&self, idx: usize) -> usize {
+        let key = self.get_key(idx);
+        let mut start = idx;
+        while start > 0 && self.get_key(start - 1) == key {
+            start -= 1;
+        }
+        return start;
+    }
+
+    // Splits the items into at most `num_chunks` ranges of about the same
+    // size, without splitting any run of duplicate keys, so that each range
+    // can be iterated with `iter_range`.
+    pub fn chunk_bounds(&self, num_chunks: usize) -> Vec<(usize, usize)> {
+        let len = self.len();
+        let num_chunks = usize::max(1, usize::min(num_chunks, len));
+        let mut starts: Vec<usize> = (0..num_chunks)
+            .map(|i| if i == 0 { 0 } else { self.run_start(i * len / num_chunks) })
+            .collect();
+        starts.dedup();
+        starts.push(len);
+        return starts.windows(2)
+            .map(|w| (w[0], w[1]))
+            .filter(|(start, end)| start < end)
+            .collect();
+    }
+
     pub fn iter_unique(&self) -> impl Iterator<Item = (T, usize)> + '_ {
-        map_scale!(self, DedupIter::new(self.iterable.cdf_iter()))
+        map_scale!(self, DedupIter::new(self.raw_iter()))
     }
 
     // Code adapted from superslice,
@@ -366,10 +569,13 @@ impl<T: TrainingKey> RMITrainingData<T> {
         let cmp = f(self.get(base));
         base + (cmp == Ordering::Less) as usize
     }
-    pub fn soft_copy(&self) -> RMITrainingData<T> {
+    pub fn soft_copy(&self) -> RMITrainingData<'a, T> {
         return RMITrainingData {
             scale: self.scale,
-            iterable: Arc::clone(&self.iterable),
+            iterable: match &self.iterable {
+                TrainingSource::Provider(p) => TrainingSource::Provider(Arc::clone(p)),
+                TrainingSource::Slice(items) => TrainingSource::Slice(items),
+            },
         };
     }
 }
@@ -426,23 +632,18 @@ impl PartialOrd for ModelInput {
 #[derive(Clone, Copy, Debug)]
 pub enum ModelInput {
     Int(u64),
+    Int128(u128),
     Float(f64),
 }
 
 impl PartialEq for ModelInput {
     fn eq(&self, other: &Self) -> bool {
-        match self {
-            ModelInput::Int(x) => match other {
-                ModelInput::Int(y) => x == y,
-                ModelInput::Float(_) => false,
-            },
-
-            ModelInput::Float(x) => {
-                match other {
-                    ModelInput::Int(_) => false,
-                    ModelInput::Float(y) => x == y, // exact equality is intentional
-                }
-            }
+        match (self, other) {
+            (ModelInput::Int(x), ModelInput::Int(y)) => x == y,
+            (ModelInput::Int128(x), ModelInput::Int128(y)) => x == y,
+            // exact equality is intentional
+            (ModelInput::Float(x), ModelInput::Float(y)) => x == y,
+            _ => false,
         }
     }
 }
@@ -451,15 +652,11 @@ impl Eq for ModelInput {}
 
 impl PartialOrd for ModelInput {
     fn partial_cmp(&self, other: &ModelInput) -> Option<Ordering> {
-        match self {
-            ModelInput::Int(x) => match other {
-                ModelInput::Int(y) => x.partial_cmp(y),
-                ModelInput::Float(_) => None,
-            },
-            ModelInput::Float(x) => match other {
-                ModelInput::Int(_) => None,
-                ModelInput::Float(y) => x.partial_cmp(y),
-            },
+        match (self, other) {
+            (ModelInput::Int(x), ModelInput::Int(y)) => x.partial_cmp(y),
+            (ModelInput::Int128(x), ModelInput::Int128(y)) => x.partial_cmp(y),
+            (ModelInput::Float(x), ModelInput::Float(y)) => x.partial_cmp(y),
+            _ => None,
         }
     }
 }
@@ -468,6 +665,7 @@ impl ModelInput {
     pub fn as_float(&self) -> f64 {
         return match self {
             ModelInput::Int(x) => *x as f64,
+            ModelInput::Int128(x) => *x as f64,
             ModelInput::Float(x) => *x,
         };
     }
@@ -475,6 +673,8 @@ impl ModelInput {
     pub fn as_int(&self) -> u64 {
         return match self {
             ModelInput::Int(x) => *x,
+            // integer models use the high word of a 128-bit key
+            ModelInput::Int128(x) => (*x >> 64) as u64,
             ModelInput::Float(x) => *x as u64,
         };
     }
@@ -482,6 +682,7 @@ impl ModelInput {
     pub fn max_value(&self) -> ModelInput {
         return match self {
             ModelInput::Int(_) => std::u64::MAX.into(),
+            ModelInput::Int128(_) => std::u128::MAX.into(),
             ModelInput::Float(_) => std::f64::MAX.into(),
         };
     }
@@ -489,6 +690,7 @@ impl ModelInput {
     pub fn min_value(&self) -> ModelInput {
         return match self {
             ModelInput::Int(_) => 0.into(),
+            ModelInput::Int128(_) => 0u128.into(),
             ModelInput::Float(_) => std::f64::MIN.into(),
         };
     }
@@ -502,6 +704,7 @@ impl ModelInput {
                     0.into()
                 }
             }
+            ModelInput::Int128(x) => x.saturating_sub(1).into(),
             ModelInput::Float(x) => (x - std::f64::EPSILON).into(),
         };
     }
@@ -515,6 +718,7 @@ impl ModelInput {
                     std::u64::MAX.into()
                 }
             }
+            ModelInput::Int128(x) => x.saturating_add(1).into(),
             ModelInput::Float(x) => (x + std::f64::EPSILON).into(),
         };
     }
@@ -526,6 +730,12 @@ impl From<u64> for ModelInput {
     }
 }
 
+impl From<u128> for ModelInput {
+    fn from(i: u128) -> Self {
+        ModelInput::Int128(i)
+    }
+}
+
 impl From<u32> for ModelInput {
     fn from(i: u32) -> Self {
         ModelInput::Int(i as u64)
@@ -564,6 +774,11 @@ impl ModelDataType {
 pub enum ModelParam {
     Int(u64),
     Float(f64),
+    Float32(f32),
+    Short(u16),
+    Int32(u32),
+    // unused bytes, to align the parameters that follow
+    Padding(usize),
     ShortArray(Vec<u16>),
     IntArray(Vec<u64>),
     Int32Array(Vec<u32>),
@@ -576,6 +791,10 @@ impl ModelParam {
         match self {
             ModelParam::Int(_) => 8,
             ModelParam::Float(_) => 8,
+            ModelParam::Float32(_) => 4,
+            ModelParam::Short(_) => 2,
+            ModelParam::Int32(_) => 4,
+            ModelParam::Padding(n) => *n,
             ModelParam::ShortArray(a) => 2 * a.len(),
             ModelParam::IntArray(a) => 8 * a.len(),
             ModelParam::Int32Array(a) => 4 * a.len(),
@@ -587,6 +806,10 @@ impl ModelParam {
         match self {
             ModelParam::Int(_) => "uint64_t",
             ModelParam::Float(_) => "double",
+            ModelParam::Float32(_) => "float",
+            ModelParam::Short(_) => "uint16_t",
+            ModelParam::Int32(_) => "uint32_t",
+            ModelParam::Padding(_) => "char",
             ModelParam::ShortArray(_) => "short",
             ModelParam::IntArray(_) => "uint64_t",
             ModelParam::Int32Array(_) => "uint32_t",
@@ -598,6 +821,10 @@ impl ModelParam {
         match self {
             ModelParam::Int(_) => false,
             ModelParam::Float(_) => false,
+            ModelParam::Float32(_) => false,
+            ModelParam::Short(_) => false,
+            ModelParam::Int32(_) => false,
+            ModelParam::Padding(_) => false,
             ModelParam::ShortArray(_) => true,
             ModelParam::IntArray(_) => true,
             ModelParam::Int32Array(_) => true,
@@ -609,6 +836,10 @@ impl ModelParam {
         match self {
             ModelParam::Int(_) => "",
             ModelParam::Float(_) => "",
+            ModelParam::Float32(_) => "",
+            ModelParam::Short(_) => "",
+            ModelParam::Int32(_) => "",
+            ModelParam::Padding(_) => panic!("Cannot declare padding as a constant"),
             ModelParam::ShortArray(_) => "[]",
             ModelParam::IntArray(_) => "[]",
             ModelParam::Int32Array(_) => "[]",
@@ -626,6 +857,17 @@ impl ModelParam {
                 }
                 return tmp;
             }
+            ModelParam::Float32(v) => {
+                let mut tmp = format!("{:.}", v);
+                if !tmp.contains('.') {
+                    tmp.push_str(".0");
+                }
+                tmp.push('f');
+                return tmp;
+            }
+            ModelParam::Short(v) => format!("{}", v),
+            ModelParam::Int32(v) => format!("{}UL", v),
+            ModelParam::Padding(_) => panic!("Padding has no value"),
             ModelParam::ShortArray(arr) => {
                 let itms: Vec<String> = arr.iter().map(|i| format!("{}", i)).collect();
                 return format!("{{ {} }}", itms.join(", "));
@@ -668,6 +910,10 @@ impl ModelParam {
         match self {
             ModelParam::Int(v) => target.write_u64::<LittleEndian>(*v),
             ModelParam::Float(v) => target.write_f64::<LittleEndian>(*v),
+            ModelParam::Float32(v) => target.write_f32::<LittleEndian>(*v),
+            ModelParam::Short(v) => target.write_u16::<LittleEndian>(*v),
+            ModelParam::Int32(v) => target.write_u32::<LittleEndian>(*v),
+            ModelParam::Padding(n) => target.write_all(&vec![0u8; *n]),
             ModelParam::ShortArray(arr) => {
                 for v in arr {
                     target.write_u16::<LittleEndian>(*v)?;
@@ -704,6 +950,10 @@ impl ModelParam {
         match self {
             ModelParam::Int(v) => *v as f64,
             ModelParam::Float(v) => *v,
+            ModelParam::Float32(v) => f64::from(*v),
+            ModelParam::Short(v) => f64::from(*v),
+            ModelParam::Int32(v) => f64::from(*v),
+            ModelParam::Padding(_) => panic!("Cannot treat padding as a float"),
             ModelParam::ShortArray(_) => panic!("Cannot treat a short array parameter as a float"),
             ModelParam::IntArray(_) => panic!("Cannot treat an int array parameter as a float"),
             ModelParam::Int32Array(_) => panic!("Cannot treat an int32 array parameter as a float"),
@@ -715,6 +965,10 @@ impl ModelParam {
         match self {
             ModelParam::Int(_) => 1,
             ModelParam::Float(_) => 1,
+            ModelParam::Float32(_) => 1,
+            ModelParam::Short(_) => 1,
+            ModelParam::Int32(_) => 1,
+            ModelParam::Padding(_) => 0,
             ModelParam::ShortArray(p) => p.len(),
             ModelParam::IntArray(p) => p.len(),
             ModelParam::Int32Array(p) => p.len(),
@@ -771,6 +1025,43 @@ impl From<Vec<f64>> for ModelParam {
     }
 }
 
+/// Records which floating point parameters of a model have been rounded to
+/// single precision (see `Model::quantize_params`). The model keeps its
+/// original parameters, so the rounding can be undone later.
+#[derive(Clone, Copy, Default)]
+pub struct ParamPrecision {
+    float32_mask: u8,
+}
+
+impl ParamPrecision {
+    pub fn set(&mut self, mask: &[bool]) {
+        assert!(mask.len() <= 8, "At most 8 parameters can be quantized");
+        self.float32_mask = mask.iter().enumerate()
+            .filter(|(_idx, &to_f32)| to_f32)
+            .fold(0, |acc, (idx, _)| acc | (1 << idx));
+    }
+    
+    fn is_float32(&self, param_idx: usize) -> bool {
+        return self.float32_mask & (1 << param_idx) != 0;
+    }
+
+    /// the value a model should compute with for its `param_idx`th parameter
+    pub fn value(&self, param_idx: usize, v: f64) -> f64 {
+        if self.is_float32(param_idx) {
+            return f64::from(v as f32);
+        }
+        return v;
+    }
+
+    /// the parameter that should be stored for the `param_idx`th parameter
+    pub fn param(&self, param_idx: usize, v: f64) -> ModelParam {
+        if self.is_float32(param_idx) {
+            return ModelParam::Float32(v as f32);
+        }
+        return ModelParam::Float(v);
+    }
+}
+
 pub enum ModelRestriction {
     None,
     MustBeTop,
@@ -808,9 +1099,25 @@ pub trait Model: Sync + Send {
         return None;
     }
 
+    /// True if the generated model function never predicts less for a
+    /// larger key (for every key, not only the training keys), so the keys
+    /// routed to each of the models below it form a range.
+    fn is_monotonic(&self) -> bool {
+        return false;
+    }
+
     fn set_to_constant_model(&mut self, _constant: u64) -> bool {
         return false;
     }
+
+    /// Rounds the parameters selected by `mask` (one entry for each item of
+    /// `params`) to single precision, so they are stored as floats, and
+    /// restores the others to full precision. Predictions afterwards use
+    /// the rounded parameters, so errors must be computed again. Returns
+    /// false if the model cannot be quantized.
+    fn quantize_params(&mut self, _mask: &[bool]) -> bool {
+        return false;
+    }
 }
 
 #[cfg(test)]
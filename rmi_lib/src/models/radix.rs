@@ -72,6 +72,11 @@ inline uint64_t radix(uint64_t prefix_length, uint64_t bits, uint64_t inp) {
     fn function_name(&self) -> String {
         return String::from("radix");
     }
+
+    fn is_monotonic(&self) -> bool {
+        // keys that differ in the shifted out prefix can be routed out of order
+        return self.params.0 == 0;
+    }
     fn needs_bounds_check(&self) -> bool {
         return false;
     }
@@ -11,6 +11,10 @@ pub enum StdFunctions {
     EXP1,
     PHI,
     BinarySearch,
+    BranchlessLowerBound,
+    LinearLowerBound,
+    ExponentialLowerBound,
+    InterpolationLowerBound,
 }
 
 impl StdFunctions {
@@ -19,7 +23,23 @@ impl StdFunctions {
             StdFunctions::EXP1 => "inline double exp1(double x);",
             StdFunctions::PHI => "inline double phi(double x);",
             StdFunctions::BinarySearch => {
-                "uint64_t bs_lower_bound(const uint64_t a[], uint64_t n, uint64_t x);"
+                "uint64_t bs_upper_bound(const uint64_t a[], uint64_t n, uint64_t x);"
+            }
+            StdFunctions::BranchlessLowerBound => {
+                "template <typename KeyT>
+inline size_t bl_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key);"
+            }
+            StdFunctions::LinearLowerBound => {
+                "template <typename KeyT>
+inline size_t lin_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key);"
+            }
+            StdFunctions::ExponentialLowerBound => {
+                "template <typename KeyT>
+inline size_t exp_lower_bound(const KeyT* data, size_t n, size_t guess, KeyT key);"
+            }
+            StdFunctions::InterpolationLowerBound => {
+                "template <typename KeyT>
+inline size_t ip_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key);"
             }
         }
     }
@@ -59,6 +79,86 @@ uint64_t bs_upper_bound(const uint64_t a[], uint64_t n, uint64_t x) {
     return l;
 }
 
+"
+            }
+            StdFunctions::BranchlessLowerBound => {
+                "
+// index of the first item in [lo, hi) that is not less than key, or hi
+template <typename KeyT>
+inline size_t bl_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key) {
+  size_t n = hi - lo;
+  if (n == 0) return lo;
+  const KeyT* base = data + lo;
+  while (n > 1) {
+    size_t half = n / 2;
+    base = (base[half] < key ? base + half : base);
+    n -= half;
+  }
+  return (base - data) + (*base < key);
+}
+"
+            }
+            StdFunctions::LinearLowerBound => {
+                "
+// since the data is sorted, the lower bound is the number of smaller
+// items. Counting them has no branches, and vectorizes.
+template <typename KeyT>
+inline size_t lin_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key) {
+  size_t count = 0;
+  for (size_t i = lo; i < hi; i++)
+    count += (data[i] < key);
+  return lo + count;
+}
+"
+            }
+            StdFunctions::ExponentialLowerBound => {
+                "
+// gallop away from guess until the lower bound is bracketed, then
+// binary search between the last two probes.
+template <typename KeyT>
+inline size_t exp_lower_bound(const KeyT* data, size_t n, size_t guess, KeyT key) {
+  if (n == 0) return 0;
+  if (guess >= n) guess = n - 1;
+
+  size_t lo, hi;
+  size_t bound = 1;
+  if (data[guess] < key) {
+    while (guess + bound < n && data[guess + bound] < key)
+      bound *= 2;
+    lo = guess + bound / 2 + 1;
+    hi = (guess + bound < n ? guess + bound : n);
+  } else {
+    while (bound <= guess && !(data[guess - bound] < key))
+      bound *= 2;
+    lo = (bound <= guess ? guess - bound + 1 : 0);
+    hi = guess - bound / 2;
+  }
+  return bl_lower_bound(data, lo, hi, key);
+}
+"
+            }
+            StdFunctions::InterpolationLowerBound => {
+                "
+// a few interpolation steps narrow the window, then the remainder
+// is handled with a binary search.
+template <typename KeyT>
+inline size_t ip_lower_bound(const KeyT* data, size_t lo, size_t hi, KeyT key) {
+  for (int step = 0; step < 4 && hi - lo > 16; step++) {
+    const KeyT lk = data[lo];
+    const KeyT hk = data[hi - 1];
+    if (!(lk < key)) return lo;
+    if (hk < key) return hi;
+
+    size_t mid = lo + (size_t)((double)(key - lk) / (double)(hk - lk)
+                               * (double)(hi - 1 - lo));
+    if (data[mid] < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return bl_lower_bound(data, lo, hi, key);
+}
 "
             }
         }
@@ -1,11 +1,13 @@
 use crate::models::*;
 use crate::train;
 use crate::codegen;
+use crate::cost_model::CostModel;
+use crate::workload::QueryWorkload;
 use log::*;
 use json::*;
 use indicatif::{ProgressBar};
 use rayon::prelude::*;
-use std::collections::BTreeSet;
+use std::collections::{BTreeMap, BTreeSet};
 use tabular::{Table, row};
 
 //const TOP_ONLY_LAYERS: &[&str] = &["radix", "radix18", "radix22", "robust_linear"];
@@ -56,11 +58,47 @@ fn get_branching_factors() -> Vec<u64> {
     return range.map(|i| (2 as u64).pow(i)).collect();
 }
 
-fn pareto_front(results: &[RMIStatistics]) -> Vec<RMIStatistics> {
+// The fraction of the data that candidate RMIs are estimated on, if the
+// optimizer should estimate their errors instead of training them fully.
+fn sample_fraction() -> Option<f64> {
+    return std::env::var_os("RMI_OPTIMIZER_SAMPLE").map(|x| {
+        let fraction = x.to_str()
+            .and_then(|v| v.parse::<f64>().ok())
+            .filter(|v| *v > 0.0 && *v <= 1.0);
+        match fraction {
+            Some(v) => v,
+            None => panic!("Invalid optimizer sample fraction {:?}, must be in (0, 1]", x)
+        }
+    });
+}
+
+/// What the optimizer trades off against the size of an RMI.
+#[derive(Clone, Copy, Debug, PartialEq)]
+enum Objective {
+    /// the predicted time of a lookup on this machine
+    Latency,
+    /// the average log2 error
+    Log2Error
+}
+
+fn objective() -> Objective {
+    return match std::env::var_os("RMI_OPTIMIZER_OBJECTIVE") {
+        None => Objective::Latency,
+        Some(x) => {
+            match x.to_str().unwrap() {
+                "latency" => Objective::Latency,
+                "log2" => Objective::Log2Error,
+                _ => panic!("Invalid optimizer objective {}", x.to_str().unwrap())
+            }
+        }
+    };
+}
+
+fn pareto_front(results: &[RMIStatistics], objective: Objective) -> Vec<RMIStatistics> {
     let mut on_front: Vec<RMIStatistics> = Vec::new();
 
     for result in results.iter() {
-        if results.iter().any(|v| result.dominated_by(v)) {
+        if results.iter().any(|v| result.dominated_by(v, objective)) {
             // not on the front
             continue;
         }
@@ -71,7 +109,8 @@ fn pareto_front(results: &[RMIStatistics]) -> Vec<RMIStatistics> {
     return on_front;
 }
 
-fn narrow_front(results: &[RMIStatistics], desired_size: usize) -> Vec<RMIStatistics> {
+fn narrow_front(results: &[RMIStatistics], desired_size: usize,
+                objective: Objective) -> Vec<RMIStatistics> {
     assert!(desired_size >= 2);
     if results.len() <= desired_size {
         return results.to_vec();
@@ -84,15 +123,15 @@ fn narrow_front(results: &[RMIStatistics], desired_size: usize) -> Vec<RMIStatis
 
     let best_mod = tmp.remove(0);
     while tmp.len() > desired_size - 1 {
-        // find the two items closest in size and remove less accuracte one.
+        // find the two items closest in size and remove the worse one.
         let smallest_gap =
             (0..tmp.len()-1).zip(1..tmp.len())
             .map(|(idx1, idx2)| (idx1, idx2,
                                  (tmp[idx2].size as f64) / (tmp[idx1].size as f64)))
             .min_by(|(_, _, v1), (_, _, v2)| v1.partial_cmp(v2).unwrap()).unwrap();
 
-        let err1 = tmp[smallest_gap.0].average_log2_error;
-        let err2 = tmp[smallest_gap.1].average_log2_error;
+        let err1 = tmp[smallest_gap.0].objective_value(objective);
+        let err2 = tmp[smallest_gap.1].objective_value(objective);
         if err1 > err2 {
             tmp.remove(smallest_gap.0);
         } else {
@@ -124,9 +163,10 @@ fn first_phase_configs() -> Vec<(String, u64)> {
     return results;
 }
 
-fn second_phase_configs(first_phase: &[RMIStatistics]) -> Vec<(String, u64)> {
+fn second_phase_configs(first_phase: &[RMIStatistics],
+                        objective: Objective) -> Vec<(String, u64)> {
     let qualifying_model_configs = {
-        let on_front = pareto_front(first_phase);
+        let on_front = pareto_front(first_phase, objective);
         let mut qualifying = BTreeSet::new();
         for result in on_front {
             qualifying.insert(result.models.clone());
@@ -154,32 +194,79 @@ fn second_phase_configs(first_phase: &[RMIStatistics]) -> Vec<(String, u64)> {
 pub struct RMIStatistics {
     pub models: String,
     pub branching_factor: u64,
+    /// over the queries of the workload, if the RMI was trained for one,
+    /// and over the keys otherwise
     pub average_log2_error: f64,
     pub max_log2_error: f64,
-    pub size: u64
+    pub size: u64,
+    /// the predicted time of a lookup on this machine, in nanoseconds
+    pub predicted_ns: f64,
+    /// the estimated average log2 error, and the half-width of its 95%
+    /// confidence interval, if the RMI was measured on a sample
+    pub estimated_log2_error: Option<(f64, f64)>
+}
+
+// the predicted time of a lookup in an RMI, see CostModel::predict_ns
+fn predict_ns(cost_model: &CostModel, models: &str, root: &Box<dyn Model>,
+              size: u64, average_log2_error: f64, num_keys: usize, key_bytes: usize) -> f64 {
+    let layers: Vec<&str> = models.split(',').collect();
+    let root_bytes: usize = root.params().iter().map(|p| p.size()).sum();
+    return cost_model.predict_ns(layers[0], layers[1],
+                                 root_bytes as u64, size - root_bytes as u64,
+                                 average_log2_error, num_keys as u64, key_bytes as u64);
 }
 
 impl RMIStatistics {
-    fn from_trained(rmi: &train::TrainedRMI) -> RMIStatistics {
+    fn from_trained(rmi: &train::TrainedRMI, cost_model: &CostModel,
+                    key_bytes: usize) -> RMIStatistics {
+        let size = codegen::rmi_size(&rmi);
+        let average_log2_error = rmi.query_avg_log2_error.unwrap_or(rmi.model_avg_log2_error);
+        return RMIStatistics {
+            average_log2_error,
+            max_log2_error: rmi.model_max_log2_error,
+            size,
+            predicted_ns: predict_ns(cost_model, &rmi.models, &rmi.rmi[0][0], size,
+                                     average_log2_error, rmi.num_data_rows, key_bytes),
+            models: rmi.models.clone(),
+            branching_factor: rmi.branching_factor,
+            estimated_log2_error: None
+        };
+    }
+
+    fn from_estimate(rmi: &train::EstimatedRMI, cost_model: &CostModel,
+                     num_keys: usize, key_bytes: usize) -> RMIStatistics {
+        let size = codegen::estimated_rmi_size(&rmi);
         return RMIStatistics {
             average_log2_error: rmi.model_avg_log2_error,
             max_log2_error: rmi.model_max_log2_error,
-            size: codegen::rmi_size(&rmi),
+            size,
+            predicted_ns: predict_ns(cost_model, &rmi.models, &rmi.top_model, size,
+                                     rmi.model_avg_log2_error, num_keys, key_bytes),
             models: rmi.models.clone(),
-            branching_factor: rmi.branching_factor
+            branching_factor: rmi.branching_factor,
+            estimated_log2_error: Some((rmi.model_avg_log2_error, rmi.model_avg_log2_error_ci))
         };
     }
 
-    fn dominated_by(&self, other: &RMIStatistics) -> bool {
+    fn objective_value(&self, objective: Objective) -> f64 {
+        return match objective {
+            Objective::Latency => self.predicted_ns,
+            Objective::Log2Error => self.average_log2_error
+        };
+    }
+
+    fn dominated_by(&self, other: &RMIStatistics, objective: Objective) -> bool {
+        let value = self.objective_value(objective);
+        let other_value = other.objective_value(objective);
         if self.size < other.size { return false; }
-        if self.average_log2_error < other.average_log2_error { return false; }
+        if value < other_value { return false; }
 
-        if self.size == other.size && self.average_log2_error <= other.average_log2_error {
+        if self.size == other.size && value <= other_value {
             return false;
         }
 
-        let log2_diff = (self.average_log2_error - other.average_log2_error).abs();
-        if self.size <= other.size && log2_diff < std::f64::EPSILON {
+        let diff = (value - other_value).abs();
+        if self.size <= other.size && diff < std::f64::EPSILON {
             return false;
         }
 
@@ -191,15 +278,38 @@ impl RMIStatistics {
     }
 
     pub fn display_table(itms: &[RMIStatistics]) {
-        let mut table = Table::new("{:<} {:>} {:>} {:>} {:>}");
+        if itms.iter().any(|itm| itm.estimated_log2_error.is_some()) {
+            let mut table = Table::new("{:<} {:>} {:>} {:>} {:>} {:>} {:>}");
+            table.add_row(row!("Models", "Branch", "   AvgLg2", "   EstLg2",
+                               "   MaxLg2", "   Size (b)", "   Pred (ns)"));
+            for itm in itms {
+                let estimate = match itm.estimated_log2_error {
+                    Some((est, ci)) => format!("     {:2.5} ± {:1.5}", est, ci),
+                    None => String::from("     -")
+                };
+                table.add_row(row!(itm.models.clone(),
+                                   format!("{:10}", itm.branching_factor),
+                                   format!("     {:2.5}", itm.average_log2_error),
+                                   estimate,
+                                   format!("     {:2.5}", itm.max_log2_error),
+                                   format!("     {}", itm.size),
+                                   format!("     {:.1}", itm.predicted_ns)));
+            }
+
+            print!("{}", table);
+            return;
+        }
+
+        let mut table = Table::new("{:<} {:>} {:>} {:>} {:>} {:>}");
         table.add_row(row!("Models", "Branch", "   AvgLg2",
-                           "   MaxLg2", "   Size (b)"));
+                           "   MaxLg2", "   Size (b)", "   Pred (ns)"));
         for itm in itms {
             table.add_row(row!(itm.models.clone(),
                                format!("{:10}", itm.branching_factor),
                                format!("     {:2.5}", itm.average_log2_error),
                                format!("     {:2.5}", itm.max_log2_error),
-                               format!("     {}", itm.size)));
+                               format!("     {}", itm.size),
+                               format!("     {:.1}", itm.predicted_ns)));
         }
 
         print!("{}", table);
@@ -212,37 +322,124 @@ impl RMIStatistics {
             "namespace" => namespace,
             "size" => self.size,
             "average log2 error" => self.average_log2_error,
+            "predicted ns" => self.predicted_ns,
             "binary" => true
         );
     }
 }
 
 fn measure_rmis<T: TrainingKey>(data: &RMITrainingData<T>,
-                configs: &[(String, u64)]) -> Vec<RMIStatistics> {
+                configs: &[(String, u64)],
+                cost_model: &CostModel,
+                workload: Option<&QueryWorkload>) -> Vec<RMIStatistics> {
+    let key_bytes = std::mem::size_of::<T>();
     let pbar = ProgressBar::new(configs.len() as u64);
     
-   configs.par_iter()
+    // configurations with the same root model and branching factor differ
+    // only in their leaves, so they are trained together and share the root.
+    let mut groups: BTreeMap<(&str, u64), Vec<(usize, &str)>> = BTreeMap::new();
+    for (config_idx, (models, branch_factor)) in configs.iter().enumerate() {
+        let layers: Vec<&str> = models.split(',').collect();
+        assert_eq!(layers.len(), 2, "Only two-layer configurations can be measured");
+        groups.entry((layers[0], *branch_factor))
+            .or_insert_with(Vec::new)
+            .push((config_idx, layers[1]));
+    }
+    let groups: Vec<((&str, u64), Vec<(usize, &str)>)> = groups.into_iter().collect();
+
+    let mut results: Vec<(usize, RMIStatistics)> = groups.par_iter()
+        .flat_map(|((root_model, branch_factor), leaves)| {
+            let leaf_models: Vec<&str> = leaves.iter().map(|(_, leaf)| *leaf).collect();
+            let stats = train::train_variants(
+                data, root_model, &leaf_models, *branch_factor, workload,
+                |rmi| RMIStatistics::from_trained(rmi, cost_model, key_bytes)
+            );
+            pbar.inc(leaves.len() as u64);
+            leaves.iter().map(|(config_idx, _)| *config_idx)
+                .zip(stats.into_iter())
+                .collect::<Vec<(usize, RMIStatistics)>>()
+        }).collect();
+
+    results.sort_by_key(|(config_idx, _)| *config_idx);
+    return results.into_iter().map(|(_, stats)| stats).collect();
+}
+
+// Like measure_rmis, but the errors of each RMI are estimated on a
+// `sample_fraction` of the data.
+fn estimate_rmis<T: TrainingKey>(data: &RMITrainingData<T>,
+                                 configs: &[(String, u64)],
+                                 sample_fraction: f64,
+                                 cost_model: &CostModel) -> Vec<RMIStatistics> {
+    let key_bytes = std::mem::size_of::<T>();
+    let pbar = ProgressBar::new(configs.len() as u64);
+    return configs.par_iter()
         .map(|(models, branch_factor)| {
-            let mut loc_data = data.soft_copy();
-            let res = train::train(&mut loc_data, models, *branch_factor);
+            let layers: Vec<&str> = models.split(',').collect();
+            assert_eq!(layers.len(), 2, "Only two-layer configurations can be measured");
+            let estimate = train::estimate(data, layers[0], layers[1],
+                                           *branch_factor, sample_fraction);
             pbar.inc(1);
-            RMIStatistics::from_trained(&res)
-        }).collect()
+            RMIStatistics::from_estimate(&estimate, cost_model, data.len(), key_bytes)
+        }).collect();
 }
 
+// Measures the configurations on the full data, or estimates them if the
+// optimizer is sampling. Estimates do not account for a workload, so
+// configurations are always measured for one.
+fn measure_or_estimate_rmis<T: TrainingKey>(data: &RMITrainingData<T>,
+                                            configs: &[(String, u64)],
+                                            cost_model: &CostModel,
+                                            workload: Option<&QueryWorkload>) -> Vec<RMIStatistics> {
+    return match sample_fraction() {
+        Some(fraction) if workload.is_none() => estimate_rmis(data, configs, fraction, cost_model),
+        _ => measure_rmis(data, configs, cost_model, workload)
+    };
+}
+
+/// Finds up to `restrict` two-layer RMI configurations on the Pareto front
+/// of size and the optimizer's objective. With a `workload`, every
+/// configuration is trained for it (see `train::train_for_workload`) and
+/// its errors are taken over the queries.
 pub fn find_pareto_efficient_configs<T: TrainingKey>(
-    data: &RMITrainingData<T>, restrict: usize)
+    data: &RMITrainingData<T>, restrict: usize, workload: Option<&QueryWorkload>)
     -> Vec<RMIStatistics>{
+    let objective = objective();
+    let cost_model = CostModel::for_this_machine();
+    if workload.is_some() && sample_fraction().is_some() {
+        warn!("Errors cannot be estimated for a workload, so every configuration is trained");
+    }
     let initial_configs  = first_phase_configs();
-    let first_phase_results = measure_rmis(data, &initial_configs);
+    let first_phase_results = measure_or_estimate_rmis(data, &initial_configs, &cost_model,
+                                                       workload);
 
-    let next_configs = second_phase_configs(&first_phase_results);
-    let second_phase_results = measure_rmis(data, &next_configs);
+    let next_configs = second_phase_configs(&first_phase_results, objective);
+    let second_phase_results = measure_or_estimate_rmis(data, &next_configs, &cost_model,
+                                                        workload);
     
-    let mut final_front = pareto_front(&second_phase_results);
-    final_front = narrow_front(&final_front, restrict);
+    let mut final_front = pareto_front(&second_phase_results, objective);
+
+    if sample_fraction().is_some() && workload.is_none() {
+        // only the configurations on the estimated front are trained on the
+        // full data, and their estimates are kept for comparison. Twice as
+        // many as needed are trained, since some estimates are off by enough
+        // that their configurations are not on the real front.
+        final_front = narrow_front(&final_front, 2 * restrict, objective);
+        info!("Training {} configurations on the full data", final_front.len());
+        let configs: Vec<(String, u64)> = final_front.iter()
+            .map(|v| (v.models.clone(), v.branching_factor))
+            .collect();
+        let measured = measure_rmis(data, &configs, &cost_model, None);
+        let measured: Vec<RMIStatistics> = measured.into_iter().zip(final_front.iter())
+            .map(|(mut exact, estimated)| {
+                exact.estimated_log2_error = estimated.estimated_log2_error;
+                exact
+            }).collect();
+        final_front = pareto_front(&measured, objective);
+    }
+
+    final_front = narrow_front(&final_front, restrict, objective);
     final_front.sort_by(
-        |a, b| a.average_log2_error.partial_cmp(&b.average_log2_error).unwrap()
+        |a, b| a.objective_value(objective).partial_cmp(&b.objective_value(objective)).unwrap()
     );
 
     return final_front;
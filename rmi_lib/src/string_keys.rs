@@ -0,0 +1,199 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+// String keys are indexed through a fixed-width encoding that preserves
+// their order. The prefix that all of the keys share is stripped (like
+// `RadixModel` strips the common prefix of integer keys), and the bytes
+// after it are read as the digits of a mixed radix number: the digit of
+// each position is the rank of the byte among the distinct bytes that the
+// keys have at that position, and 0 where a key ends. Positions where the
+// keys only use a few bytes (digits, separators, ...) thus take up few
+// values, so more bytes fit into the 64 bits and the encoded keys are dense
+// enough for the models to fit.
+//
+// The encoding is not one-to-one: keys that only differ after the encoded
+// bytes collide. The RMI is trained on the encoded keys, which treats
+// colliding keys as duplicates, so the error of each leaf covers the
+// longest run of them (see `LeafStats`). The generated `find` then searches
+// the strings themselves to tell colliding keys apart.
+
+// the most bytes after the common prefix that can be encoded
+const MAX_ENCODED_BYTES: usize = 64;
+
+// the flag set in the code of a byte that no key has at a position
+const NOT_IN_ALPHABET: u16 = 0x200;
+
+pub struct StringKeyEncoding {
+    prefix: Vec<u8>,
+    // the code of each byte at each encoded position: one more than its
+    // rank among the bytes the keys have there (0 is the end of a key). A
+    // byte that no key has there gets the code of the largest such byte
+    // below it, or 0, and the flag.
+    codes: Vec<Vec<u16>>,
+    // the number of codes at each position
+    bases: Vec<u64>,
+    // the encodings of the first and last key, which bound every encoding
+    min_encoded: u64,
+    max_encoded: u64,
+}
+
+impl StringKeyEncoding {
+    /// The encoding for the sorted keys `keys`.
+    pub fn new(keys: &[&[u8]]) -> StringKeyEncoding {
+        let prefix_len = match (keys.first(), keys.last()) {
+            (Some(first), Some(last)) => first.iter().zip(last.iter())
+                .take_while(|(a, b)| a == b)
+                .count(),
+            _ => 0
+        };
+        let prefix = keys.first().map_or(Vec::new(), |k| k[..prefix_len].to_vec());
+
+        let max_len = keys.iter().map(|k| k.len() - prefix_len).max().unwrap_or(0);
+        let num_positions = usize::max(1, usize::min(max_len, MAX_ENCODED_BYTES));
+        let mut in_alphabet = vec![vec![false; 256]; num_positions];
+        for key in keys {
+            for (pos, byte) in key[prefix_len..].iter().take(num_positions).enumerate() {
+                in_alphabet[pos][*byte as usize] = true;
+            }
+        }
+
+        // take positions while their codes still fit into 64 bits
+        let mut codes = Vec::new();
+        let mut bases = Vec::new();
+        let mut max_value: u64 = 1;
+        for alphabet in in_alphabet {
+            let mut position_codes = Vec::with_capacity(256);
+            let mut num_below = 0;
+            for byte in 0..256 {
+                if alphabet[byte] {
+                    num_below += 1;
+                    position_codes.push(num_below);
+                } else {
+                    position_codes.push(num_below | NOT_IN_ALPHABET);
+                }
+            }
+
+            let base = num_below as u64 + 1;
+            match max_value.checked_mul(base) {
+                Some(v) => max_value = v,
+                None => break
+            };
+            codes.push(position_codes);
+            bases.push(base);
+        }
+
+        let mut encoding = StringKeyEncoding {
+            prefix, codes, bases, min_encoded: 0, max_encoded: std::u64::MAX
+        };
+        if let (Some(first), Some(last)) = (keys.first(), keys.last()) {
+            encoding.min_encoded = encoding.encode(first);
+            encoding.max_encoded = encoding.encode(last);
+        }
+        return encoding;
+    }
+
+    pub fn prefix(&self) -> &[u8] { &self.prefix }
+
+    /// the number of bytes after the prefix that are encoded
+    pub fn num_bytes(&self) -> usize { self.bases.len() }
+
+    /// the code of each byte at each encoded position
+    pub fn codes(&self) -> &[Vec<u16>] { &self.codes }
+
+    /// the number of codes at each encoded position
+    pub fn bases(&self) -> &[u64] { &self.bases }
+
+    pub fn not_in_alphabet_flag(&self) -> u16 { NOT_IN_ALPHABET }
+
+    /// the smallest and largest encoding of any key
+    pub fn bounds(&self) -> (u64, u64) { (self.min_encoded, self.max_encoded) }
+
+    /// The encoding of `key`. Keys below (above) every key of the data map
+    /// to the encoding of the first (last) key.
+    pub fn encode(&self, key: &[u8]) -> u64 {
+        let head = &key[..usize::min(key.len(), self.prefix.len())];
+        if head < self.prefix.as_slice() {
+            return self.min_encoded;
+        }
+        if head > self.prefix.as_slice() {
+            return self.max_encoded;
+        }
+
+        let mut encoded: u64 = 0;
+        let mut exact = true;
+        for (pos, base) in self.bases.iter().enumerate() {
+            let code = if !exact {
+                // the key falls after every key with the bytes before
+                base - 1
+            } else {
+                match key.get(self.prefix.len() + pos) {
+                    None => 0,
+                    Some(byte) => {
+                        let code = self.codes[pos][*byte as usize];
+                        exact = code & NOT_IN_ALPHABET == 0;
+                        (code & !NOT_IN_ALPHABET) as u64
+                    }
+                }
+            };
+            encoded = encoded * base + code;
+        }
+        return u64::min(u64::max(encoded, self.min_encoded), self.max_encoded);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sorted(keys: &[&'static [u8]]) -> Vec<&'static [u8]> {
+        let mut keys = keys.to_vec();
+        keys.sort();
+        return keys;
+    }
+
+    #[test]
+    fn test_prefix_and_bases() {
+        let keys = sorted(&[b"https://a.com", b"https://b.org", b"https://ab.com"]);
+        let enc = StringKeyEncoding::new(&keys);
+        assert_eq!(enc.prefix(), b"https://");
+        // the keys are a.com, ab.com and b.org after the prefix
+        assert_eq!(enc.bases(), &[3, 3, 4, 4, 4, 2]);
+    }
+
+    #[test]
+    fn test_encode() {
+        let keys = sorted(&[b"key-10", b"key-20", b"key-31"]);
+        let enc = StringKeyEncoding::new(&keys);
+        assert_eq!(enc.prefix(), b"key-");
+        assert_eq!(enc.bases(), &[4, 3]);
+        assert_eq!(enc.encode(b"key-10"), 3 + 1);
+        assert_eq!(enc.encode(b"key-31"), 3 * 3 + 2);
+        assert_eq!(enc.encode(b"key-2"), 2 * 3);
+        // a byte between two bytes that the keys have there
+        assert_eq!(enc.encode(b"key-15"), 3 + 2);
+        assert_eq!(enc.encode(b"key-25"), 2 * 3 + 2);
+        // keys outside of the data
+        assert_eq!(enc.encode(b"key-"), enc.encode(b"key-10"));
+        assert_eq!(enc.encode(b"abc"), enc.encode(b"key-10"));
+        assert_eq!(enc.encode(b"kez"), enc.encode(b"key-31"));
+        assert_eq!(enc.encode(b"key-4"), enc.encode(b"key-31"));
+    }
+
+    #[test]
+    fn test_encode_preserves_order() {
+        let keys = sorted(&[b"a", b"a\x00", b"ab", b"abcdefghij", b"abcdefghik",
+                            b"abd", b"b\xff", b"c"]);
+        let queries = sorted(&[b"", b"\x00", b"a", b"a\x00", b"a\x01", b"aa", b"ab", b"abc",
+                               b"abcdefghij", b"abcdefghijk", b"abcdefghik", b"abd", b"abz",
+                               b"b", b"b\xfe", b"b\xff", b"b\xff\xff", b"c", b"d"]);
+        let enc = StringKeyEncoding::new(&keys);
+        for pair in queries.windows(2) {
+            assert!(enc.encode(pair[0]) <= enc.encode(pair[1]),
+                    "{:?} {:?}", pair[0], pair[1]);
+        }
+    }
+}
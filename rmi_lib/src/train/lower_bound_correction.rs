@@ -1,4 +1,5 @@
 use crate::models::*;
+use rayon::prelude::*;
 
 
 fn find_first_below<T: Copy>(data: &[Option<T>], idx: usize) -> Option<(usize, T)> {
@@ -88,43 +89,107 @@ pub struct LowerBoundCorrection<T> {
     run_lengths: Vec<u64>
 }
 
+// The first and last key of a leaf within one chunk of the data, along
+// with the longest run of a key in the leaf within the chunk.
+struct ChunkLeafStats<T> {
+    leaf_idx: usize,
+    first: (usize, T),
+    last: (usize, T),
+    max_run_length: u64
+}
+
+fn chunk_leaf_stats<T: TrainingKey, F>(pred_func: &F, num_leaf_models: u64,
+                                       data: &RMITrainingData<T>,
+                                       start_idx: usize, end_idx: usize,
+                                       is_last_chunk: bool)
+                                       -> Vec<ChunkLeafStats<T>>
+where F: Fn(T) -> u64 {
+    let mut stats: Vec<ChunkLeafStats<T>> = Vec::new();
+    let mut current_run_length = 0;
+    let mut current_run_key = data.get_key(start_idx);
+    for (x, y) in data.iter_range(start_idx, end_idx) {
+        let leaf_idx = pred_func(x.into());
+        let target = u64::min(num_leaf_models - 1, leaf_idx) as usize;
+
+        match stats.last_mut() {
+            Some(leaf) if leaf.leaf_idx == target => {
+                if x == current_run_key {
+                    current_run_length += 1;
+                } else {
+                    leaf.max_run_length = u64::max(leaf.max_run_length, current_run_length);
+                    current_run_length = 1;
+                    current_run_key = x;
+                }
+                leaf.last = (y, x);
+            },
+            prev => {
+                if let Some(leaf) = prev {
+                    leaf.max_run_length = u64::max(leaf.max_run_length, current_run_length);
+                }
+                current_run_length = 1;
+                current_run_key = x;
+                stats.push(ChunkLeafStats {
+                    leaf_idx: target, first: (y, x), last: (y, x), max_run_length: 0
+                });
+            }
+        };
+    }
+
+    // chunks end on a change of key, which ends the current run. The run
+    // at the very end of the data is not counted.
+    if !is_last_chunk {
+        if let Some(leaf) = stats.last_mut() {
+            leaf.max_run_length = u64::max(leaf.max_run_length, current_run_length);
+        }
+    }
+
+    return stats;
+}
+
 impl <T: TrainingKey> LowerBoundCorrection<T> {
     pub fn new<F>(pred_func: F, num_leaf_models: u64, data: &RMITrainingData<T>) -> LowerBoundCorrection<T>
-    where F: Fn(T) -> u64 {
+    where F: Fn(T) -> u64 + Sync {
     
         let mut first_key_for_leaf: Vec<Option<(usize, T)>>
             = vec![None ; num_leaf_models as usize];
         let mut last_key_for_leaf: Vec<Option<(usize, T)>>
             = vec![None ; num_leaf_models as usize];
         let mut max_run_length: Vec<u64> = vec![0 ; num_leaf_models as usize];
-        
-        let mut last_target = 0;
-        let mut current_run_length = 0;
-        let mut current_run_key = data.get_key(0);
-        for (x, y) in data.iter() {
-            let leaf_idx = pred_func(x.into());
-            let target = u64::min(num_leaf_models - 1, leaf_idx) as usize;
-            
-            if target == last_target && x == current_run_key {
-                current_run_length += 1;
-            } else if target != last_target || x != current_run_key {
-                max_run_length[last_target] = u64::max(
-                    max_run_length[last_target],
-                    current_run_length
-                );
-                
-                current_run_length = 1;
-                current_run_key = x;
-                last_target = target;
-            }
-            
-            if first_key_for_leaf[target].is_none() {
-                first_key_for_leaf[target] = Some((y, x));
+
+        // runs of a key never cross chunks, so each chunk can be scanned
+        // on its own and the results merged in order.
+        let chunks = data.chunk_bounds(rayon::current_num_threads() * 4);
+        let chunk_stats: Vec<Vec<ChunkLeafStats<T>>> = chunks.par_iter().enumerate()
+            .map(|(chunk_idx, &(start_idx, end_idx))| {
+                chunk_leaf_stats(&pred_func, num_leaf_models, data,
+                                 start_idx, end_idx, chunk_idx == chunks.len() - 1)
+            }).collect();
+
+        for leaf in chunk_stats.into_iter().flatten() {
+            if first_key_for_leaf[leaf.leaf_idx].is_none() {
+                first_key_for_leaf[leaf.leaf_idx] = Some(leaf.first);
             }
-            last_key_for_leaf[target] = Some((y, x));
+            last_key_for_leaf[leaf.leaf_idx] = Some(leaf.last);
+            max_run_length[leaf.leaf_idx] = u64::max(max_run_length[leaf.leaf_idx],
+                                                     leaf.max_run_length);
         }
 
-        let next_for_leaf = compute_next_for_leaf(num_leaf_models, data.len(), &first_key_for_leaf);
+        return LowerBoundCorrection::from_leaves(first_key_for_leaf, last_key_for_leaf,
+                                                 max_run_length, data.len());
+    }
+
+    // Builds the corrections from the first and last (offset, key) pair of
+    // each leaf and the longest run of a key in each leaf, for callers that
+    // have already made a pass over the data.
+    pub fn from_leaves(first_key_for_leaf: Vec<Option<(usize, T)>>,
+                       last_key_for_leaf: Vec<Option<(usize, T)>>,
+                       max_run_length: Vec<u64>,
+                       num_keys: usize) -> LowerBoundCorrection<T> {
+        let num_leaf_models = first_key_for_leaf.len() as u64;
+        assert_eq!(last_key_for_leaf.len(), num_leaf_models as usize);
+        assert_eq!(max_run_length.len(), num_leaf_models as usize);
+
+        let next_for_leaf = compute_next_for_leaf(num_leaf_models, num_keys, &first_key_for_leaf);
         let prev_for_leaf = compute_prev_for_leaf(num_leaf_models, &last_key_for_leaf);
         
         return LowerBoundCorrection {
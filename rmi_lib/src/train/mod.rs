@@ -7,13 +7,15 @@
  
 
 use crate::models::*;
-use crate::cache_fix::cache_fix;
+use crate::cache_fix::{cache_fix, SplineKey};
+use crate::workload::QueryWorkload;
 use log::*;
 use std::time::SystemTime;
 
 mod two_layer;
-//mod multi_layer;
+mod multi_layer;
 mod lower_bound_correction;
+pub mod shard;
 
 pub struct TrainedRMI {
     pub num_rmi_rows: usize,
@@ -24,16 +26,44 @@ pub struct TrainedRMI {
     pub model_max_error: u64,
     pub model_max_error_idx: usize,
     pub model_max_log2_error: f64,
-    pub last_layer_max_l1s: Vec<u64>,
+    /// the (left, right) error of each leaf: the lower bound of every key
+    /// routed to the leaf is at most `left` positions before and `right`
+    /// positions after its prediction
+    pub last_layer_max_l1s: Vec<(u64, u64)>,
+    /// the number of keys routed to each leaf
+    pub leaf_key_counts: Vec<u64>,
+    /// for RMIs trained for a workload, the number of queries routed to
+    /// each leaf
+    pub leaf_query_counts: Vec<u64>,
+    /// for RMIs trained for a workload, the average log2 error over its
+    /// queries, which is the expected number of steps of a binary search
+    /// per query
+    pub query_avg_log2_error: Option<f64>,
     pub rmi: Vec<Vec<Box<dyn Model>>>,
     pub models: String,
     pub branching_factor: u64,
-    pub cache_fix: Option<(usize, Vec<(u64, usize)>)>,
+    /// for bounded RMIs, the line size and the (key, offset) points of
+    /// the spline, whose keys have the type of the data's keys
+    pub cache_fix: Option<(usize, Vec<(ModelParam, usize)>)>,
     pub build_time: u128
 }
 
-fn train_model<T: TrainingKey>(model_type: &str,
-                              data: &RMITrainingData<T>) -> Box<dyn Model> {
+/// The estimated errors of a two-layer RMI, along with its root model and
+/// one of its leaf models (see `estimate`).
+pub struct EstimatedRMI {
+    pub model_avg_log2_error: f64,
+    /// the half-width of the 95% confidence interval of the average log2 error
+    pub model_avg_log2_error_ci: f64,
+    pub model_max_error: u64,
+    pub model_max_log2_error: f64,
+    pub top_model: Box<dyn Model>,
+    pub leaf_model: Box<dyn Model>,
+    pub models: String,
+    pub branching_factor: u64
+}
+
+pub fn train_model<T: TrainingKey>(model_type: &str,
+                                  data: &RMITrainingData<T>) -> Box<dyn Model> {
     let model: Box<dyn Model> = match model_type {
         "linear" => Box::new(LinearModel::new(data)),
         "robust_linear" => Box::new(RobustLinearModel::new(data)),
@@ -99,6 +129,25 @@ fn validate(model_spec: &[String]) {
 
 pub fn train<T: TrainingKey>(data: &RMITrainingData<T>,
                             model_spec: &str, branch_factor: u64) -> TrainedRMI {
+    return train_with(data, model_spec, branch_factor, None);
+}
+
+/// Trains an RMI for the queries of `workload`: part of the leaves (see
+/// `QUERY_LEAF_SHARE`) are allocated by query frequency instead of key
+/// frequency, so there are more, smaller leaves where the queries
+/// concentrate, and the RMI reports its average log2 error over the
+/// queries. Only two-layer RMIs can be trained for a workload.
+pub fn train_for_workload<T: TrainingKey>(data: &RMITrainingData<T>,
+                                         model_spec: &str, branch_factor: u64,
+                                         workload: &QueryWorkload) -> TrainedRMI {
+    assert_eq!(model_spec.split(',').count(), 2,
+               "Only two-layer RMIs can be trained for a workload");
+    return train_with(data, model_spec, branch_factor, Some(workload));
+}
+
+fn train_with<T: TrainingKey>(data: &RMITrainingData<T>,
+                             model_spec: &str, branch_factor: u64,
+                             workload: Option<&QueryWorkload>) -> TrainedRMI {
 
     let start_time = SystemTime::now();
     let (model_list, last_model): (Vec<String>, String) = {
@@ -108,28 +157,97 @@ pub fn train<T: TrainingKey>(data: &RMITrainingData<T>,
         (all_models, last)
     };
 
-    if model_list.len() == 1 {
-        let mut res = two_layer::train_two_layer(&mut data.soft_copy(), &model_list[0],
-                                             &last_model, branch_factor);
-        let build_time = SystemTime::now()
-            .duration_since(start_time)
-            .map(|d| d.as_nanos())
-            .unwrap_or(std::u128::MAX);
-        res.build_time = build_time;
-        
-        return res;
-    }
+    assert!(!model_list.is_empty(), "An RMI must have at least two layers");
+    let mut res = if model_list.len() == 1 {
+        two_layer::train_two_layer(&mut data.soft_copy(), &model_list[0],
+                                   &last_model, branch_factor, workload)
+    } else {
+        multi_layer::train_multi_layer(data, &model_list, &last_model, branch_factor)
+    };
+
+    let build_time = SystemTime::now()
+        .duration_since(start_time)
+        .map(|d| d.as_nanos())
+        .unwrap_or(std::u128::MAX);
+    res.build_time = build_time;
+    return res;
+}
+
+/// Trains a two-layer RMI with a `root_model` root and `branch_factor`
+/// leaves for each of the `leaf_models` types, and returns `f` of each RMI.
+/// This is faster than calling `train` for each of them, since the root
+/// model is trained once and shared by the leaves of every type. With a
+/// `workload`, the RMIs are trained for it (see `train_for_workload`).
+pub fn train_variants<T, F, R>(data: &RMITrainingData<T>,
+                               root_model: &str, leaf_models: &[&str],
+                               branch_factor: u64, workload: Option<&QueryWorkload>,
+                               f: F) -> Vec<R>
+where T: TrainingKey, F: Fn(&TrainedRMI) -> R {
+    return two_layer::train_two_layer_variants(&mut data.soft_copy(), root_model,
+                                               leaf_models, branch_factor, workload, f);
+}
+
+/// Estimates the errors of a two-layer RMI with a `root_model` root and
+/// `branch_factor` leaves of type `leaf_model` without training all of it.
+/// The root is trained on a `sample_fraction` of the keys, and at most a
+/// `sample_fraction` of the leaves (but at least a sample of 128 keys' worth)
+/// are trained on all of their keys.
+pub fn estimate<T: TrainingKey>(data: &RMITrainingData<T>,
+                               root_model: &str, leaf_model: &str,
+                               branch_factor: u64, sample_fraction: f64) -> EstimatedRMI {
+    return two_layer::estimate_two_layer(data, root_model, leaf_model,
+                                         branch_factor, sample_fraction);
+}
 
-    // it is not a simple, two layer rmi
-    //return multi_layer::train_multi_layer(data, &model_list, last_model, branch_factor);
-    panic!(); // TODO
+/// Stores the parameters of the last layer of `rmi` in single precision
+/// where that keeps the average log2 error within `max_log2_growth` of the
+/// full-precision RMI. The errors of the returned RMI are computed again for
+/// the rounded parameters. `data` must be the data the RMI was trained on.
+pub fn quantize_last_layer<T: TrainingKey>(data: &RMITrainingData<T>,
+                                          rmi: TrainedRMI,
+                                          max_log2_growth: f64) -> TrainedRMI {
+    assert!(rmi.cache_fix.is_none(), "Cannot quantize a bounded RMI");
+    let start_time = SystemTime::now();
+    let mut res = two_layer::quantize_two_layer(data, rmi, max_log2_growth);
+    let quantize_time = SystemTime::now()
+        .duration_since(start_time)
+        .map(|d| d.as_nanos())
+        .unwrap_or(0);
+    res.build_time = res.build_time.saturating_add(quantize_time);
+    return res;
+}
+
+/// Updates the two-layer `rmi` for `data`, whose first `num_unchanged` keys
+/// are the same as those of the data the RMI was trained on, and whose other
+/// keys have changed, for example because keys were inserted or appended.
+/// The root model is kept, and only the leaves of the changed keys (and of
+/// the unchanged key before them) are trained again, so for appended keys
+/// the time this takes grows with the number of new keys rather than the
+/// size of the data. RMIs cannot be updated once they are quantized, and
+/// the errors of an RMI trained for a workload are no longer taken over its
+/// queries once it is updated.
+pub fn update<T: TrainingKey>(data: &RMITrainingData<T>,
+                             rmi: TrainedRMI,
+                             num_unchanged: usize) -> TrainedRMI {
+    assert!(rmi.cache_fix.is_none(), "Cannot update a bounded RMI");
+    assert_eq!(rmi.rmi.len(), 2, "Only two-layer RMIs can be updated");
+    let start_time = SystemTime::now();
+    let mut res = two_layer::update_two_layer(data, rmi, num_unchanged);
+    res.build_time = SystemTime::now()
+        .duration_since(start_time)
+        .map(|d| d.as_nanos())
+        .unwrap_or(std::u128::MAX);
+    return res;
 }
 
+/// Trains the best RMI on the optimizer's Pareto front that is smaller
+/// than `max_size`, for the `workload` if there is one.
 pub fn train_for_size<T: TrainingKey>(data: &RMITrainingData<T>,
-                                     max_size: usize) -> TrainedRMI {
+                                     max_size: usize,
+                                     workload: Option<&QueryWorkload>) -> TrainedRMI {
 
     let start_time = SystemTime::now();
-    let pareto = crate::find_pareto_efficient_configs(data, 1000);
+    let pareto = crate::find_pareto_efficient_configs(data, 1000, workload);
     // go down the front until we find something small enough
 
     let config = pareto.into_iter()
@@ -141,9 +259,10 @@ pub fn train_for_size<T: TrainingKey>(data: &RMITrainingData<T>,
     let models = config.models;
     let bf = config.branching_factor;
 
-    info!("Found RMI config {} {} with size {} and average log2 {}",
-          models, bf, config.size, config.average_log2_error);
-    let mut res = train(data, models.as_str(), bf);
+    info!("Found RMI config {} {} with size {}, average log2 {}, \
+           and predicted lookup time {:.1} ns",
+          models, bf, config.size, config.average_log2_error, config.predicted_ns);
+    let mut res = train_with(data, models.as_str(), bf, workload);
     
     let build_time = SystemTime::now()
             .duration_since(start_time)
@@ -153,7 +272,7 @@ pub fn train_for_size<T: TrainingKey>(data: &RMITrainingData<T>,
     return res;
 }
 
-pub fn train_bounded(data: &RMITrainingData<u64>,
+pub fn train_bounded<K: SplineKey>(data: &RMITrainingData<K>,
                      model_spec: &str,
                      branch_factor: u64,
                      line_size: usize) -> TrainedRMI {
@@ -163,7 +282,7 @@ pub fn train_bounded(data: &RMITrainingData<u64>,
     std::mem::drop(data);
 
     // reindex the spline points so we can build an RMI on top
-    let reindexed_splines: Vec<(u64, usize)> = spline.iter()
+    let reindexed_splines: Vec<(K, usize)> = spline.iter()
         .enumerate()
         .map(|(idx, (key, _old_offset))| (*key, idx))
         .collect();
@@ -172,7 +291,9 @@ pub fn train_bounded(data: &RMITrainingData<u64>,
     let mut new_data = RMITrainingData::new(Box::new(reindexed_splines));
 
     let mut res = crate::train(&mut new_data, model_spec, branch_factor);
-    res.cache_fix = Some((line_size, spline));
+    res.cache_fix = Some((line_size, spline.iter()
+                          .map(|(key, offset)| (key.to_param(), *offset))
+                          .collect()));
     res.num_data_rows = data.len();
     
     let build_time = SystemTime::now()
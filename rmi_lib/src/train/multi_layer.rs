@@ -1,118 +1,405 @@
-// < begin copyright > 
+// < begin copyright >
 // Copyright Ryan Marcus 2020
-// 
+//
 // See root directory of this project for license terms.
-// 
-// < end copyright > 
- 
+//
+// < end copyright >
+
+// Training RMIs with three or more layers. Each layer has `branch_factor`
+// times as many models as the layer above it, and each model is trained
+// on the keys routed to it to predict their positions, scaled to the size
+// of the next layer (the last layer predicts the positions themselves).
+//
+// Unlike in a two-layer RMI, the keys routed to a model below the second
+// layer are not always contiguous: two neighboring models of the layer
+// above can both overshoot into the other's part of the next layer. So
+// the keys of each model are gathered from the runs of keys routed to it,
+// and the lower bound corrections cover every leaf that a query in a gap
+// between two runs can reach, not only the leaves next to the gap.
+//
+// Every model is assumed to be monotonic between the first and the last
+// key it was trained on. A query in a gap can reach a model far from the
+// keys of that model, so each model is also trained on the keys on either
+// side of every gap that can reach it (in a two-layer RMI, these are the
+// usual neighboring keys of each leaf).
+
 use crate::models::*;
 use crate::train::{train_model, TrainedRMI};
+use crate::train::two_layer::{LeafStats, lower_bound_error, max_errors, assemble_rmi,
+                               SEGMENTS_PER_THREAD};
 use log::*;
+use rayon::prelude::*;
+
+// A range of consecutive keys that take the same path through the layers
+// trained so far, and the index of the model on the next layer that they
+// are routed to.
+struct Run {
+    model_idx: usize,
+    start: usize,
+    end: usize
+}
+
+// A gap between two keys where the path through the layers trained so far
+// changes: the last key before the gap and the (index, key) pair of the
+// first key after it.
+struct Gap<T> {
+    prev_key: T,
+    next: (usize, T)
+}
+
+// How the keys, and the queries between them, are routed to the models of
+// the layer below the layers trained so far.
+struct Routing<T> {
+    runs: Vec<Run>,
+    // the runs of model `m` are `run_order[run_offsets[m]..run_offsets[m + 1]]`
+    run_offsets: Vec<usize>,
+    run_order: Vec<usize>,
+    gaps: Vec<Gap<T>>,
+    // the (inclusive) ranges of models that the queries in each gap can reach
+    gap_models: Vec<Vec<(usize, usize)>>,
+    // the indexes of the keys on either side of the gaps that can reach
+    // model `m` are `gap_keys[gap_key_offsets[m]..gap_key_offsets[m + 1]]`
+    gap_key_offsets: Vec<usize>,
+    gap_keys: Vec<usize>
+}
+
+// Stores the index of the model that `key` is routed to on each layer
+// below the root in `path`, and returns the index on the last of them.
+fn route(layers: &[Vec<Box<dyn Model>>], branch_factor: u64,
+         key: &ModelInput, path: &mut Vec<usize>) -> usize {
+    path.clear();
+    let mut model_idx = 0;
+    for layer in layers {
+        let next_layer_size = layer.len() as u64 * branch_factor;
+        let pred = layer[model_idx].predict_to_int(key);
+        model_idx = u64::min(next_layer_size - 1, pred) as usize;
+        path.push(model_idx);
+    }
+    return model_idx;
+}
+
+// Splits the data into runs of keys with the same path through `layers`.
+// The chunks of the data are routed in parallel, and a run that crosses
+// into the next chunk is joined back together, so the runs do not depend
+// on the number of threads.
+fn routed_runs<T: TrainingKey>(data: &RMITrainingData<T>,
+                               layers: &[Vec<Box<dyn Model>>],
+                               branch_factor: u64) -> Vec<Run> {
+    let chunks = data.chunk_bounds(rayon::current_num_threads() * SEGMENTS_PER_THREAD);
+    let chunk_runs: Vec<(bool, Vec<Run>)> = chunks.par_iter()
+        .map(|&(start_idx, end_idx)| {
+            let mut path = Vec::new();
+            let mut last_path = Vec::new();
+            if start_idx > 0 {
+                route(layers, branch_factor,
+                      &data.get_key(start_idx - 1).to_model_input(), &mut last_path);
+            }
+
+            let mut continues_last_chunk = false;
+            let mut runs: Vec<Run> = Vec::new();
+            for (idx, (x, _y)) in (start_idx..).zip(data.iter_model_input_range(start_idx, end_idx)) {
+                let model_idx = route(layers, branch_factor, &x, &mut path);
+                match runs.last_mut() {
+                    Some(run) if path == last_path => run.end = idx + 1,
+                    _ => {
+                        continues_last_chunk |= runs.is_empty() && start_idx > 0
+                            && path == last_path;
+                        runs.push(Run { model_idx, start: idx, end: idx + 1 });
+                    }
+                };
+                std::mem::swap(&mut path, &mut last_path);
+            }
+            (continues_last_chunk, runs)
+        }).collect();
+
+    let mut runs: Vec<Run> = Vec::new();
+    for (continues_last_chunk, chunk) in chunk_runs {
+        let mut chunk = chunk.into_iter();
+        if continues_last_chunk {
+            let first = chunk.next().unwrap();
+            runs.last_mut().unwrap().end = first.end;
+        }
+        runs.extend(chunk);
+    }
+    return runs;
+}
+
+// Groups the values of the (model index, value) pairs by model, keeping
+// the order of the pairs. The values of model `m` are
+// `values[offsets[m]..offsets[m + 1]]`.
+fn group_by_model(pairs: &[(usize, usize)], num_models: usize) -> (Vec<usize>, Vec<usize>) {
+    let mut offsets = vec![0; num_models + 1];
+    for &(model_idx, _) in pairs.iter() {
+        offsets[model_idx + 1] += 1;
+    }
+    for model_idx in 0..num_models {
+        offsets[model_idx + 1] += offsets[model_idx];
+    }
+
+    let mut next = offsets.clone();
+    let mut values = vec![0; pairs.len()];
+    for &(model_idx, value) in pairs.iter() {
+        values[next[model_idx]] = value;
+        next[model_idx] += 1;
+    }
+    return (offsets, values);
+}
+
+// The gaps between the runs, along with the gaps before the first key and
+// after the last one.
+fn gaps_between_runs<T: TrainingKey>(data: &RMITrainingData<T>, runs: &[Run]) -> Vec<Gap<T>> {
+    let mut gaps = Vec::with_capacity(runs.len() + 1);
+    let first_key = data.get_key(0);
+    if first_key.as_float() > T::zero_value().as_float() {
+        gaps.push(Gap { prev_key: T::zero_value(), next: (0, first_key) });
+    }
 
-pub fn train_multi_layer(data: &mut RMITrainingData,
-                         model_list: &[String],
-                         last_model: String,
-                         branch_factor: u64) -> TrainedRMI {
-    
-    let mut rmi: Vec<Vec<Box<dyn Model>>> = Vec::new();
-    let mut data_partitions = vec![data.clone().into_data()];
-    let num_rows = data_partitions[0].len();
-
-    let mut current_model_count = 1;
-    for (_layer_idx, model_type) in model_list.iter().enumerate() {
-        info!("Training {} model layer", model_type);
-        // data_partition contains all of our data partitioned into groups
-        // based on the previous RMI layer's output
-        let next_layer_size = current_model_count * branch_factor;
-        let mut next_layer_data =
-            vec![Vec::with_capacity(num_rows / next_layer_size as usize); next_layer_size as usize];
-        let mut models: Vec<Box<dyn Model>> = Vec::with_capacity(next_layer_size as usize);
-
-        for model_data in data_partitions.into_iter() {
-            let mut md_container = RMITrainingData::new(&model_data);
-
-            // not at the last layer -- rescale
-            md_container.set_scale(next_layer_size as f64 / num_rows as f64);
-            let model = train_model(model_type.as_str(), &md_container);
-
-            // rescale back for next layer
-            md_container.set_scale(1.0);
-
-            for (x, y) in md_container.iter_int_int() {
-                let model_pred = model.predict_to_int(x.into());
-                assert!(model.needs_bounds_check() || model_pred < next_layer_size);
-                let target = u64::min(next_layer_size - 1, model_pred) as usize;
-                next_layer_data[target].push((x, y));
+    for pair in runs.windows(2) {
+        let idx = pair[1].start;
+        gaps.push(Gap { prev_key: data.get_key(idx - 1), next: (idx, data.get_key(idx)) });
+    }
+
+    let last_key = data.get_key(data.len() - 1);
+    if last_key != T::max_value() {
+        gaps.push(Gap { prev_key: last_key, next: (data.len(), T::max_value()) });
+    }
+    return gaps;
+}
+
+// The (inclusive) ranges of models on the layer below `layers` that the
+// queries from `lo` to `hi` can be routed to. Since each model is monotonic
+// over the queries that reach it, the queries routed to a model reach the
+// models of the next layer between its predictions for `lo` and `hi`.
+fn reachable_models(layers: &[Vec<Box<dyn Model>>], branch_factor: u64,
+                    lo: &ModelInput, hi: &ModelInput) -> Vec<(usize, usize)> {
+    let mut ranges = vec![(0, 0)];
+    for layer in layers {
+        let next_layer_size = layer.len() as u64 * branch_factor;
+        let mut next_ranges: Vec<(usize, usize)> = Vec::new();
+        for &(first, last) in ranges.iter() {
+            for model in layer[first..=last].iter() {
+                let from_lo = u64::min(next_layer_size - 1, model.predict_to_int(lo)) as usize;
+                let from_hi = u64::min(next_layer_size - 1, model.predict_to_int(hi)) as usize;
+                next_ranges.push((usize::min(from_lo, from_hi), usize::max(from_lo, from_hi)));
             }
+        }
 
-            models.push(model);
+        next_ranges.sort();
+        ranges.clear();
+        for (first, last) in next_ranges {
+            match ranges.last_mut() {
+                Some(range) if first <= range.1 + 1 => range.1 = usize::max(range.1, last),
+                _ => ranges.push((first, last))
+            };
         }
+    }
+    return ranges;
+}
+
+impl <T: TrainingKey> Routing<T> {
+    // routes the data through `layers` to the `num_models` models below them
+    fn new(data: &RMITrainingData<T>, layers: &[Vec<Box<dyn Model>>],
+           branch_factor: u64, num_models: usize) -> Routing<T> {
+        let runs = routed_runs(data, layers, branch_factor);
+        let run_pairs: Vec<(usize, usize)> = runs.iter().enumerate()
+            .map(|(run_idx, run)| (run.model_idx, run_idx))
+            .collect();
+        let (run_offsets, run_order) = group_by_model(&run_pairs, num_models);
 
-        data_partitions = next_layer_data
-            .into_iter()
-            .map(ModelData::IntKeyToIntPos)
+        let gaps = gaps_between_runs(data, &runs);
+        let gap_models: Vec<Vec<(usize, usize)>> = gaps.par_iter()
+            .map(|gap| reachable_models(layers, branch_factor,
+                                        &gap.prev_key.plus_epsilon().to_model_input(),
+                                        &gap.next.1.minus_epsilon().to_model_input()))
             .collect();
 
-        current_model_count *= branch_factor;
-        rmi.push(models);
-    }
-
-    info!("Training last level {} model", last_model);
-    let mut last_layer = Vec::new();
-    let mut last_layer_max_l1s: Vec<u64> = Vec::new();
-    let mut model_avg_error: f64 = 0.0;
-    let mut model_avg_l2_error: f64 = 0.0;
-    let mut model_avg_log2_error: f64 = 0.0;
-    let mut model_max_log2_error: f64 = 0.0;
-    let mut model_max_error = 0;
-    let mut model_max_error_idx = 0;
-
-    let mut n = 1;
-    for (midx, model_data) in data_partitions.into_iter().enumerate() {
-        let md_container = RMITrainingData::new(&model_data);
-        let last_model = train_model(last_model.as_str(), &md_container);
-        let mut max_error = 0;
-        
-        for (idx, (x, y)) in md_container.iter_int_int().enumerate() {
-            let pred = last_model.predict_to_int(x.into());
-            let err = u64::max(y, pred) - u64::min(y, pred);
-
-            if let Some(bound) = last_model.error_bound() {
-                if err > bound {
-                    warn!("Precision issue: model reports max bound of {}, \
-                           but an error of {} was observed on input {} at index {}. Prediction: {} Actual: {}",
-                          bound, err, x, idx, pred, y);
+        let mut key_pairs: Vec<(usize, usize)> = Vec::new();
+        for (gap, ranges) in gaps.iter().zip(gap_models.iter()) {
+            let (next_idx, _) = gap.next;
+            for model_idx in ranges.iter().flat_map(|&(first, last)| first..=last) {
+                if next_idx > 0 {
+                    key_pairs.push((model_idx, next_idx - 1));
+                }
+                if next_idx < data.len() {
+                    key_pairs.push((model_idx, next_idx));
                 }
             }
+        }
+        key_pairs.par_sort_unstable();
+        key_pairs.dedup();
+        let (gap_key_offsets, gap_keys) = group_by_model(&key_pairs, num_models);
+
+        return Routing { runs, run_offsets, run_order, gaps, gap_models,
+                         gap_key_offsets, gap_keys };
+    }
+
+    fn runs_of(&self, model_idx: usize) -> impl Iterator<Item = &Run> + '_ {
+        return self.run_order[self.run_offsets[model_idx]..self.run_offsets[model_idx + 1]]
+            .iter().map(move |&run_idx| &self.runs[run_idx]);
+    }
+
+    fn gap_keys_of(&self, model_idx: usize) -> &[usize] {
+        return &self.gap_keys[self.gap_key_offsets[model_idx]..self.gap_key_offsets[model_idx + 1]];
+    }
+
+    fn is_empty(&self, model_idx: usize) -> bool {
+        return self.run_offsets[model_idx] == self.run_offsets[model_idx + 1];
+    }
+
+    // Stores the keys of model `model_idx` in `model_data`: the keys routed
+    // to it, and the keys on either side of the gaps that can reach it, in
+    // order. Returns the range of `model_data` holding each run, and whether
+    // that run ends the data.
+    fn gather_keys(&self, data: &RMITrainingData<T>, model_idx: usize,
+                   model_data: &mut Vec<(T, usize)>) -> Vec<(usize, usize, bool)> {
+        // a key next to a gap may be a duplicate, whose position is the
+        // first of its run
+        let gap_key = |idx: usize| (data.get_key(idx), data.get(data.run_start(idx)).1);
+
+        model_data.clear();
+        let mut run_bounds = Vec::new();
+        let mut gap_keys = self.gap_keys_of(model_idx).iter().copied().peekable();
+        for run in self.runs_of(model_idx) {
+            while let Some(idx) = gap_keys.next_if(|&idx| idx < run.start) {
+                model_data.push(gap_key(idx));
+            }
+            while gap_keys.next_if(|&idx| idx < run.end).is_some() {}
 
-            max_error = u64::max(max_error, err);
-            model_avg_error += ((max_error as f64) - model_avg_error) / (n as f64);
-            model_avg_l2_error += ((max_error as f64).powf(2.0) - model_avg_l2_error) / (n as f64);
-            let log2_error = ((2 * max_error + 2) as f64).log2();
-            model_avg_log2_error += (log2_error - model_avg_log2_error) / (n as f64);
-            model_max_log2_error = f64::max(model_max_log2_error, log2_error);
-            n += 1;
+            let run_start = model_data.len();
+            model_data.extend(data.iter_range(run.start, run.end));
+            run_bounds.push((run_start, model_data.len(), run.end == data.len()));
         }
-        if max_error > model_max_error {
-            model_max_error = max_error;
-            model_max_error_idx = midx;
+        model_data.extend(gap_keys.map(gap_key));
+        return run_bounds;
+    }
+}
+
+// Trains the `num_models` models of the layer below `layers`, scaling the
+// positions of the keys by `scale`. Returns the models along with the
+// statistics of each of them over the keys routed to it if `leaf_stats` is
+// set. A model that no key is routed to predicts the lower bound of the
+// first gap that can reach it.
+fn train_layer<T: TrainingKey>(data: &RMITrainingData<T>,
+                               routing: &Routing<T>,
+                               model_type: &str,
+                               num_models: usize,
+                               scale: f64,
+                               max_target: u64,
+                               leaf_stats: bool)
+                               -> (Vec<Box<dyn Model>>, Vec<LeafStats<T>>) {
+    let (mut models, stats): (Vec<Box<dyn Model>>, Vec<LeafStats<T>>)
+        = (0..num_models).into_par_iter()
+        .map_init(Vec::new, |model_data, model_idx| {
+            let run_bounds = routing.gather_keys(data, model_idx, model_data);
+            let mut container = RMITrainingData::from_slice(model_data);
+            container.set_scale(scale);
+            let model = train_model(model_type, &container);
+
+            let stats = if leaf_stats {
+                run_bounds.iter()
+                    .map(|&(start, end, ends_data)| {
+                        LeafStats::of_leaf(&model, &model_data[start..end], data.len(), ends_data)
+                    })
+                    .reduce(|a, b| LeafStats {
+                        first: a.first,
+                        last: b.last,
+                        longest_run: u64::max(a.longest_run, b.longest_run),
+                        num_keys: a.num_keys + b.num_keys,
+                        max_error: max_errors(a.max_error, b.max_error)
+                    })
+                    .unwrap_or_else(LeafStats::empty)
+            } else {
+                LeafStats::empty()
+            };
+            (model, stats)
+        }).unzip();
+
+    trace!("Fixing empty models...");
+    let mut could_not_replace = false;
+    let mut replaced = vec![false; num_models];
+    for (gap, ranges) in routing.gaps.iter().zip(routing.gap_models.iter()) {
+        let target = u64::min(max_target, (gap.next.0 as f64 * scale) as u64);
+        for model_idx in ranges.iter().flat_map(|&(first, last)| first..=last) {
+            if routing.is_empty(model_idx) && !replaced[model_idx] {
+                replaced[model_idx] = true;
+                if !models[model_idx].set_to_constant_model(target) {
+                    could_not_replace = true;
+                }
+            }
         }
+    }
+
+    if could_not_replace {
+        warn!("Some empty {} models could not be replaced with constants, \
+               negative lookup performance may be poor.", model_type);
+    }
+    return (models, stats);
+}
+
+// Computes the (number of keys, (left, right) error) pair of each leaf, including
+// the corrections needed for lower bound searches. A query in a gap has the
+// lower bound of the first key after the gap, so every leaf the gap can
+// reach must include that key in its error bound.
+fn correct_leaf_errors<T: TrainingKey>(num_rows: usize,
+                                       routing: &Routing<T>,
+                                       leaf_models: &[Box<dyn Model>],
+                                       leaf_stats: &[LeafStats<T>]) -> Vec<(u64, (u64, u64))> {
+    let gap_errors: Vec<Vec<(usize, (u64, u64))>> = routing.gaps.par_iter()
+        .zip(routing.gap_models.par_iter())
+        .map(|(gap, ranges)| {
+            ranges.iter()
+                .flat_map(|&(first, last)| first..=last)
+                .map(|leaf_idx| {
+                    (leaf_idx, lower_bound_error(&leaf_models[leaf_idx], (0, 0), gap.next,
+                                                 gap.prev_key, gap.next.0, 0, num_rows))
+                }).collect()
+        }).collect();
+
+    let mut lb_errors = vec![(0, 0); leaf_models.len()];
+    for (leaf_idx, err) in gap_errors.into_iter().flatten() {
+        lb_errors[leaf_idx] = max_errors(lb_errors[leaf_idx], err);
+    }
+
+    return leaf_stats.iter().zip(lb_errors.into_iter())
+        .map(|(stats, lb_error)| {
+            let (left, right) = max_errors(stats.max_error, lb_error);
+            (stats.num_keys, (left + stats.longest_run, right + stats.longest_run))
+        }).collect();
+}
+
+pub fn train_multi_layer<T: TrainingKey>(data: &RMITrainingData<T>,
+                                        model_list: &[String],
+                                        last_model: &str,
+                                        branch_factor: u64) -> TrainedRMI {
+    let num_rows = data.len();
+
+    trace!("Training top-level {} model layer", model_list[0]);
+    let mut md_container = data.soft_copy();
+    md_container.set_scale(branch_factor as f64 / num_rows as f64);
+    let mut layers: Vec<Vec<Box<dyn Model>>> = vec![vec![train_model(&model_list[0], &md_container)]];
+
+    let mut num_models = branch_factor;
+    for model_type in model_list[1..].iter() {
+        let next_layer_size = num_models.checked_mul(branch_factor)
+            .expect("The RMI has too many models on its last layer");
+        trace!("Training {} model layer (num models = {})", model_type, num_models);
+
+        let routing = Routing::new(data, &layers, branch_factor, num_models as usize);
+        let (models, _) = train_layer(data, &routing, model_type, num_models as usize,
+                                      next_layer_size as f64 / num_rows as f64,
+                                      next_layer_size - 1, false);
+        layers.push(models);
+        num_models = next_layer_size;
+    }
+
+    trace!("Training last-level {} model layer (num models = {})", last_model, num_models);
+    let routing = Routing::new(data, &layers, branch_factor, num_models as usize);
+    let (leaf_models, leaf_stats) = train_layer(data, &routing, last_model, num_models as usize,
+                                                1.0, num_rows as u64, true);
+    let last_layer_max_l1s = correct_leaf_errors(num_rows, &routing, &leaf_models, &leaf_stats);
+    layers.push(leaf_models);
 
-        last_layer.push(last_model);
-        last_layer_max_l1s.push(max_error);
-    }
-    rmi.push(last_layer);
-
-    return TrainedRMI {
-        model_avg_error,
-        model_avg_l2_error,
-        model_avg_log2_error,
-        model_max_error,
-        model_max_error_idx,
-        model_max_log2_error,
-        last_layer_max_l1s,
-        rmi,
-        models: format!("{},{}", model_list.join(","), last_model),
-        branching_factor: branch_factor
-    };
+    return assemble_rmi(num_rows, last_layer_max_l1s, Vec::new(), layers,
+                        format!("{},{}", model_list.join(","), last_model),
+                        branch_factor);
 }
@@ -0,0 +1,359 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+// Training a two-layer RMI in shards. A plan splits the leaves into ranges
+// of about the same number of keys, each of them a shard, under a root
+// trained on a sample of the keys. Each shard is then trained on its own,
+// possibly in another process or on another machine, and reads only the
+// keys routed to its leaves (and the keys on either side of them). Finally
+// the trained shards are merged, with the root of the plan, into one RMI.
+// The leaves of each shard are the same as those of an RMI trained all at
+// once with the same root, so the merged RMI does not depend on the number
+// of shards.
+
+use crate::models::*;
+use crate::train::{validate, train_model, TrainedRMI};
+use crate::train::two_layer::{train_leaf_range, assemble_rmi, sample_keys, train_sampled_root};
+use byteorder::{LittleEndian, ReadBytesExt, WriteBytesExt};
+use log::*;
+use std::collections::HashSet;
+use std::fs::File;
+use std::io::{BufReader, BufWriter, Read, Write};
+use std::sync::Arc;
+
+/// How a two-layer RMI is split into shards (see `plan_shards`).
+pub struct ShardPlan<T> {
+    pub models: String,
+    pub branching_factor: u64,
+    pub num_rows: usize,
+    /// the (first leaf, index of the first key) of each shard
+    pub shards: Vec<(usize, usize)>,
+    // the (key, offset) pairs the root is trained on
+    sample: Vec<(T, usize)>
+}
+
+/// The leaves of one shard of an RMI (see `train_shard`).
+pub struct TrainedShard {
+    pub first_leaf: usize,
+    /// the number of keys, the (left, right) error, and the parameters
+    /// of each leaf
+    pub leaves: Vec<(u64, (u64, u64), Vec<ModelParam>)>
+}
+
+// A leaf trained by a shard, of which only the parameters are known. The
+// code, types and properties of the leaf come from a model of the same type
+// trained on no data.
+struct StoredModel {
+    prototype: Arc<Box<dyn Model>>,
+    params: Vec<ModelParam>
+}
+
+impl Model for StoredModel {
+    fn predict_to_int(&self, _inp: &ModelInput) -> u64 {
+        panic!("The leaves of an RMI merged from shards cannot make predictions");
+    }
+    fn predict_to_float(&self, _inp: &ModelInput) -> f64 {
+        panic!("The leaves of an RMI merged from shards cannot make predictions");
+    }
+
+    fn input_type(&self) -> ModelDataType { return self.prototype.input_type(); }
+    fn output_type(&self) -> ModelDataType { return self.prototype.output_type(); }
+
+    fn params(&self) -> Vec<ModelParam> { return self.params.clone(); }
+
+    fn code(&self) -> String { return self.prototype.code(); }
+    fn function_name(&self) -> String { return self.prototype.function_name(); }
+
+    fn standard_functions(&self) -> HashSet<StdFunctions> {
+        return self.prototype.standard_functions();
+    }
+    fn needs_bounds_check(&self) -> bool { return self.prototype.needs_bounds_check(); }
+    fn restriction(&self) -> ModelRestriction { return self.prototype.restriction(); }
+    fn error_bound(&self) -> Option<u64> { return self.prototype.error_bound(); }
+}
+
+/// Plans a two-layer RMI with the `model_spec` models and `branch_factor`
+/// leaves over `data`, split into (at most) `num_shards` shards. The root is
+/// trained on about `sample_size` evenly spaced keys, so it is the same for
+/// every shard and can be trained again from the plan. Shards end where one
+/// leaf ends and the next begins, so if a leaf has more keys than a shard
+/// would there are fewer shards.
+pub fn plan_shards<T: TrainingKey>(data: &RMITrainingData<T>,
+                                  model_spec: &str, branch_factor: u64,
+                                  num_shards: usize, sample_size: usize) -> ShardPlan<T> {
+    let models: Vec<String> = model_spec.split(',').map(String::from).collect();
+    assert_eq!(models.len(), 2, "Only two-layer RMIs can be trained in shards");
+    validate(&models);
+    assert!(!models[1].starts_with("radix"),
+            "The leaves of an RMI trained in shards cannot be radix tables");
+    assert!(num_shards > 0 && sample_size > 0,
+            "An RMI needs at least one shard and one sampled key");
+    let num_rows = data.len();
+    assert!(num_rows > 0, "Cannot train an RMI without data");
+
+    let stride = usize::max(1, (num_rows + sample_size - 1) / sample_size);
+    let sample = sample_keys(data, stride);
+    let top_model = train_sampled_root(&sample, &models[0], branch_factor, num_rows);
+
+    // the root is only trained on the sample, so it may not route the last
+    // key to a leaf that exists
+    let last_key = data.get_key(num_rows - 1).to_model_input();
+    assert!(top_model.needs_bounds_check()
+            || top_model.predict_to_int(&last_key) < branch_factor,
+            "The {} root trained on {} keys routes keys past the last leaf",
+            models[0], sample.len());
+
+    let leaf_of = |idx: usize| -> usize {
+        let model_idx = top_model.predict_to_int(&data.get_key(idx).to_model_input());
+        return u64::min(branch_factor - 1, model_idx) as usize;
+    };
+
+    // each shard starts with the first key of the leaf of every
+    // (1 / `num_shards`)th key, so the shards have about as many keys
+    let mut shards: Vec<(usize, usize)> = vec![(0, 0)];
+    for shard_idx in 1..num_shards {
+        let boundary_model = leaf_of(shard_idx * num_rows / num_shards);
+        let split_idx = data.lower_bound_by(|x| {
+            let model_idx = top_model.predict_to_int(&x.0.to_model_input());
+            return u64::min(branch_factor - 1, model_idx).cmp(&(boundary_model as u64));
+        });
+        if split_idx > shards.last().unwrap().1 {
+            shards.push((boundary_model, split_idx));
+        }
+    }
+    info!("Split the {} leaves into {} shards under a root trained on {} keys",
+          branch_factor, shards.len(), sample.len());
+
+    return ShardPlan {
+        models: String::from(model_spec),
+        branching_factor: branch_factor,
+        num_rows, shards, sample
+    };
+}
+
+impl <T: TrainingKey> ShardPlan<T> {
+    /// the root of the RMI, trained again from the sample of the plan
+    pub fn root(&self) -> Box<dyn Model> {
+        let root_model = self.models.split(',').next().unwrap();
+        return train_sampled_root(&self.sample, root_model,
+                                  self.branching_factor, self.num_rows);
+    }
+
+    /// the first leaf, the leaf after the last, the first key, and the key
+    /// after the last of the shard `shard_idx`
+    pub fn shard_range(&self, shard_idx: usize) -> (usize, usize, usize, usize) {
+        assert!(shard_idx < self.shards.len(),
+                "There is no shard {}, the plan has {} shards", shard_idx, self.shards.len());
+        let (first_leaf, start_idx) = self.shards[shard_idx];
+        let (end_leaf, end_idx) = if shard_idx + 1 < self.shards.len() {
+            self.shards[shard_idx + 1]
+        } else {
+            (self.branching_factor as usize, self.num_rows)
+        };
+        return (first_leaf, end_leaf, start_idx, end_idx);
+    }
+
+    /// Writes the plan to `path`: the model spec, the branching factor, the
+    /// number of keys, the shards, and the sample of the root, all little
+    /// endian.
+    pub fn write_to(&self, path: &str) -> Result<(), std::io::Error> {
+        let mut target = BufWriter::new(File::create(path)?);
+        target.write_u64::<LittleEndian>(self.models.len() as u64)?;
+        target.write_all(self.models.as_bytes())?;
+        target.write_u64::<LittleEndian>(self.branching_factor)?;
+        target.write_u64::<LittleEndian>(self.num_rows as u64)?;
+
+        target.write_u64::<LittleEndian>(self.shards.len() as u64)?;
+        for &(first_leaf, start_idx) in self.shards.iter() {
+            target.write_u64::<LittleEndian>(first_leaf as u64)?;
+            target.write_u64::<LittleEndian>(start_idx as u64)?;
+        }
+
+        target.write_u64::<LittleEndian>(self.sample.len() as u64)?;
+        for &(key, offset) in self.sample.iter() {
+            target.write_u128::<LittleEndian>(key.to_key_bits())?;
+            target.write_u64::<LittleEndian>(offset as u64)?;
+        }
+        return target.flush();
+    }
+
+    /// Reads a plan written by `write_to`.
+    pub fn read_from(path: &str) -> Result<ShardPlan<T>, std::io::Error> {
+        let mut source = BufReader::new(File::open(path)?);
+        let mut models = vec![0u8; source.read_u64::<LittleEndian>()? as usize];
+        source.read_exact(&mut models)?;
+        let models = String::from_utf8(models)
+            .map_err(|e| std::io::Error::new(std::io::ErrorKind::InvalidData, e))?;
+        let branching_factor = source.read_u64::<LittleEndian>()?;
+        let num_rows = source.read_u64::<LittleEndian>()? as usize;
+
+        let num_shards = source.read_u64::<LittleEndian>()? as usize;
+        let mut shards = Vec::with_capacity(num_shards);
+        for _ in 0..num_shards {
+            let first_leaf = source.read_u64::<LittleEndian>()? as usize;
+            let start_idx = source.read_u64::<LittleEndian>()? as usize;
+            shards.push((first_leaf, start_idx));
+        }
+
+        let sample_size = source.read_u64::<LittleEndian>()? as usize;
+        let mut sample = Vec::with_capacity(sample_size);
+        for _ in 0..sample_size {
+            let key = T::from_key_bits(source.read_u128::<LittleEndian>()?);
+            let offset = source.read_u64::<LittleEndian>()? as usize;
+            sample.push((key, offset));
+        }
+
+        return Ok(ShardPlan { models, branching_factor, num_rows, shards, sample });
+    }
+}
+
+/// Trains the leaves of the shard `shard_idx` of the `plan` over `data`,
+/// which must be the data the plan was made for. Only the keys of the shard
+/// and the keys on either side of it are read.
+pub fn train_shard<T: TrainingKey>(data: &RMITrainingData<T>,
+                                  plan: &ShardPlan<T>,
+                                  shard_idx: usize) -> TrainedShard {
+    assert_eq!(data.len(), plan.num_rows,
+               "The shard plan is for {} keys, but the data has {}",
+               plan.num_rows, data.len());
+    let leaf_model = plan.models.split(',').nth(1).unwrap();
+    let (first_leaf, end_leaf, start_idx, end_idx) = plan.shard_range(shard_idx);
+    info!("Training leaves {} to {} for keys {} to {}",
+          first_leaf, end_leaf, start_idx, end_idx);
+
+    let top_model = plan.root();
+    let (leaf_models, leaf_errors) = train_leaf_range(data, &top_model, leaf_model,
+                                                      plan.branching_factor,
+                                                      first_leaf, end_leaf,
+                                                      start_idx, end_idx);
+    let leaves = leaf_models.iter().zip(leaf_errors.into_iter())
+        .map(|(model, (num_keys, err))| (num_keys, err, model.params()))
+        .collect();
+    return TrainedShard { first_leaf, leaves };
+}
+
+// Each parameter is written as a tag for its type, the number of items for
+// arrays, and its value(s). Padding is written as its number of bytes.
+fn write_param<W: Write>(target: &mut W, param: &ModelParam) -> Result<(), std::io::Error> {
+    let (tag, len) = match param {
+        ModelParam::Int(_) => (0, None),
+        ModelParam::Float(_) => (1, None),
+        ModelParam::Float32(_) => (2, None),
+        ModelParam::Short(_) => (3, None),
+        ModelParam::Int32(_) => (4, None),
+        ModelParam::Padding(n) => (5, Some(*n)),
+        ModelParam::ShortArray(a) => (6, Some(a.len())),
+        ModelParam::IntArray(a) => (7, Some(a.len())),
+        ModelParam::Int32Array(a) => (8, Some(a.len())),
+        ModelParam::FloatArray(a) => (9, Some(a.len())),
+    };
+    target.write_u8(tag)?;
+    if let Some(len) = len {
+        target.write_u64::<LittleEndian>(len as u64)?;
+    }
+    return match param {
+        ModelParam::Padding(_) => Ok(()),
+        _ => param.write_to(target)
+    };
+}
+
+fn read_param<R: Read>(source: &mut R) -> Result<ModelParam, std::io::Error> {
+    let tag = source.read_u8()?;
+    if tag <= 4 {
+        return Ok(match tag {
+            0 => ModelParam::Int(source.read_u64::<LittleEndian>()?),
+            1 => ModelParam::Float(source.read_f64::<LittleEndian>()?),
+            2 => ModelParam::Float32(source.read_f32::<LittleEndian>()?),
+            3 => ModelParam::Short(source.read_u16::<LittleEndian>()?),
+            _ => ModelParam::Int32(source.read_u32::<LittleEndian>()?),
+        });
+    }
+
+    let len = source.read_u64::<LittleEndian>()? as usize;
+    return Ok(match tag {
+        5 => ModelParam::Padding(len),
+        6 => ModelParam::ShortArray((0..len).map(|_| source.read_u16::<LittleEndian>())
+                                    .collect::<Result<_, _>>()?),
+        7 => ModelParam::IntArray((0..len).map(|_| source.read_u64::<LittleEndian>())
+                                  .collect::<Result<_, _>>()?),
+        8 => ModelParam::Int32Array((0..len).map(|_| source.read_u32::<LittleEndian>())
+                                    .collect::<Result<_, _>>()?),
+        9 => ModelParam::FloatArray((0..len).map(|_| source.read_f64::<LittleEndian>())
+                                    .collect::<Result<_, _>>()?),
+        _ => return Err(std::io::Error::new(std::io::ErrorKind::InvalidData,
+                                            format!("Unknown parameter type {}", tag)))
+    });
+}
+
+impl TrainedShard {
+    /// Writes the shard to `path`: its first leaf and number of leaves, and
+    /// the number of keys, errors, and parameters of each leaf, all little
+    /// endian.
+    pub fn write_to(&self, path: &str) -> Result<(), std::io::Error> {
+        let mut target = BufWriter::new(File::create(path)?);
+        target.write_u64::<LittleEndian>(self.first_leaf as u64)?;
+        target.write_u64::<LittleEndian>(self.leaves.len() as u64)?;
+        for (num_keys, (left, right), params) in self.leaves.iter() {
+            target.write_u64::<LittleEndian>(*num_keys)?;
+            target.write_u64::<LittleEndian>(*left)?;
+            target.write_u64::<LittleEndian>(*right)?;
+            target.write_u64::<LittleEndian>(params.len() as u64)?;
+            for param in params.iter() {
+                write_param(&mut target, param)?;
+            }
+        }
+        return target.flush();
+    }
+
+    /// Reads a shard written by `write_to`.
+    pub fn read_from(path: &str) -> Result<TrainedShard, std::io::Error> {
+        let mut source = BufReader::new(File::open(path)?);
+        let first_leaf = source.read_u64::<LittleEndian>()? as usize;
+        let num_leaves = source.read_u64::<LittleEndian>()? as usize;
+        let mut leaves = Vec::with_capacity(num_leaves);
+        for _ in 0..num_leaves {
+            let num_keys = source.read_u64::<LittleEndian>()?;
+            let left = source.read_u64::<LittleEndian>()?;
+            let right = source.read_u64::<LittleEndian>()?;
+            let num_params = source.read_u64::<LittleEndian>()? as usize;
+            let params = (0..num_params).map(|_| read_param(&mut source))
+                .collect::<Result<Vec<ModelParam>, _>>()?;
+            leaves.push((num_keys, (left, right), params));
+        }
+        return Ok(TrainedShard { first_leaf, leaves });
+    }
+}
+
+/// Merges the trained `shards` of the `plan`, one for each shard of the plan
+/// in order, into an RMI. The leaves of the merged RMI only hold their
+/// parameters, so code can be generated for it, but it cannot be quantized
+/// or bounded.
+pub fn merge_shards<T: TrainingKey>(plan: &ShardPlan<T>,
+                                   shards: Vec<TrainedShard>) -> TrainedRMI {
+    assert_eq!(shards.len(), plan.shards.len(),
+               "The plan has {} shards, but {} were given", plan.shards.len(), shards.len());
+    let leaf_model = plan.models.split(',').nth(1).unwrap();
+    let prototype = Arc::new(train_model(leaf_model, &RMITrainingData::<T>::empty()));
+
+    let mut leaf_models: Vec<Box<dyn Model>> = Vec::with_capacity(plan.branching_factor as usize);
+    let mut last_layer_max_l1s = Vec::with_capacity(plan.branching_factor as usize);
+    for (shard_idx, shard) in shards.into_iter().enumerate() {
+        let (first_leaf, end_leaf, _, _) = plan.shard_range(shard_idx);
+        assert!(shard.first_leaf == first_leaf && shard.leaves.len() == end_leaf - first_leaf,
+                "Shard {} has leaves {} to {}, but the plan has leaves {} to {}",
+                shard_idx, shard.first_leaf, shard.first_leaf + shard.leaves.len(),
+                first_leaf, end_leaf);
+        for (num_keys, err, params) in shard.leaves {
+            leaf_models.push(Box::new(StoredModel { prototype: prototype.clone(), params }));
+            last_layer_max_l1s.push((num_keys, err));
+        }
+    }
+
+    return assemble_rmi(plan.num_rows, last_layer_max_l1s, Vec::new(),
+                        vec![vec![plan.root()], leaf_models],
+                        plan.models.clone(), plan.branching_factor);
+}
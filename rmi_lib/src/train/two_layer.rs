@@ -7,22 +7,97 @@
  
 use crate::models::TrainingKey;
 use crate::models::*;
-use crate::train::{validate, train_model, TrainedRMI};
+use crate::train::{validate, train_model, TrainedRMI, EstimatedRMI};
 use crate::train::lower_bound_correction::LowerBoundCorrection;
+use crate::workload::QueryWorkload;
 use log::*;
+use rayon::prelude::*;
 
-fn error_between(v1: u64, v2: u64, max_pred: u64) -> u64 {
-    let pred1 = u64::min(v1, max_pred);
-    let pred2 = u64::min(v2, max_pred);
-    return u64::max(pred1, pred2) - u64::min(pred1, pred2);
+// the number of pieces the leaves (or the data) are split into per thread,
+// so that threads that finish early can pick up more work
+pub const SEGMENTS_PER_THREAD: usize = 4;
+
+// the fewest keys whose leaves are sampled when the error of an RMI is
+// estimated
+const MIN_LEAF_SAMPLES: u64 = 128;
+
+// the (left, right) error of the prediction `pred` for the position `y`:
+// how far `y` lies before or after `pred`, with both capped at `max_pred`.
+fn errors_between(pred: u64, y: u64, max_pred: u64) -> (u64, u64) {
+    let pred = u64::min(pred, max_pred);
+    let y = u64::min(y, max_pred);
+    return if y < pred { (pred - y, 0) } else { (0, y - pred) };
+}
+
+// the larger of two (left, right) errors on each side
+pub fn max_errors(a: (u64, u64), b: (u64, u64)) -> (u64, u64) {
+    return (u64::max(a.0, b.0), u64::max(a.1, b.1));
+}
+
+// the average log2 of the width of the search window of a leaf with the
+// (left, right) error `err`, over its `n` keys
+fn log2_window(n: u64, err: (u64, u64)) -> f64 {
+    return (n as f64) * ((err.0 + err.1 + 2) as f64).log2();
+}
+
+// What the pass that trains a leaf learns about the keys routed to it.
+pub struct LeafStats<T> {
+    // the first and last (offset, key) pairs of the leaf
+    pub first: Option<(usize, T)>,
+    pub last: Option<(usize, T)>,
+    pub longest_run: u64,
+    pub num_keys: u64,
+    // the largest (left, right) error of the leaf's keys
+    pub max_error: (u64, u64)
+}
+
+impl <T: TrainingKey> LeafStats<T> {
+    pub fn empty() -> LeafStats<T> {
+        return LeafStats { first: None, last: None, longest_run: 0, num_keys: 0, max_error: (0, 0) };
+    }
+
+    // the statistics of the trained leaf `model` over its `keys`. The run of
+    // keys at the very end of the data does not count towards the longest
+    // run (see LowerBoundCorrection).
+    pub fn of_leaf(model: &Box<dyn Model>, keys: &[(T, usize)],
+                   num_rows: usize, ends_data: bool) -> LeafStats<T> {
+        let mut longest_run = 0;
+        let mut current_run = 0;
+        let mut max_error = (0, 0);
+        for (idx, &(x, y)) in keys.iter().enumerate() {
+            if idx > 0 && keys[idx - 1].0 == x {
+                current_run += 1;
+            } else {
+                longest_run = u64::max(longest_run, current_run);
+                current_run = 1;
+            }
+
+            let pred = model.predict_to_int(&x.to_model_input());
+            max_error = max_errors(max_error, errors_between(pred, y as u64, num_rows as u64));
+        }
+
+        if !ends_data {
+            longest_run = u64::max(longest_run, current_run);
+        }
+
+        return LeafStats {
+            first: keys.first().map(|&(x, y)| (y, x)),
+            last: keys.last().map(|&(x, y)| (y, x)),
+            longest_run, max_error,
+            num_keys: keys.len() as u64
+        };
+    }
 }
 
+// Trains the leaves for the keys from `start_idx` to `end_idx`, and gathers
+// the statistics of each leaf in the same pass.
 fn build_models_from<T: TrainingKey>(data: &RMITrainingData<T>,
                                     top_model: &Box<dyn Model>,
                                     model_type: &str,
                                     start_idx: usize, end_idx: usize,
                                     first_model_idx: usize,
-                                    num_models: usize) -> Vec<Box<dyn Model>> {
+                                    num_models: usize)
+                                    -> (Vec<Box<dyn Model>>, Vec<LeafStats<T>>) {
 
     assert!(end_idx > start_idx,
             "start index was {} but end index was {}",
@@ -33,12 +108,23 @@ fn build_models_from<T: TrainingKey>(data: &RMITrainingData<T>,
     let dummy_md = RMITrainingData::<T>::empty();
     let mut leaf_models: Vec<Box<dyn Model>>
                              = Vec::with_capacity(num_models as usize);
+    let mut leaf_stats: Vec<LeafStats<T>> = Vec::with_capacity(num_models as usize);
+    // the keys of the current leaf. The buffer is reused for every leaf,
+    // and each leaf model is trained on a view of it.
     let mut second_layer_data = Vec::with_capacity((end_idx - start_idx) / num_models as usize);
     let mut last_target = first_model_idx;
+
+    // each leaf is also trained on the last key of the leaf before it (see
+    // below), even when that leaf is in the previous range.
+    if start_idx > 0 {
+        let prev_key = data.get_key(start_idx - 1);
+        let (_, prev_offset) = data.get(data.run_start(start_idx - 1));
+        second_layer_data.push((prev_key, prev_offset));
+    }
+    // the keys routed to the current leaf start here in the buffer
+    let mut leaf_start = second_layer_data.len();
            
-    let bounded_it = data.iter()
-        .skip(start_idx)
-        .take(end_idx - start_idx);
+    let bounded_it = data.iter_range(start_idx, end_idx);
         
     for (x, y) in bounded_it {
         let model_pred = top_model.predict_to_int(&x.to_model_input()) as usize;
@@ -56,26 +142,32 @@ fn build_models_from<T: TrainingKey>(data: &RMITrainingData<T>,
             // include the first point of the next leaf node to
             // support lower bound searches (not required, but reduces error)
             let last_item = second_layer_data.last().copied();
+            let leaf_end = second_layer_data.len();
             second_layer_data.push((x, y));
             
-            let container = RMITrainingData::new(Box::new(second_layer_data));
+            let container = RMITrainingData::from_slice(&second_layer_data);
             let leaf_model = train_model(model_type, &container);
+            leaf_stats.push(LeafStats::of_leaf(&leaf_model,
+                                               &second_layer_data[leaf_start..leaf_end],
+                                               data.len(), false));
             leaf_models.push(leaf_model);
             
             
             // leave empty models for any we skipped.
             for _skipped_idx in (last_target+1)..target {
                 leaf_models.push(train_model(model_type, &dummy_md));
+                leaf_stats.push(LeafStats::empty());
             }
             assert_eq!(leaf_models.len() + first_model_idx, target);
 
-            second_layer_data = Vec::new();
+            second_layer_data.clear();
 
             // include the last item of this leaf in the next leaf
             // to support lower bound searches.
             if let Some(v) = last_item {
                 second_layer_data.push(v);
             }
+            leaf_start = second_layer_data.len();
 
         }
         
@@ -83,33 +175,78 @@ fn build_models_from<T: TrainingKey>(data: &RMITrainingData<T>,
         last_target = target;
     }
 
-    // train the last remaining model
+    // train the last remaining model, including the first key of the next
+    // leaf if there is one.
+    let leaf_end = second_layer_data.len();
+    if end_idx < data.len() {
+        second_layer_data.push(data.get(end_idx));
+    }
     assert!(! second_layer_data.is_empty());
-    let container = RMITrainingData::new(Box::new(second_layer_data));
+    let container = RMITrainingData::from_slice(&second_layer_data);
     let leaf_model = train_model(model_type, &container);
+    leaf_stats.push(LeafStats::of_leaf(&leaf_model,
+                                       &second_layer_data[leaf_start..leaf_end],
+                                       data.len(), end_idx == data.len()));
     leaf_models.push(leaf_model);
     assert!(leaf_models.len() <= num_models);
     
     // add models at the end with nothing mapped into them
     for _skipped_idx in (last_target+1)..(first_model_idx + num_models) as usize {
         leaf_models.push(train_model(model_type, &dummy_md));
+        leaf_stats.push(LeafStats::empty());
     }
     assert_eq!(num_models as usize, leaf_models.len());
-    return leaf_models;
+    assert_eq!(num_models as usize, leaf_stats.len());
+    return (leaf_models, leaf_stats);
 }
 
-pub fn train_two_layer<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
-                                      layer1_model: &str, layer2_model: &str,
-                                      num_leaf_models: u64) -> TrainedRMI {
-    validate(&[String::from(layer1_model), String::from(layer2_model)]);
-
+// trains the root model of a two-layer RMI with `num_leaf_models` leaves
+fn train_root<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
+                              layer1_model: &str,
+                              num_leaf_models: u64) -> Box<dyn Model> {
     let num_rows = md_container.len();
 
     trace!("Training top-level {} model layer", layer1_model);
     md_container.set_scale(num_leaf_models as f64 / num_rows as f64);
     let top_model = train_model(layer1_model, &md_container);
+    check_monotonic(md_container, &top_model, layer1_model);
+
+    md_container.set_scale(1.0);
+    return top_model;
+}
+
+// Trains the root model of a two-layer RMI whose leaves are allocated partly
+// by query frequency, on the blended positions of the `workload` (see
+// `QueryWorkload::root_training_data`). Returns nothing if the root, which
+// is not bounds checked, would route keys past the last leaf.
+fn train_workload_root<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                       layer1_model: &str,
+                                       num_leaf_models: u64,
+                                       workload: &QueryWorkload) -> Option<Box<dyn Model>> {
+    let num_rows = md_container.len();
+
+    trace!("Training top-level {} model layer for the workload", layer1_model);
+    let root_data = workload.root_training_data(md_container);
+    let mut root_container = RMITrainingData::from_slice(&root_data);
+    root_container.set_scale(num_leaf_models as f64 / num_rows as f64);
+    let top_model = train_model(layer1_model, &root_container);
+    check_monotonic(md_container, &top_model, layer1_model);
+
+    // the root is monotonic, so the last key gets the largest prediction
+    let last_key = md_container.get_key(num_rows - 1).to_model_input();
+    if !top_model.needs_bounds_check()
+        && top_model.predict_to_int(&last_key) >= num_leaf_models {
+        trace!("The {} root trained for the workload is out of bounds", layer1_model);
+        return None;
+    }
+    return Some(top_model);
+}
 
-    // Check monotonicity if in debug mode
+// checks that the root `top_model` is monotonic over the data, in debug mode
+#[allow(unused_variables)]
+fn check_monotonic<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                   top_model: &Box<dyn Model>,
+                                   layer1_model: &str) {
     #[cfg(debug_assertions)]
     {
         let mut last_pred = 0;
@@ -122,74 +259,215 @@ pub fn train_two_layer<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
         }
         trace!("Top model was monotonic.");
     }
+}
 
-    trace!("Training second-level {} model layer (num models = {})",
-          layer2_model, num_leaf_models);
-    md_container.set_scale(1.0);
+// The candidate roots of a two-layer RMI: for a `workload` the root trained
+// for it, and the usual root last. Roots that cannot follow the blended
+// positions closely can route the queries worse than the usual root does,
+// so the leaves are trained under each candidate and the one with the
+// lower average log2 error over the queries is kept.
+fn train_roots<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
+                               layer1_model: &str,
+                               num_leaf_models: u64,
+                               workload: Option<&QueryWorkload>) -> Vec<Box<dyn Model>> {
+    let mut roots = Vec::with_capacity(2);
+    if let Some(workload) = workload {
+        if let Some(root) = train_workload_root(md_container, layer1_model,
+                                                num_leaf_models, workload) {
+            roots.push(root);
+        }
+    }
+    roots.push(train_root(md_container, layer1_model, num_leaf_models));
+    return roots;
+}
 
-    // find a prediction boundary near the middle
-    let midpoint_model = num_leaf_models / 2;
-    let split_idx = md_container.lower_bound_by(|x| {
-        let model_idx = top_model.predict_to_int(&x.0.to_model_input());
-        let model_target = u64::min(num_leaf_models - 1, model_idx);
-        return model_target.cmp(&midpoint_model);
-    });
-
-    // make sure the split point that we got is valid
-    if split_idx > 0 && split_idx < md_container.len() {
-        let key_at = top_model.predict_to_int(&md_container.get_key(split_idx)
-                                              .to_model_input());
-        let key_pr = top_model.predict_to_int(&md_container.get_key(split_idx - 1)
-                                              .to_model_input());
-        assert!(key_at > key_pr);
+// Trains the leaves under each of the candidate `roots` (see `train_roots`),
+// and returns the index of the best root along with its leaves, per-leaf
+// errors and per-leaf query counts. To need no more memory than training
+// one leaf layer, only the leaves of the last candidate are kept, and the
+// leaves of the best root are trained again if it is another one. Ties go
+// to the last candidate.
+fn train_best_leaf_layer<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                         roots: &[Box<dyn Model>],
+                                         layer2_model: &str,
+                                         num_leaf_models: u64,
+                                         workload: Option<&QueryWorkload>)
+                                         -> (usize, Vec<Box<dyn Model>>,
+                                             Vec<(u64, (u64, u64))>, Vec<u64>) {
+    let train_under = |top_model: &Box<dyn Model>|
+                       -> (f64, Vec<Box<dyn Model>>, Vec<(u64, (u64, u64))>, Vec<u64>) {
+        let (leaf_models, last_layer_max_l1s)
+            = train_leaf_layer(md_container, top_model, layer2_model, num_leaf_models);
+        let query_counts = query_counts(workload, &last_layer_max_l1s);
+        let error = query_log2_error(&last_layer_max_l1s, &query_counts).unwrap_or(0.0);
+        return (error, leaf_models, last_layer_max_l1s, query_counts);
+    };
+
+    let last_idx = roots.len() - 1;
+    let mut best = (last_idx, f64::INFINITY);
+    for (root_idx, top_model) in roots[..last_idx].iter().enumerate() {
+        let (error, ..) = train_under(top_model);
+        trace!("Root {} gives an average log2 error of {} over the queries",
+               root_idx, error);
+        if error < best.1 {
+            best = (root_idx, error);
+        }
     }
 
-    let mut leaf_models = if split_idx >= md_container.len() {
-        build_models_from(&md_container, &top_model, layer2_model,
-                          0, md_container.len(), 0,
-                          num_leaf_models as usize)
-    } else {
-        let split_idx_target = u64::min(num_leaf_models - 1,
-                                        top_model.predict_to_int(
-                                            &md_container.get_key(split_idx)
-                                                .to_model_input()))
-            as usize;
-
-        let first_half_models = split_idx_target as usize;
-        let second_half_models = num_leaf_models as usize - split_idx_target as usize;
-
-        let (mut hf1, mut hf2)
-            = rayon::join(|| build_models_from(&md_container, &top_model, layer2_model,
-                                               0, split_idx,
-                                               0,
-                                               first_half_models),
-                          || build_models_from(&md_container, &top_model, layer2_model,
-                                               split_idx + 1, md_container.len(),
-                                               split_idx_target,
-                                               second_half_models));
-
-        let mut leaf_models = Vec::new();
-        leaf_models.append(&mut hf1);
-        leaf_models.append(&mut hf2);
-        leaf_models
+    let last = train_under(&roots[last_idx]);
+    if last_idx > 0 {
+        trace!("Root {} gives an average log2 error of {} over the queries",
+               last_idx, last.0);
+    }
+    if last.0 <= best.1 {
+        let (_, leaf_models, last_layer_max_l1s, query_counts) = last;
+        return (last_idx, leaf_models, last_layer_max_l1s, query_counts);
+    }
+
+    drop(last);
+    let (_, leaf_models, last_layer_max_l1s, query_counts) = train_under(&roots[best.0]);
+    return (best.0, leaf_models, last_layer_max_l1s, query_counts);
+}
+
+// Trains the leaves of a two-layer RMI with the root `top_model`, and returns
+// them along with the (number of keys, maximum error) pair of each leaf.
+fn train_leaf_layer<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                    top_model: &Box<dyn Model>,
+                                    layer2_model: &str,
+                                    num_leaf_models: u64)
+                                    -> (Vec<Box<dyn Model>>, Vec<(u64, (u64, u64))>) {
+    return train_leaf_range(md_container, top_model, layer2_model, num_leaf_models,
+                            0, num_leaf_models as usize, 0, md_container.len());
+}
+
+// Trains the leaves `first_leaf` to `end_leaf` of a two-layer RMI with the
+// root `top_model`, whose keys are those from `start_idx` to `end_idx`, and
+// returns them along with the (number of keys, maximum error) pair of each
+// of them. The leaves are the same as those of the whole leaf layer.
+pub fn train_leaf_range<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                        top_model: &Box<dyn Model>,
+                                        layer2_model: &str,
+                                        num_leaf_models: u64,
+                                        first_leaf: usize, end_leaf: usize,
+                                        start_idx: usize, end_idx: usize)
+                                        -> (Vec<Box<dyn Model>>, Vec<(u64, (u64, u64))>) {
+    let num_range_leaves = (end_leaf - first_leaf) as u64;
+    trace!("Training second-level {} model layer (num models = {})",
+          layer2_model, num_range_leaves);
+
+
+    // Split the leaves into segments that are trained in parallel. Each
+    // segment is a range of the data that starts with the first key of one
+    // of the leaves. Since leaves at the edge of a segment still see the
+    // keys of their neighbors, the leaves are the same for any number of
+    // segments.
+    let data: &RMITrainingData<T> = md_container;
+    let leaf_of = |idx: usize| -> usize {
+        let model_idx = top_model.predict_to_int(&data.get_key(idx).to_model_input());
+        return u64::min(num_leaf_models - 1, model_idx) as usize;
     };
+    assert!(start_idx < end_idx && end_idx <= data.len());
+    assert!(if start_idx == 0 { first_leaf == 0 } else {
+                leaf_of(start_idx) >= first_leaf && leaf_of(start_idx - 1) < first_leaf
+            }, "Leaf {} does not start at key {}", first_leaf, start_idx);
+    assert!(if end_idx == data.len() { end_leaf == num_leaf_models as usize } else {
+                leaf_of(end_idx) >= end_leaf && leaf_of(end_idx - 1) < end_leaf
+            }, "Leaf {} does not start at key {}", end_leaf, end_idx);
+
+    let num_segments = u64::min(
+        num_range_leaves, (rayon::current_num_threads() * SEGMENTS_PER_THREAD) as u64
+    );
+    // (index of the first key, index of the first leaf) of each segment
+    let mut segments: Vec<(usize, usize)> = vec![(start_idx, first_leaf)];
+    for segment_idx in 1..num_segments {
+        let boundary_model = first_leaf as u64 + segment_idx * num_range_leaves / num_segments;
+        let split_idx = data.lower_bound_by(|x| {
+            let model_idx = top_model.predict_to_int(&x.0.to_model_input());
+            let model_target = u64::min(num_leaf_models - 1, model_idx);
+            return model_target.cmp(&boundary_model);
+        });
 
-    trace!("Computing lower bound stats...");
-    let lb_corrections = LowerBoundCorrection::new(
-        |x| top_model.predict_to_int(&x.to_model_input()), num_leaf_models, md_container
+        if split_idx >= end_idx {
+            break;
+        }
+        
+        // make sure the split point that we got is valid
+        if split_idx == 0 || split_idx <= segments.last().unwrap().0 {
+            continue;
+        }
+        assert!(leaf_of(split_idx) > leaf_of(split_idx - 1));
+        segments.push((split_idx, leaf_of(split_idx)));
+    }
+    trace!("Training leaves in {} segments", segments.len());
+
+    let segment_leaves: Vec<(Vec<Box<dyn Model>>, Vec<LeafStats<T>>)>
+        = (0..segments.len()).into_par_iter()
+        .map(|segment_idx| {
+            let (start_idx, first_model) = segments[segment_idx];
+            let (end_idx, end_model) = if segment_idx + 1 < segments.len() {
+                segments[segment_idx + 1]
+            } else {
+                (end_idx, end_leaf)
+            };
+            build_models_from(data, top_model, layer2_model,
+                              start_idx, end_idx,
+                              first_model, end_model - first_model)
+        }).collect();
+
+    let mut leaf_models: Vec<Box<dyn Model>> = Vec::with_capacity(num_range_leaves as usize);
+    let mut leaf_stats: Vec<LeafStats<T>> = Vec::with_capacity(num_range_leaves as usize);
+    for (mut models, mut stats) in segment_leaves {
+        leaf_models.append(&mut models);
+        leaf_stats.append(&mut stats);
+    }
+    assert_eq!(leaf_models.len(), num_range_leaves as usize);
+    let key_errors: Vec<(u64, (u64, u64))> = leaf_stats.iter()
+        .map(|stats| (stats.num_keys, stats.max_error))
+        .collect();
+
+    // the lower bound stats and the leaf errors come from the same pass
+    // over the data that trained the leaves. The last key before the range
+    // stands in for the leaves before it, and the first key after the range
+    // for the leaves after it, which the corrections of the leaves at the
+    // edges of the range depend on.
+    let key_stats = |idx: usize| -> LeafStats<T> {
+        let (key, offset) = data.get(idx);
+        let mut stats = LeafStats::empty();
+        stats.first = Some((offset, key));
+        stats.last = Some((offset, key));
+        return stats;
+    };
+    let lb_offset = if start_idx > 0 { 1 } else { 0 };
+    if start_idx > 0 {
+        leaf_stats.insert(0, key_stats(start_idx - 1));
+    }
+    if end_idx < data.len() {
+        leaf_stats.push(key_stats(end_idx));
+    }
+    let lb_corrections = LowerBoundCorrection::from_leaves(
+        leaf_stats.iter().map(|stats| stats.first).collect(),
+        leaf_stats.iter().map(|stats| stats.last).collect(),
+        leaf_stats.iter().map(|stats| stats.longest_run).collect(),
+        md_container.len()
     );
 
     trace!("Fixing empty models...");
     // replace any empty model with a model that returns the correct constant
     // (for LB predictions), if the underlying model supports it.
     let mut could_not_replace = false;
-    for idx in 0..(num_leaf_models as usize)-1 {
-        assert_eq!(lb_corrections.first_key(idx).is_none(),
-                   lb_corrections.last_key(idx).is_none());
+    let num_fixed_leaves = if end_idx < data.len() {
+        num_range_leaves as usize
+    } else {
+        num_range_leaves as usize - 1
+    };
+    for idx in 0..num_fixed_leaves {
+        let lb_idx = idx + lb_offset;
+        assert_eq!(lb_corrections.first_key(lb_idx).is_none(),
+                   lb_corrections.last_key(lb_idx).is_none());
 
-        if lb_corrections.last_key(idx).is_none() {
+        if lb_corrections.last_key(lb_idx).is_none() {
             // model is empty!
-            let upper_bound = lb_corrections.next_index(idx);
+            let upper_bound = lb_corrections.next_index(lb_idx);
             if !leaf_models[idx].set_to_constant_model(upper_bound as u64) {
                 could_not_replace = true;
             }
@@ -202,20 +480,345 @@ pub fn train_two_layer<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
     }
     
     
+    let last_layer_max_l1s = correct_leaf_errors(md_container.len(), key_errors,
+                                                 &leaf_models, &lb_corrections, lb_offset);
+    return (leaf_models, last_layer_max_l1s);
+}
+
+pub fn train_two_layer<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
+                                      layer1_model: &str, layer2_model: &str,
+                                      num_leaf_models: u64,
+                                      workload: Option<&QueryWorkload>) -> TrainedRMI {
+    validate(&[String::from(layer1_model), String::from(layer2_model)]);
+
+    let mut roots = train_roots(md_container, layer1_model, num_leaf_models, workload);
+    let (root_idx, leaf_models, last_layer_max_l1s, query_counts)
+        = train_best_leaf_layer(md_container, &roots, layer2_model, num_leaf_models, workload);
+
+    let top_model = roots.swap_remove(root_idx);
+    return assemble_rmi(md_container.len(), last_layer_max_l1s, query_counts,
+                        vec![vec![top_model], leaf_models],
+                        format!("{},{}", layer1_model, layer2_model),
+                        num_leaf_models);
+}
+
+// Trains a two-layer RMI with a `layer1_model` root for each of the
+// `layer2_models` leaf types, and returns `f` of each. The root is trained
+// once and shared by all of them. Each RMI is dropped before the leaves of
+// the next one are trained, so this needs no more memory than training one.
+pub fn train_two_layer_variants<T, F, R>(md_container: &mut RMITrainingData<T>,
+                                         layer1_model: &str, layer2_models: &[&str],
+                                         num_leaf_models: u64,
+                                         workload: Option<&QueryWorkload>, f: F) -> Vec<R>
+where T: TrainingKey, F: Fn(&TrainedRMI) -> R {
+    for layer2_model in layer2_models {
+        validate(&[String::from(layer1_model), String::from(*layer2_model)]);
+    }
+
+    let mut roots = train_roots(md_container, layer1_model, num_leaf_models, workload);
+    let mut results = Vec::with_capacity(layer2_models.len());
+    for layer2_model in layer2_models {
+        let (root_idx, leaf_models, last_layer_max_l1s, query_counts)
+            = train_best_leaf_layer(md_container, &roots, layer2_model,
+                                    num_leaf_models, workload);
+        let top_model = roots.remove(root_idx);
+        let rmi = assemble_rmi(md_container.len(), last_layer_max_l1s, query_counts,
+                               vec![vec![top_model], leaf_models],
+                               format!("{},{}", layer1_model, layer2_model),
+                               num_leaf_models);
+        results.push(f(&rmi));
+
+        // take the root back for the next leaf type
+        roots.insert(root_idx, rmi.rmi.into_iter().next().unwrap().pop().unwrap());
+    }
+    return results;
+}
+
+// Updates a two-layer `rmi` for `md_container`, whose first `num_unchanged`
+// keys are the keys the RMI was trained on (see `train::update`). The leaf
+// of the last unchanged key was also trained on the first changed key, so
+// it is trained again along with every leaf after it.
+pub fn update_two_layer<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                        rmi: TrainedRMI,
+                                        num_unchanged: usize) -> TrainedRMI {
+    let TrainedRMI { rmi: mut layers, models, branching_factor, num_rmi_rows,
+                     last_layer_max_l1s, leaf_key_counts, .. } = rmi;
+    assert!(md_container.len() > 0, "Cannot update an RMI for empty data");
+    assert!(num_unchanged <= num_rmi_rows && num_unchanged <= md_container.len(),
+            "The first {} keys cannot be unchanged, the RMI was trained on {} keys \
+             and there are {} now", num_unchanged, num_rmi_rows, md_container.len());
+    let layer2_model = models.split(',').nth(1).unwrap().to_string();
+
+    let num_leaf_models = layers[1].len() as u64;
+    let top_model = &layers[0][0];
+    let leaf_of = |key: T| -> usize {
+        let model_idx = top_model.predict_to_int(&key.to_model_input());
+        return u64::min(num_leaf_models - 1, model_idx) as usize;
+    };
+
+    // the root is only known to route the keys it was trained on to the
+    // leaves in order (and, without a bounds check, to leaves that exist)
+    let mut last_pred = 0;
+    for (x, _y) in md_container.iter_range(num_unchanged.saturating_sub(1), md_container.len()) {
+        let pred = top_model.predict_to_int(&x.to_model_input());
+        assert!(pred >= last_pred && (top_model.needs_bounds_check() || pred < num_leaf_models),
+                "The root of the {} RMI cannot route the changed keys to its leaves, \
+                 so it must be trained again", models);
+        last_pred = pred;
+    }
+
+    let mut first_leaf = if num_unchanged == 0 { 0 } else {
+        leaf_of(md_container.get_key(num_unchanged - 1))
+    };
+
+    // the predictions of the leaves are capped at the number of keys, so a
+    // leaf that may have predicted past the old end of the data can have a
+    // larger error now. Its left error then reaches from its last key to
+    // the old end.
+    let mut leaf_end = 0;
+    for (leaf_idx, (num_keys, (left, _))) in leaf_key_counts.iter()
+        .zip(last_layer_max_l1s.iter()).enumerate().take(first_leaf) {
+        leaf_end += *num_keys;
+        if *num_keys > 0 && left + leaf_end + 1 >= num_rmi_rows as u64 {
+            first_leaf = leaf_idx;
+            break;
+        }
+    }
+
+    // the leaves before the first key are empty, and are trained again too
+    let start_idx = md_container.lower_bound_by(|x| leaf_of(x.0).cmp(&first_leaf));
+    if start_idx == 0 {
+        first_leaf = 0;
+    }
+
+    info!("Training {} of the {} leaves again, for the last {} of {} keys",
+          num_leaf_models as usize - first_leaf, num_leaf_models,
+          md_container.len() - start_idx, md_container.len());
+    let (leaf_models, leaf_errors) = train_leaf_range(md_container, top_model, &layer2_model,
+                                                      num_leaf_models,
+                                                      first_leaf, num_leaf_models as usize,
+                                                      start_idx, md_container.len());
+
+    layers[1].truncate(first_leaf);
+    layers[1].extend(leaf_models);
+    let mut l1s: Vec<(u64, (u64, u64))> = leaf_key_counts.into_iter()
+        .zip(last_layer_max_l1s.into_iter())
+        .take(first_leaf)
+        .collect();
+    l1s.extend(leaf_errors);
+
+    return assemble_rmi(md_container.len(), l1s, Vec::new(), layers, models, branching_factor);
+}
+
+// every `stride`th (key, offset) pair of the data, starting with the first,
+// and the last pair, so that a root trained on the sample sees the whole
+// range of the keys
+pub fn sample_keys<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                   stride: usize) -> Vec<(T, usize)> {
+    let num_rows = md_container.len();
+    let mut sample: Vec<(T, usize)> = (0..num_rows).step_by(stride)
+        .map(|idx| (md_container.get_key(idx),
+                    md_container.get(md_container.run_start(idx)).1))
+        .collect();
+    if (num_rows - 1) % stride != 0 {
+        let last_idx = md_container.run_start(num_rows - 1);
+        sample.push((md_container.get_key(num_rows - 1), md_container.get(last_idx).1));
+    }
+    return sample;
+}
+
+// trains the root model of a two-layer RMI with `num_leaf_models` leaves on
+// a `sample` (see `sample_keys`) of data with `num_rows` keys
+pub fn train_sampled_root<T: TrainingKey>(sample: &[(T, usize)],
+                                          layer1_model: &str,
+                                          num_leaf_models: u64,
+                                          num_rows: usize) -> Box<dyn Model> {
+    trace!("Training top-level {} model layer on {} of {} keys",
+           layer1_model, sample.len(), num_rows);
+    let mut sample_container = RMITrainingData::from_slice(sample);
+    sample_container.set_scale(num_leaf_models as f64 / num_rows as f64);
+    return train_model(layer1_model, &sample_container);
+}
+
+// Estimates the errors of a two-layer RMI from a sample of the data. The
+// root is trained on every (1 / `sample_fraction`)th key, which stratifies
+// the sample over the whole key space. The key space is then split into
+// about `sample_fraction` times as many strata as there are leaves, and the
+// leaf of the middle key of each stratum is trained on all of the keys that
+// the root routes to it, exactly as it would be in the full RMI. Leaves are
+// sampled in proportion to the number of keys routed to them, so the errors
+// of the sampled keys estimate the average log2 error. The confidence
+// interval only accounts for which keys were sampled, not for the root
+// being trained on a sample, and the maximum error is the largest error of
+// any sampled leaf, so it can only be lower than that of the full RMI.
+pub fn estimate_two_layer<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                          layer1_model: &str, layer2_model: &str,
+                                          num_leaf_models: u64,
+                                          sample_fraction: f64) -> EstimatedRMI {
+    validate(&[String::from(layer1_model), String::from(layer2_model)]);
+    assert!(sample_fraction > 0.0 && sample_fraction <= 1.0,
+            "Sample fraction must be in (0, 1], not {}", sample_fraction);
+    let num_rows = md_container.len();
+    assert!(num_rows > 0, "Cannot estimate the error of an RMI without data");
+
+    let stride = usize::max(1, (1.0 / sample_fraction).round() as usize);
+    let sample = sample_keys(md_container, stride);
+    let top_model = train_sampled_root(&sample, layer1_model, num_leaf_models, num_rows);
+    std::mem::drop(sample);
+
+    let leaf_of = |key: T| -> u64 {
+        let model_idx = top_model.predict_to_int(&key.to_model_input());
+        return u64::min(num_leaf_models - 1, model_idx);
+    };
+    let first_key_of = |leaf_idx: u64| -> usize {
+        return md_container.lower_bound_by(|x| leaf_of(x.0).cmp(&leaf_idx));
+    };
+
+    // the leaf of the middle key of each of `num_draws` equal ranges of the
+    // keys, so that each leaf is sampled about as often as it is used
+    let num_draws = usize::min(num_rows, u64::max(
+        MIN_LEAF_SAMPLES, (sample_fraction * num_leaf_models as f64).ceil() as u64
+    ) as usize);
+    let mut draws: Vec<(u64, usize)> = Vec::new();
+    for draw_idx in 0..num_draws {
+        let key_idx = (2 * draw_idx + 1) * num_rows / (2 * num_draws);
+        let leaf_idx = leaf_of(md_container.get_key(key_idx));
+        match draws.last_mut() {
+            Some(last) if last.0 == leaf_idx => { last.1 += 1; },
+            _ => draws.push((leaf_idx, 1))
+        };
+    }
+    trace!("Training {} of {} second-level {} models",
+           draws.len(), num_leaf_models, layer2_model);
+
+    // the corrected error of each sampled leaf, and its model
+    let sampled: Vec<((u64, u64), Box<dyn Model>)> = draws.par_iter()
+        .map(|&(leaf_idx, _)| {
+            let lo = first_key_of(leaf_idx);
+            let hi = if leaf_idx + 1 == num_leaf_models { num_rows } else { first_key_of(leaf_idx + 1) };
+            assert!(lo < hi, "Sampled leaf {} has no keys", leaf_idx);
+
+            // train the leaf on the same keys as build_models_from would
+            let mut leaf_data = Vec::with_capacity(hi - lo + 2);
+            if lo > 0 {
+                let (_, prev_offset) = md_container.get(md_container.run_start(lo - 1));
+                leaf_data.push((md_container.get_key(lo - 1), prev_offset));
+            }
+            let leaf_start = leaf_data.len();
+            leaf_data.extend(md_container.iter_range(lo, hi));
+            let leaf_end = leaf_data.len();
+            if hi < num_rows {
+                leaf_data.push(md_container.get(hi));
+            }
+
+            let leaf_model = train_model(layer2_model, &RMITrainingData::from_slice(&leaf_data));
+            let stats = LeafStats::of_leaf(&leaf_model, &leaf_data[leaf_start..leaf_end],
+                                           num_rows, hi == num_rows);
+
+            let next = if hi < num_rows {
+                let (key, offset) = md_container.get(hi);
+                (offset, key)
+            } else {
+                (num_rows, T::max_value())
+            };
+            let prev_key = if lo > 0 { md_container.get_key(lo - 1) } else { T::zero_value() };
+            let first_idx = if leaf_idx == 0 { hi } else { lo };
+            let err = lower_bound_error(&leaf_model, stats.max_error, next, prev_key,
+                                        first_idx, stats.longest_run, num_rows);
+            (err, leaf_model)
+        }).collect();
+
+    // each draw is a key, so the average log2 error of the draws estimates
+    // the average log2 error of all the keys.
+    let log2_error = |err: (u64, u64)| log2_window(1, err);
+    let model_avg_log2_error = draws.iter().zip(sampled.iter())
+        .map(|((_, count), (err, _))| *count as f64 * log2_error(*err))
+        .sum::<f64>() / num_draws as f64;
+
+    let variance = if num_draws < 2 { 0.0 } else {
+        let deviations = draws.iter().zip(sampled.iter())
+            .map(|((_, count), (err, _))| {
+                let deviation = log2_error(*err) - model_avg_log2_error;
+                *count as f64 * deviation * deviation
+            }).sum::<f64>() / (num_draws - 1) as f64;
+        let undrawn = 1.0 - num_draws as f64 / num_rows as f64;
+        undrawn * deviations / num_draws as f64
+    };
+
+    let model_max_error = sampled.iter().map(|(err, _)| u64::max(err.0, err.1)).max().unwrap();
+    let leaf_model = sampled.into_iter().next().unwrap().1;
+    
+    return EstimatedRMI {
+        model_avg_log2_error,
+        model_avg_log2_error_ci: 1.96 * variance.sqrt(),
+        model_max_error,
+        model_max_log2_error: (model_max_error as f64).log2(),
+        top_model, leaf_model,
+        models: format!("{},{}", layer1_model, layer2_model),
+        branching_factor: num_leaf_models
+    };
+}
+
+// computes the number of keys routed to each leaf and the (left, right)
+// error of each leaf, including the corrections needed for lower bound
+// searches.
+fn compute_leaf_errors<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                       top_model: &Box<dyn Model>,
+                                       leaf_models: &[Box<dyn Model>],
+                                       lb_corrections: &LowerBoundCorrection<T>)
+                                       -> Vec<(u64, (u64, u64))> {
+    let key_errors = compute_key_errors(md_container, top_model, leaf_models);
+    return correct_leaf_errors(md_container.len(), key_errors, leaf_models, lb_corrections, 0);
+}
+
+// computes the number of keys routed to each leaf and the (left, right)
+// error of each leaf over those keys.
+fn compute_key_errors<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                      top_model: &Box<dyn Model>,
+                                      leaf_models: &[Box<dyn Model>])
+                                      -> Vec<(u64, (u64, u64))> {
+    let num_leaf_models = leaf_models.len() as u64;
     trace!("Computing last level errors...");
-    // evaluate model, compute last level errors
-    let mut last_layer_max_l1s = vec![(0, 0) ; num_leaf_models as usize];
-    for (x, y) in md_container.iter_model_input() {
-        let leaf_idx = top_model.predict_to_int(&x);
-        let target = u64::min(num_leaf_models - 1, leaf_idx) as usize;
-        
-        let pred = leaf_models[target].predict_to_int(&x);
-        let err = error_between(pred, y as u64, md_container.len() as u64);
+    // evaluate model, compute last level errors. Each chunk of the data
+    // produces the statistics of the leaves it maps to, in order.
+    let chunks = md_container.chunk_bounds(rayon::current_num_threads() * SEGMENTS_PER_THREAD);
+    let chunk_errors: Vec<Vec<(usize, u64, (u64, u64))>> = chunks.par_iter()
+        .map(|&(start_idx, end_idx)| {
+            let mut leaf_stats: Vec<(usize, u64, (u64, u64))> = Vec::new();
+            for (x, y) in md_container.iter_model_input_range(start_idx, end_idx) {
+                let leaf_idx = top_model.predict_to_int(&x);
+                let target = u64::min(num_leaf_models - 1, leaf_idx) as usize;
+                
+                let pred = leaf_models[target].predict_to_int(&x);
+                let err = errors_between(pred, y as u64, md_container.len() as u64);
 
+                match leaf_stats.last_mut() {
+                    Some(stats) if stats.0 == target => {
+                        stats.1 += 1;
+                        stats.2 = max_errors(err, stats.2);
+                    },
+                    _ => leaf_stats.push((target, 1, err))
+                };
+            }
+            leaf_stats
+        }).collect();
+
+    let mut last_layer_max_l1s = vec![(0, (0, 0)) ; num_leaf_models as usize];
+    for (target, count, err) in chunk_errors.into_iter().flatten() {
         let cur_val = last_layer_max_l1s[target];
-        last_layer_max_l1s[target] = (cur_val.0 + 1, u64::max(err, cur_val.1));
-    }    
+        last_layer_max_l1s[target] = (cur_val.0 + count, max_errors(err, cur_val.1));
+    }
 
+    return last_layer_max_l1s;
+}
+
+// The (left, right) error of a leaf with the error `curr_err` over its keys,
+// corrected for lower bound searches. `next` is the (index, key) of the first
+// key after the leaf, `prev_key` is the last key before the leaf, and
+// `first_idx` is the index of the first key after the previous leaf.
+pub fn lower_bound_error<T: TrainingKey>(leaf_model: &Box<dyn Model>, curr_err: (u64, u64),
+                                         next: (usize, T), prev_key: T, first_idx: usize,
+                                         longest_run: u64, num_rows: usize) -> (u64, u64) {
     // for lower bound searches, we need to make sure that:
     //   (1) a query for the first key in the next leaf minus one 
     //       includes the key in the next leaf. (upper error)
@@ -223,72 +826,124 @@ pub fn train_two_layer<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
     //       includes the first key after the previous leaf (lower error)
     //       (normally, the first key after the previous leaf is the first
     //        key in this leaf, but not in the case where this leaf has no keys)
-    let mut large_corrections = 0;
-    for leaf_idx in 0..num_leaf_models as usize {
-        let curr_err = last_layer_max_l1s[leaf_idx].1;
-        let upper_error = {
-            let (idx_of_next, key_of_next) = lb_corrections.next(leaf_idx);
-            let pred = leaf_models[leaf_idx].predict_to_int(
-                &key_of_next.minus_epsilon().to_model_input()
-            );
-            error_between(pred, idx_of_next as u64 + 1, md_container.len() as u64)
-        };
-        
-        let lower_error = {
-            let first_key_before = lb_corrections.prev_key(leaf_idx);
+    let upper_error = {
+        let (idx_of_next, key_of_next) = next;
+        let pred = leaf_model.predict_to_int(&key_of_next.minus_epsilon().to_model_input());
+        errors_between(pred, idx_of_next as u64 + 1, num_rows as u64)
+    };
+    
+    let lower_error = {
+        let pred = leaf_model.predict_to_int(&prev_key.plus_epsilon().to_model_input());
+        errors_between(pred, first_idx as u64, num_rows as u64)
+    };
 
-            let prev_idx = if leaf_idx == 0 { 0 } else { leaf_idx - 1 };
-            let first_idx = lb_corrections.next_index(prev_idx);
+    let (left, right) = max_errors(curr_err, max_errors(upper_error, lower_error));
+    return (left + longest_run, right + longest_run);
+}
 
-            let pred = leaf_models[leaf_idx].predict_to_int(
-                &first_key_before.plus_epsilon().to_model_input()
-            );
-            error_between(pred, first_idx as u64, md_container.len() as u64)
-        };
-          
-            
-        let new_err = *(&[curr_err, upper_error, lower_error]).iter().max().unwrap()
-            + lb_corrections.longest_run(leaf_idx);
+// adds the corrections needed for lower bound searches to the per-leaf
+// (number of keys, (left, right) error) pairs in `key_errors`. The
+// corrections of each leaf are `lb_offset` places later in `lb_corrections`.
+fn correct_leaf_errors<T: TrainingKey>(num_rows: usize,
+                                       key_errors: Vec<(u64, (u64, u64))>,
+                                       leaf_models: &[Box<dyn Model>],
+                                       lb_corrections: &LowerBoundCorrection<T>,
+                                       lb_offset: usize)
+                                       -> Vec<(u64, (u64, u64))> {
+    let num_leaf_models = leaf_models.len() as u64;
+    let last_layer_max_l1s = key_errors;
 
-        let num_items_in_leaf = last_layer_max_l1s[leaf_idx].0;
-        last_layer_max_l1s[leaf_idx] = (num_items_in_leaf, new_err);
+    let corrected: Vec<((u64, (u64, u64)), bool)> = (0..num_leaf_models as usize).into_par_iter()
+        .map(|leaf_idx| {
+            let curr_err = last_layer_max_l1s[leaf_idx].1;
+            let lb_idx = leaf_idx + lb_offset;
+            let prev_idx = if lb_idx == 0 { 0 } else { lb_idx - 1 };
+            let new_err = lower_bound_error(&leaf_models[leaf_idx], curr_err,
+                                            lb_corrections.next(lb_idx),
+                                            lb_corrections.prev_key(lb_idx),
+                                            lb_corrections.next_index(prev_idx),
+                                            lb_corrections.longest_run(lb_idx),
+                                            num_rows);
 
-        if new_err - curr_err > 512 && num_items_in_leaf > 100 {
-            large_corrections += 1;
-        }
-    }
+            let num_items_in_leaf = last_layer_max_l1s[leaf_idx].0;
+            let large_correction = (new_err.0 + new_err.1) - (curr_err.0 + curr_err.1) > 1024
+                && num_items_in_leaf > 100;
+            ((num_items_in_leaf, new_err), large_correction)
+        }).collect();
+
+    let large_corrections = corrected.iter().filter(|(_, large)| *large).count();
+    let last_layer_max_l1s: Vec<(u64, (u64, u64))> = corrected.into_iter()
+        .map(|(stats, _)| stats).collect();
 
     if large_corrections > 1 {
         trace!("Of {} models, {} needed large lower bound corrections.",
               num_leaf_models, large_corrections);
     }
-                        
-    trace!("Evaluating two-layer RMI...");
+
+    return last_layer_max_l1s;
+}
+
+// the number of queries of the `workload` routed to each leaf, given the
+// per-leaf (number of keys, (left, right) error) pairs, or nothing without
+// a workload
+pub fn query_counts(workload: Option<&QueryWorkload>,
+                    last_layer_max_l1s: &[(u64, (u64, u64))]) -> Vec<u64> {
+    return match workload {
+        None => Vec::new(),
+        Some(workload) => workload.leaf_counts(last_layer_max_l1s.iter().map(|(n, _)| *n))
+    };
+}
+
+// the average log2 of the width of the search window over the queries,
+// given the per-leaf errors and query counts, or nothing without queries
+fn query_log2_error(last_layer_max_l1s: &[(u64, (u64, u64))],
+                    query_counts: &[u64]) -> Option<f64> {
+    let num_queries: u64 = query_counts.iter().sum();
+    if num_queries == 0 { return None; }
+    return Some(last_layer_max_l1s.iter().zip(query_counts.iter())
+                .map(|((_n, err), count)| log2_window(*count, *err)).sum::<f64>()
+                / num_queries as f64);
+}
+
+// builds the trained RMI, and its error statistics, from the per-leaf
+// (number of keys, (left, right) error) pairs. The average errors are over
+// the half-width of each leaf's search window, which is its error if the
+// leaf's errors are symmetric. With the number of queries of each leaf in
+// `query_counts`, the average log2 error is also taken over the queries.
+pub fn assemble_rmi(num_rows: usize,
+                    last_layer_max_l1s: Vec<(u64, (u64, u64))>,
+                    query_counts: Vec<u64>,
+                    rmi: Vec<Vec<Box<dyn Model>>>,
+                    models: String,
+                    num_leaf_models: u64) -> TrainedRMI {
+    trace!("Evaluating RMI...");
     let (m_idx, m_err) = last_layer_max_l1s
         .iter().enumerate()
-        .max_by_key(|(_idx, &x)| x.1).unwrap();
+        .max_by_key(|(_idx, &(_n, (left, right)))| u64::max(left, right)).unwrap();
     
-    let model_max_error = m_err.1;
+    let model_max_error = u64::max((m_err.1).0, (m_err.1).1);
     let model_max_error_idx = m_idx;
 
+    let half_width = |err: &(u64, u64)| (err.0 + err.1) as f64 / 2.0;
     let model_avg_error: f64 = last_layer_max_l1s
-        .iter().map(|(n, err)| n * err).sum::<u64>() as f64 / num_rows as f64;
+        .iter().map(|(n, err)| *n as f64 * half_width(err)).sum::<f64>() / num_rows as f64;
 
     let model_avg_l2_error: f64 = last_layer_max_l1s
         .iter()
-        .map(|(n, err)| ((n*err) as f64).powf(2.0) / num_rows as f64).sum::<f64>();
+        .map(|(n, err)| (*n as f64 * half_width(err)).powf(2.0) / num_rows as f64).sum::<f64>();
     
     let model_avg_log2_error: f64 = last_layer_max_l1s
-        .iter().map(|(n, err)| (*n as f64)*((2*err + 2) as f64).log2()).sum::<f64>() / num_rows as f64;
+        .iter().map(|(n, err)| log2_window(*n, *err)).sum::<f64>() / num_rows as f64;
 
     let model_max_log2_error: f64 = (model_max_error as f64).log2();
+
+    let query_avg_log2_error = query_log2_error(&last_layer_max_l1s, &query_counts);
     
-    let final_errors = last_layer_max_l1s.into_iter()
-        .map(|(_n, err)| err).collect();
+    let (leaf_key_counts, final_errors) = last_layer_max_l1s.into_iter().unzip();
     
     return TrainedRMI {
-        num_rmi_rows: md_container.len(),
-        num_data_rows: md_container.len(),
+        num_rmi_rows: num_rows,
+        num_data_rows: num_rows,
         model_avg_error,
         model_avg_l2_error,
         model_avg_log2_error,
@@ -296,11 +951,103 @@ pub fn train_two_layer<T: TrainingKey>(md_container: &mut RMITrainingData<T>,
         model_max_error_idx,
         model_max_log2_error,
         last_layer_max_l1s: final_errors,
-        rmi: vec![vec![top_model], leaf_models],
-        models: format!("{},{}", layer1_model, layer2_model),
+        leaf_key_counts,
+        leaf_query_counts: query_counts,
+        query_avg_log2_error,
+        rmi,
+        models,
         branching_factor: num_leaf_models,
         cache_fix: None,
         build_time: 0
     };
 
 }
+
+// Searches for the smallest single-precision encoding of the leaf parameters
+// whose average log2 error is at most `max_log2_growth` above the
+// full-precision RMI. The candidates are rounding every parameter, and
+// rounding all but one of them. The errors of each candidate are computed
+// again from the data, so the errors reported by the resulting RMI hold for
+// the rounded parameters.
+pub fn quantize_two_layer<T: TrainingKey>(md_container: &RMITrainingData<T>,
+                                          mut rmi: TrainedRMI,
+                                          max_log2_growth: f64) -> TrainedRMI {
+    assert_eq!(rmi.rmi.len(), 2, "Only two-layer RMIs can be quantized");
+    let num_params = rmi.rmi[1][0].params().len();
+
+    // quantizing nothing does not change the model, but tells us if the
+    // leaf model supports quantization at all.
+    if !rmi.rmi[1].iter_mut().all(|m| m.quantize_params(&vec![false; num_params])) {
+        warn!("Leaf models of type {} cannot be quantized", rmi.rmi[1][0].function_name());
+        return rmi;
+    }
+    
+    let baseline_log2_error = rmi.model_avg_log2_error;
+    let TrainedRMI { rmi: mut layers, models, branching_factor, build_time,
+                     leaf_query_counts, .. } = rmi;
+    let num_leaf_models = layers[1].len() as u64;
+    
+    let lb_corrections = {
+        let top_model = &layers[0][0];
+        LowerBoundCorrection::new(
+            |x| top_model.predict_to_int(&x.to_model_input()), num_leaf_models, md_container
+        )
+    };
+
+    // the first candidate is strictly smaller than the others
+    let mut candidates = vec![vec![true; num_params]];
+    if num_params > 1 {
+        for keep_idx in 0..num_params {
+            let mut mask = vec![true; num_params];
+            mask[keep_idx] = false;
+            candidates.push(mask);
+        }
+    }
+
+    let mut best: Option<(Vec<bool>, Vec<(u64, (u64, u64))>, f64)> = None;
+    for (candidate_idx, mask) in candidates.into_iter().enumerate() {
+        layers[1].iter_mut().for_each(|m| { m.quantize_params(&mask); });
+        let errors = compute_leaf_errors(md_container, &layers[0][0], &layers[1],
+                                         &lb_corrections);
+        let log2_error = errors
+            .iter().map(|(n, err)| log2_window(*n, *err)).sum::<f64>()
+            / md_container.len() as f64;
+        trace!("Quantizing leaf parameters {:?} gives average log2 error {} (was {})",
+               mask, log2_error, baseline_log2_error);
+
+        if log2_error > baseline_log2_error + max_log2_growth {
+            continue;
+        }
+
+        let improves = match &best {
+            None => true,
+            Some((_, _, best_log2_error)) => log2_error < *best_log2_error
+        };
+        if improves {
+            best = Some((mask, errors, log2_error));
+        }
+
+        if candidate_idx == 0 {
+            break;
+        }
+    }
+
+    let (mask, errors) = match best {
+        Some((mask, errors, _)) => (mask, errors),
+        None => {
+            info!("No quantization of the leaf parameters was within the error budget");
+            let mask = vec![false; num_params];
+            layers[1].iter_mut().for_each(|m| { m.quantize_params(&mask); });
+            let errors = compute_leaf_errors(md_container, &layers[0][0], &layers[1],
+                                             &lb_corrections);
+            (mask, errors)
+        }
+    };
+
+    info!("Storing leaf parameters {:?} in single precision", mask);
+    layers[1].iter_mut().for_each(|m| { m.quantize_params(&mask); });
+    let mut res = assemble_rmi(md_container.len(), errors, leaf_query_counts,
+                               layers, models, branching_factor);
+    res.build_time = build_time;
+    return res;
+}
@@ -0,0 +1,107 @@
+// < begin copyright >
+// Copyright Ryan Marcus 2020
+//
+// See root directory of this project for license terms.
+//
+// < end copyright >
+
+use crate::models::{RMITrainingData, TrainingKey};
+use log::*;
+use rayon::prelude::*;
+use std::cmp::Ordering;
+
+/// The share of the leaves allocated by query frequency when an RMI is
+/// trained for a workload. The rest are allocated by key frequency as
+/// usual, so that keys that are rarely queried still get leaves.
+pub const QUERY_LEAF_SHARE: f64 = 0.5;
+
+// the most keys the root of an RMI trained for a workload is trained on
+const MAX_ROOT_SAMPLE: usize = 1 << 22;
+
+/// A sample of the queries an RMI will serve, stored as the position of
+/// each query's lower bound in the data. Queries past the last key are
+/// searched for in the leaf of the last key, so they count as queries for
+/// the last key.
+pub struct QueryWorkload {
+    // sorted
+    positions: Vec<usize>,
+    num_rows: usize
+}
+
+impl QueryWorkload {
+    /// the workload of looking up each of the keys in `queries` (in any
+    /// order, with any multiplicity) in `data`
+    pub fn new<T: TrainingKey + PartialOrd>(data: &RMITrainingData<T>,
+                                           queries: &RMITrainingData<T>) -> QueryWorkload {
+        let num_rows = data.len();
+        assert!(num_rows > 0, "Cannot build a workload without data");
+        assert!(queries.len() > 0, "A workload must have at least one query");
+
+        let keys: Vec<T> = queries.iter().map(|(key, _)| key).collect();
+        let mut positions: Vec<usize> = keys.par_iter()
+            .map(|query| {
+                let pos = data.lower_bound_by(|(key, _)| {
+                    key.partial_cmp(query).unwrap_or(Ordering::Less)
+                });
+                usize::min(pos, num_rows - 1)
+            }).collect();
+        positions.par_sort_unstable();
+
+        info!("Read a workload of {} queries", positions.len());
+        return QueryWorkload { positions, num_rows };
+    }
+
+    pub fn len(&self) -> usize {
+        return self.positions.len();
+    }
+
+    /// the number of queries whose lower bound is in `start..end`
+    pub fn count_between(&self, start: usize, end: usize) -> u64 {
+        let lo = self.positions.partition_point(|&pos| pos < start);
+        let hi = self.positions.partition_point(|&pos| pos < end);
+        return (hi - lo) as u64;
+    }
+
+    /// the number of queries of each leaf of an RMI, given the number of
+    /// keys routed to each leaf. The keys of each leaf directly follow
+    /// those of the leaf before it.
+    pub fn leaf_counts(&self, keys_per_leaf: impl Iterator<Item = u64>) -> Vec<u64> {
+        let mut start = 0;
+        return keys_per_leaf.map(|num_keys| {
+            let end = start + num_keys as usize;
+            let count = self.count_between(start, end);
+            start = end;
+            count
+        }).collect();
+    }
+
+    /// Training data for the root of an RMI that allocates
+    /// `QUERY_LEAF_SHARE` of its leaves by query frequency: a sample of
+    /// the keys, each with a position that blends its own position with
+    /// the share of the queries that come before it (scaled to the number
+    /// of keys). Like the positions of the keys, the blended positions grow
+    /// with the keys, so a root trained on them is still monotonic.
+    pub fn root_training_data<T: TrainingKey>(&self, data: &RMITrainingData<T>) -> Vec<(T, usize)> {
+        assert_eq!(data.len(), self.num_rows,
+                   "The workload was built for data with {} keys, not {}",
+                   self.num_rows, data.len());
+        let num_rows = self.num_rows;
+        let num_queries = self.positions.len() as f64;
+        let blend = |idx: usize| -> usize {
+            let pos = data.run_start(idx);
+            let queries_before = self.count_between(0, pos) as f64;
+            let blended = (1.0 - QUERY_LEAF_SHARE) * pos as f64
+                + QUERY_LEAF_SHARE * queries_before / num_queries * num_rows as f64;
+            return usize::min(blended as usize, num_rows - 1);
+        };
+
+        let stride = usize::max(1, (num_rows + MAX_ROOT_SAMPLE - 1) / MAX_ROOT_SAMPLE);
+        let mut sample: Vec<usize> = (0..num_rows).step_by(stride).collect();
+        if (num_rows - 1) % stride != 0 {
+            sample.push(num_rows - 1);
+        }
+        return sample.par_iter()
+            .map(|&idx| (data.get_key(idx), blend(idx)))
+            .collect();
+    }
+}
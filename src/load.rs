@@ -7,14 +7,30 @@
  
  
 use memmap::MmapOptions;
-use rmi_lib::{RMITrainingData, RMITrainingDataIteratorProvider, KeyType};
+use rmi_lib::{RMITrainingData, RMITrainingDataIteratorProvider, KeyType, QueryWorkload};
+use rmi_lib::string_keys::StringKeyEncoding;
 use byteorder::{LittleEndian, ReadBytesExt};
 use std::fs::File;
 use std::convert::TryInto;
 
+// The keys that follow the 8-byte header of a data file, as a native slice.
+// The keys are stored little endian, so this only works on little endian
+// hosts, and only if the mapping is aligned for the key type (an mmap is
+// always page aligned). The 16-byte alignment of u128 is never met, since
+// the keys start after the header, so u128 keys are always read one by one.
+fn native_keys<K: Copy>(data: &[u8], length: usize) -> Option<&[K]> {
+    if !cfg!(target_endian = "little") { return None; }
+    
+    // u32, u64, u128 and f64 are valid for any bit pattern
+    let (prefix, keys, _) = unsafe { data[8..].align_to::<K>() };
+    if !prefix.is_empty() || keys.len() < length { return None; }
+    return Some(&keys[..length]);
+}
+
 pub enum DataType {
     UINT64,
     UINT32,
+    UINT128,
     FLOAT64
 }
 
@@ -28,6 +44,11 @@ impl RMITrainingDataIteratorProvider for SliceAdapterU64 {
     fn cdf_iter(&self) -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
         Box::new((0..self.length).map(move |i| self.get(i).unwrap()))
     }
+
+    fn cdf_iter_range(&self, start: usize, end: usize)
+                      -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
+        Box::new((start..end).map(move |i| self.get(i).unwrap()))
+    }
     
     fn get(&self, idx: usize) -> Option<(Self::InpType, usize)> {
         if idx >= self.length { return None; };
@@ -36,6 +57,10 @@ impl RMITrainingDataIteratorProvider for SliceAdapterU64 {
         return Some((mi.into(), idx));
     }
     
+    fn keys(&self) -> Option<&[Self::InpType]> {
+        native_keys(&self.data, self.length)
+    }
+
     fn key_type(&self) -> KeyType {
         KeyType::U64
     }
@@ -54,6 +79,11 @@ impl RMITrainingDataIteratorProvider for SliceAdapterU32 {
     fn cdf_iter(&self) -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
         Box::new((0..self.length).map(move |i| self.get(i).unwrap()))
     }
+
+    fn cdf_iter_range(&self, start: usize, end: usize)
+                      -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
+        Box::new((start..end).map(move |i| self.get(i).unwrap()))
+    }
     
     fn get(&self, idx: usize) -> Option<(Self::InpType, usize)> {
         if idx >= self.length { return None; };
@@ -62,6 +92,10 @@ impl RMITrainingDataIteratorProvider for SliceAdapterU32 {
         return Some((mi, idx));
     }
     
+    fn keys(&self) -> Option<&[Self::InpType]> {
+        native_keys(&self.data, self.length)
+    }
+
     fn key_type(&self) -> KeyType {
         KeyType::U32
     }
@@ -69,6 +103,40 @@ impl RMITrainingDataIteratorProvider for SliceAdapterU32 {
     fn len(&self) -> usize { self.length }
 }
 
+struct SliceAdapterU128 {
+    data: memmap::Mmap,
+    length: usize
+}
+
+impl RMITrainingDataIteratorProvider for SliceAdapterU128 {
+    type InpType = u128;
+    fn cdf_iter(&self) -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
+        Box::new((0..self.length).map(move |i| self.get(i).unwrap()))
+    }
+
+    fn cdf_iter_range(&self, start: usize, end: usize)
+                      -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
+        Box::new((start..end).map(move |i| self.get(i).unwrap()))
+    }
+    
+    fn get(&self, idx: usize) -> Option<(Self::InpType, usize)> {
+        if idx >= self.length { return None; };
+        let mi = (&self.data[8 + idx * 16..8 + (idx + 1) * 16])
+            .read_u128::<LittleEndian>().unwrap();
+        return Some((mi, idx));
+    }
+    
+    fn keys(&self) -> Option<&[Self::InpType]> {
+        native_keys(&self.data, self.length)
+    }
+
+    fn key_type(&self) -> KeyType {
+        KeyType::U128
+    }
+    
+    fn len(&self) -> usize { self.length }
+}
+
 struct SliceAdapterF64 {
     data: memmap::Mmap,
     length: usize
@@ -79,6 +147,11 @@ impl RMITrainingDataIteratorProvider for SliceAdapterF64 {
     fn cdf_iter(&self) -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
         Box::new((0..self.length).map(move |i| self.get(i).unwrap()))
     }
+
+    fn cdf_iter_range(&self, start: usize, end: usize)
+                      -> Box<dyn Iterator<Item = (Self::InpType, usize)> + '_> {
+        Box::new((start..end).map(move |i| self.get(i).unwrap()))
+    }
     
     fn get(&self, idx: usize) -> Option<(Self::InpType, usize)> {
         if idx >= self.length { return None; };
@@ -87,6 +160,10 @@ impl RMITrainingDataIteratorProvider for SliceAdapterF64 {
         return Some((mi, idx));
     }
     
+    fn keys(&self) -> Option<&[Self::InpType]> {
+        native_keys(&self.data, self.length)
+    }
+
     fn key_type(&self) -> KeyType {
         KeyType::F64
     }
@@ -95,9 +172,10 @@ impl RMITrainingDataIteratorProvider for SliceAdapterF64 {
 }
 
 pub enum RMIMMap {
-    UINT64(RMITrainingData<u64>),
-    UINT32(RMITrainingData<u32>),
-    FLOAT64(RMITrainingData<f64>)
+    UINT64(RMITrainingData<'static, u64>),
+    UINT32(RMITrainingData<'static, u32>),
+    UINT128(RMITrainingData<'static, u128>),
+    FLOAT64(RMITrainingData<'static, f64>)
 }
 
 macro_rules! dynamic {
@@ -105,6 +183,7 @@ macro_rules! dynamic {
         match $data {
             load::RMIMMap::UINT64(mut x) => $funcname(&mut x, $($p),*),
             load::RMIMMap::UINT32(mut x) => $funcname(&mut x, $($p),*),
+            load::RMIMMap::UINT128(mut x) => $funcname(&mut x, $($p),*),
             load::RMIMMap::FLOAT64(mut x) => $funcname(&mut x, $($p),*),
         }
     }
@@ -116,16 +195,10 @@ impl RMIMMap {
         match self {
             RMIMMap::UINT64(x) => RMIMMap::UINT64(x.soft_copy()),
             RMIMMap::UINT32(x) => RMIMMap::UINT32(x.soft_copy()),
+            RMIMMap::UINT128(x) => RMIMMap::UINT128(x.soft_copy()),
             RMIMMap::FLOAT64(x) => RMIMMap::FLOAT64(x.soft_copy()),
         }
     }
-
-    pub fn into_u64(self) -> Option<RMITrainingData<u64>> {
-        match self {
-            RMIMMap::UINT64(x) => Some(x),
-            _ => None
-        }
-    }
 }
                 
 
@@ -138,6 +211,12 @@ pub fn load_data(filepath: &str,
     let mmap = unsafe { MmapOptions::new().map(&fd).unwrap() };
     let num_items = (&mmap[0..8]).read_u64::<LittleEndian>().unwrap() as usize;
 
+    // training makes several passes over the whole file, all of them in order
+    #[cfg(unix)]
+    unsafe {
+        libc::madvise(mmap.as_ptr() as *mut libc::c_void, mmap.len(), libc::MADV_SEQUENTIAL);
+    }
+
     let rtd = match dt {
         DataType::UINT64 =>
             RMIMMap::UINT64(RMITrainingData::new(Box::new(
@@ -147,6 +226,10 @@ pub fn load_data(filepath: &str,
             RMIMMap::UINT32(RMITrainingData::new(Box::new(
                 SliceAdapterU32 { data: mmap, length: num_items }
             ))),
+        DataType::UINT128 =>
+            RMIMMap::UINT128(RMITrainingData::new(Box::new(
+                SliceAdapterU128 { data: mmap, length: num_items }
+            ))),
         DataType::FLOAT64 =>
             RMIMMap::FLOAT64(RMITrainingData::new(Box::new(
                 SliceAdapterF64 { data: mmap, length: num_items }
@@ -155,3 +238,57 @@ pub fn load_data(filepath: &str,
 
     return (num_items, rtd);
 }
+
+// Reads a file of sorted strings: the number of strings as a 64-bit
+// integer, then each string as its 32-bit length followed by its bytes
+// (all little endian). The RMI is trained on the encoded keys (see
+// `string_keys`), and the encoding is returned with them.
+pub fn load_string_data(filepath: &str) -> (usize, RMIMMap, StringKeyEncoding) {
+    let fd = File::open(filepath).unwrap_or_else(|_| {
+        panic!("Unable to open data file at {}", filepath)
+    });
+
+    let mmap = unsafe { MmapOptions::new().map(&fd).unwrap() };
+    let num_items = (&mmap[0..8]).read_u64::<LittleEndian>().unwrap() as usize;
+
+    let mut keys: Vec<&[u8]> = Vec::with_capacity(num_items);
+    let mut pos = 8;
+    for _ in 0..num_items {
+        assert!(pos + 4 <= mmap.len(), "String data file {} is truncated", filepath);
+        let len = (&mmap[pos..pos + 4]).read_u32::<LittleEndian>().unwrap() as usize;
+        assert!(pos + 4 + len <= mmap.len(), "String data file {} is truncated", filepath);
+        keys.push(&mmap[pos + 4..pos + 4 + len]);
+        pos += 4 + len;
+    }
+    assert!(keys.windows(2).all(|w| w[0] <= w[1]), "String keys must be sorted");
+
+    let encoding = StringKeyEncoding::new(&keys);
+    let encoded: Vec<(u64, usize)> = keys.iter().enumerate()
+        .map(|(idx, key)| (encoding.encode(key), idx))
+        .collect();
+
+    return (num_items, RMIMMap::UINT64(RMITrainingData::new(Box::new(encoded))), encoding);
+}
+
+// Reads the query keys in `filepath`, a file in the same format as the data
+// file (but not necessarily sorted), as a workload over `data`.
+pub fn load_workload(filepath: &str, data: &RMIMMap) -> QueryWorkload {
+    return match data {
+        RMIMMap::UINT64(x) => match load_data(filepath, DataType::UINT64).1 {
+            RMIMMap::UINT64(q) => QueryWorkload::new(x, &q),
+            _ => unreachable!()
+        },
+        RMIMMap::UINT32(x) => match load_data(filepath, DataType::UINT32).1 {
+            RMIMMap::UINT32(q) => QueryWorkload::new(x, &q),
+            _ => unreachable!()
+        },
+        RMIMMap::UINT128(x) => match load_data(filepath, DataType::UINT128).1 {
+            RMIMMap::UINT128(q) => QueryWorkload::new(x, &q),
+            _ => unreachable!()
+        },
+        RMIMMap::FLOAT64(x) => match load_data(filepath, DataType::FLOAT64).1 {
+            RMIMMap::FLOAT64(q) => QueryWorkload::new(x, &q),
+            _ => unreachable!()
+        },
+    };
+}
@@ -12,10 +12,12 @@
 #[macro_use]
 mod load;
 
-use load::{load_data, DataType};
-use rmi_lib::{train, train_bounded};
-use rmi_lib::KeyType;
+use load::{load_data, load_string_data, load_workload, DataType};
+use rmi_lib::{train, train_for_workload, train_bounded, quantize_last_layer};
+use rmi_lib::{KeyType, CodegenOptions, SearchStrategy, CacheFixLayout, HugePages};
+use rmi_lib::{RMITrainingData, TrainingKey};
 use rmi_lib::optimizer;
+use rmi_lib::shard::{self, ShardPlan, TrainedShard};
 
 use json::*;
 use log::*;
@@ -76,6 +78,41 @@ fn main() {
         .arg(Arg::with_name("no-errors")
              .long("no-errors")
              .help("do not save last-level errors, and modify the RMI function signature"))
+        .arg(Arg::with_name("prefetch-batch")
+             .long("prefetch-batch")
+             .value_name("count")
+             .help("number of keys prefetched together by lookup_prefetch, default = 16"))
+        .arg(Arg::with_name("search")
+             .long("search")
+             .value_name("strategy")
+             .help("search used by find: binary, exponential, linear, interpolation, or auto (default)"))
+        .arg(Arg::with_name("mmap")
+             .long("mmap")
+             .help("store all parameters in one file that the generated load function maps read-only"))
+        .arg(Arg::with_name("mmap-populate")
+             .long("mmap-populate")
+             .help("with --mmap, pre-fault the parameter mapping when loading (MAP_POPULATE)"))
+        .arg(Arg::with_name("mmap-hugepages")
+             .long("mmap-hugepages")
+             .help("with --mmap, request transparent huge pages for the parameter mapping"))
+        .arg(Arg::with_name("huge-pages")
+             .long("huge-pages")
+             .value_name("pages")
+             .help("without --mmap, load the parameters into huge pages: thp, 2mb, or 1gb"))
+        .arg(Arg::with_name("numa-replicate")
+             .long("numa-replicate")
+             .help("without --mmap, copy the parameters to every NUMA node and read the local copy"))
+        .arg(Arg::with_name("leaf-align")
+             .long("leaf-align")
+             .value_name("bytes")
+             .help("pad each last-level record (16, 32, or 64 bytes) so it never straddles a cache line"))
+        .arg(Arg::with_name("narrow-errors")
+             .long("narrow-errors")
+             .help("store last-level errors as 16 or 32 bit integers when they fit"))
+        .arg(Arg::with_name("quantize")
+             .long("quantize")
+             .value_name("log2_error")
+             .help("store last-level parameters as floats and errors as 16 bit integers, if the average log2 error grows by at most this much"))
         .arg(Arg::with_name("threads")
              .long("threads")
              .short("t")
@@ -85,6 +122,17 @@ fn main() {
              .long("bounded")
              .value_name("line_size")
              .help("construct an error-bounded RMI using the cachefix method for the given line size"))
+        .arg(Arg::with_name("cache-fix-layout")
+             .long("cache-fix-layout")
+             .value_name("layout")
+             .help("with --bounded, layout of the spline points: packed (default), soa, or eytzinger"))
+        .arg(Arg::with_name("queries")
+             .long("queries")
+             .value_name("file")
+             .help("train for the query keys in this file (in the format of the data file): more leaves where queries concentrate, and errors averaged over the queries"))
+        .arg(Arg::with_name("instrument")
+             .long("instrument")
+             .help("count the leaves, errors, and clamped predictions of every lookup, reported by dump_stats"))
         .arg(Arg::with_name("max-size")
              .long("max-size")
              .value_name("BYTES")
@@ -95,6 +143,21 @@ fn main() {
         .arg(Arg::with_name("zero-build-time")
              .long("zero-build-time")
              .help("zero out the model build time field"))
+        .arg(Arg::with_name("shards")
+             .long("shards")
+             .value_name("count")
+             .help("plan a build in shards: split the leaves into this many shards, and write the plan to NAMESPACE_SHARD_PLAN in the data path"))
+        .arg(Arg::with_name("shard-sample")
+             .long("shard-sample")
+             .value_name("keys")
+             .help("with --shards, the number of keys to train the root on, default = 1048576"))
+        .arg(Arg::with_name("train-shard")
+             .long("train-shard")
+             .value_name("index")
+             .help("train one shard of the plan NAMESPACE_SHARD_PLAN, and write its leaves to NAMESPACE_SHARD_<index> in the data path"))
+        .arg(Arg::with_name("merge-shards")
+             .long("merge-shards")
+             .help("build the RMI from the plan NAMESPACE_SHARD_PLAN and its trained shards"))
         .arg(Arg::with_name("optimize")
              .long("optimize")
              .value_name("file")
@@ -112,6 +175,39 @@ fn main() {
 
 
     let data_dir = matches.value_of("data-path").unwrap_or("rmi_data");
+    let mut codegen_options = CodegenOptions::default();
+    if let Some(s) = matches.value_of("prefetch-batch") {
+        codegen_options.prefetch_batch_size = s.parse::<usize>()
+            .expect("Prefetch batch size must be a positive integer.");
+    }
+    codegen_options.mmap = matches.is_present("mmap");
+    codegen_options.mmap_populate = matches.is_present("mmap-populate");
+    codegen_options.mmap_huge_pages = matches.is_present("mmap-hugepages");
+    if let Some(s) = matches.value_of("huge-pages") {
+        codegen_options.huge_pages = HugePages::from_name(s)
+            .expect("Huge pages must be one of thp, 2mb, or 1gb.");
+    }
+    codegen_options.numa_replicate = matches.is_present("numa-replicate");
+    assert!(!codegen_options.mmap
+            || (codegen_options.huge_pages == HugePages::None && !codegen_options.numa_replicate),
+            "--huge-pages and --numa-replicate cannot be used with --mmap (see --mmap-hugepages).");
+    codegen_options.narrow_errors = matches.is_present("narrow-errors");
+    codegen_options.instrument = matches.is_present("instrument");
+    if let Some(s) = matches.value_of("leaf-align") {
+        let align = s.parse::<usize>()
+            .expect("Leaf alignment must be a positive integer.");
+        assert!(align == 16 || align == 32 || align == 64,
+                "Leaf alignment must be 16, 32, or 64 bytes.");
+        codegen_options.leaf_alignment = align;
+    }
+    if let Some(s) = matches.value_of("search") {
+        codegen_options.search = SearchStrategy::from_name(s)
+            .expect("Search strategy must be one of binary, exponential, linear, interpolation, or auto.");
+    }
+    if let Some(s) = matches.value_of("cache-fix-layout") {
+        codegen_options.cache_fix_layout = CacheFixLayout::from_name(s)
+            .expect("Cache fix layout must be one of packed, soa, or eytzinger.");
+    }
     
     if matches.value_of("namespace").is_some() && matches.value_of("param-grid").is_some() {
         panic!("Can only specify one of namespace or param-grid");
@@ -124,16 +220,35 @@ fn main() {
         load_data(&fp, DataType::UINT64)
     } else if fp.contains("uint32") {
         load_data(&fp, DataType::UINT32)
+    } else if fp.contains("uint128") {
+        key_type = KeyType::U128;
+        load_data(&fp, DataType::UINT128)
     } else if fp.contains("f64") {
         key_type = KeyType::F64;
         load_data(&fp, DataType::FLOAT64)
+    } else if fp.contains("string") {
+        key_type = KeyType::Str;
+        let (num_rows, data, encoding) = load_string_data(&fp);
+        info!("Encoding {} bytes of each string key, after a common prefix of {} bytes",
+              encoding.num_bytes(), encoding.prefix().len());
+        codegen_options.string_keys = Some(encoding);
+        (num_rows, data)
     } else {
-        panic!("Data file must contain uint64, uint32, or f64.");
+        panic!("Data file must contain uint64, uint32, uint128, f64, or string.");
     };
 
+    let workload = matches.value_of("queries").map(|qf| {
+        assert!(!matches!(key_type, KeyType::Str),
+                "Cannot train an RMI over strings for a workload.");
+        assert!(matches.value_of("bounded").is_none(),
+                "Cannot train a bounded RMI for a workload.");
+        info!("Reading queries from {}...", qf);
+        load_workload(qf, &data)
+    });
+
     if matches.is_present("optimize") {
         let results = dynamic!(optimizer::find_pareto_efficient_configs,
-                               data, 10);
+                               data, 10, workload.as_ref());
 
         optimizer::RMIStatistics::display_table(&results);
 
@@ -200,11 +315,14 @@ fn main() {
                            models, *branch_factor);
                     
                     let loc_data = data.soft_copy();
-                    let mut trained_model = dynamic!(train, loc_data, models, *branch_factor);
+                    let mut trained_model = match &workload {
+                        None => dynamic!(train, loc_data, models, *branch_factor),
+                        Some(w) => dynamic!(train_for_workload, loc_data, models, *branch_factor, w)
+                    };
                     
-                    let size_bs = rmi_lib::rmi_size(&trained_model);
+                    let size_bs = rmi_lib::rmi_size_for(&trained_model, &codegen_options);
                     
-                    let result_obj = object! {
+                    let mut result_obj = object! {
                         "layers" => models.clone(),
                         "branching factor" => *branch_factor,
                         "average error" => trained_model.model_avg_error as f64,
@@ -219,6 +337,9 @@ fn main() {
                         "size binary search" => size_bs,
                         "namespace" => namespace.clone()
                     };
+                    if let Some(query_log2_error) = trained_model.query_avg_log2_error {
+                        result_obj["query log2 error"] = query_log2_error.into();
+                    }
 
                     if matches.is_present("zero-build-time") {
                         trained_model.build_time = 0;
@@ -230,7 +351,7 @@ fn main() {
                             trained_model,
                             data_dir,
                             key_type,
-                            true).unwrap();
+                            &codegen_options).unwrap();
                         
                     }
                     
@@ -262,7 +383,39 @@ fn main() {
 
     } else if matches.value_of("namespace").is_some() {
         let namespace = matches.value_of("namespace").unwrap().to_string();
+        let plan_path = format!("{}/{}_SHARD_PLAN", data_dir, namespace);
+        if let Some(s) = matches.value_of("shards") {
+            let num_shards = s.parse::<usize>()
+                .expect("Number of shards must be a positive integer.");
+            let sample_size = matches.value_of("shard-sample")
+                .map(|x| x.parse::<usize>().expect("Sample size must be a positive integer."))
+                .unwrap_or(1 << 20);
+            let models = matches.value_of("models").unwrap();
+            let branch_factor = matches
+                .value_of("branching factor")
+                .unwrap()
+                .parse::<u64>()
+                .unwrap();
+            dynamic!(plan_shards, data, models, branch_factor, num_shards, sample_size, &plan_path);
+            return;
+        }
+        if let Some(s) = matches.value_of("train-shard") {
+            let shard_idx = s.parse::<usize>()
+                .expect("Shard index must be a non-negative integer.");
+            let shard_path = format!("{}/{}_SHARD_{}", data_dir, namespace, shard_idx);
+            dynamic!(train_shard, data, &plan_path, shard_idx, &shard_path);
+            return;
+        }
+        
         let mut trained_model = match matches.value_of("max-size") {
+            None if matches.is_present("merge-shards") => {
+                assert!(workload.is_none() && matches.value_of("bounded").is_none()
+                        && matches.value_of("quantize").is_none(),
+                        "An RMI merged from shards cannot be trained for a workload, \
+                         bounded, or quantized.");
+                let shard_prefix = format!("{}/{}_SHARD_", data_dir, namespace);
+                dynamic!(merge_shards, data.soft_copy(), &plan_path, &shard_prefix)
+            }
             None => {
                 // assume they gave a model spec 
                 let models = matches.value_of("models").unwrap();
@@ -273,13 +426,23 @@ fn main() {
                     .unwrap();
         
                 let trained_model = match matches.value_of("bounded") {
-                    None => dynamic!(train, data, models, branch_factor),
+                    None => match &workload {
+                        None => dynamic!(train, data.soft_copy(), models, branch_factor),
+                        Some(w) => dynamic!(train_for_workload, data.soft_copy(),
+                                            models, branch_factor, w)
+                    },
                     Some(s) => {
                         let line_size = s.parse::<usize>()
                             .expect("Line size must be a positive integer.");
-                        let d_u64 = data.into_u64()
-                            .expect("Can only construct a bounded RMI on u64 data.");
-                        train_bounded(&d_u64, models, branch_factor, line_size)
+                        match data.soft_copy() {
+                            load::RMIMMap::UINT64(x) if !matches!(key_type, KeyType::Str) =>
+                                train_bounded(&x, models, branch_factor, line_size),
+                            load::RMIMMap::UINT32(x) =>
+                                train_bounded(&x, models, branch_factor, line_size),
+                            load::RMIMMap::FLOAT64(x) =>
+                                train_bounded(&x, models, branch_factor, line_size),
+                            _ => panic!("Can only construct a bounded RMI on u64, u32, or f64 data.")
+                        }
                     }
                 };
                 trained_model
@@ -288,12 +451,22 @@ fn main() {
                 let max_size = max_size_str.parse::<usize>().unwrap();
                 info!("Constructing RMI with size less than {}", max_size);
 
-                let trained_model = dynamic!(rmi_lib::train_for_size, data, max_size);
+                let trained_model = dynamic!(rmi_lib::train_for_size, data.soft_copy(),
+                                             max_size, workload.as_ref());
                 trained_model
             }
         };
+
+        if let Some(s) = matches.value_of("quantize") {
+            let max_log2_growth = s.parse::<f64>()
+                .expect("Quantization error budget must be a number.");
+            assert!(matches.value_of("bounded").is_none(),
+                    "Cannot quantize a bounded RMI.");
+            trained_model = dynamic!(quantize_last_layer, data, trained_model, max_log2_growth);
+            codegen_options.quantize_errors = true;
+        }
         
-        let no_errors = matches.is_present("no-errors");
+        codegen_options.include_errors = !matches.is_present("no-errors");
         info!("Model build time: {} ms", trained_model.build_time / 1_000_000);
 
         info!(
@@ -313,6 +486,10 @@ fn main() {
             "Max model log2 error: {}",
             trained_model.model_max_log2_error
         );
+        if let Some(query_log2_error) = trained_model.query_avg_log2_error {
+            info!("Average log2 error over the queries (expected search steps per query): {}",
+                  query_log2_error);
+        }
         info!(
             "Max model error on model {}: {} ({}%)",
             trained_model.model_max_error_idx,
@@ -330,7 +507,7 @@ fn main() {
                 trained_model,
                 data_dir,
                 key_type,
-                !no_errors).unwrap();
+                &codegen_options).unwrap();
         } else {
             trace!("Skipping code generation due to CLI flag");
         }
@@ -338,3 +515,39 @@ fn main() {
         trace!("Must specify either a name space or a parameter grid.");
     }
 }
+
+// Plans a build of an RMI in shards (see `rmi_lib::shard`), and writes the
+// plan to `plan_path`.
+fn plan_shards<T: TrainingKey>(data: &RMITrainingData<T>, models: &str, branch_factor: u64,
+                               num_shards: usize, sample_size: usize, plan_path: &str) {
+    let plan = shard::plan_shards(data, models, branch_factor, num_shards, sample_size);
+    plan.write_to(plan_path).expect("Could not write the shard plan");
+    info!("Wrote a plan for {} shards to {}", plan.shards.len(), plan_path);
+}
+
+// Trains the shard `shard_idx` of the plan at `plan_path`, and writes it to
+// `shard_path`.
+fn train_shard<T: TrainingKey>(data: &RMITrainingData<T>, plan_path: &str,
+                               shard_idx: usize, shard_path: &str) {
+    let plan = ShardPlan::<T>::read_from(plan_path).expect("Could not read the shard plan");
+    let trained = shard::train_shard(data, &plan, shard_idx);
+    trained.write_to(shard_path).expect("Could not write the trained shard");
+    info!("Wrote the {} leaves of shard {} to {}", trained.leaves.len(), shard_idx, shard_path);
+}
+
+// Merges the shards of the plan at `plan_path`, each at `shard_prefix`
+// followed by its index, into an RMI.
+fn merge_shards<T: TrainingKey>(data: &RMITrainingData<T>, plan_path: &str,
+                                shard_prefix: &str) -> rmi_lib::TrainedRMI {
+    let plan = ShardPlan::<T>::read_from(plan_path).expect("Could not read the shard plan");
+    assert_eq!(data.len(), plan.num_rows,
+               "The shard plan is for {} keys, but the data has {}",
+               plan.num_rows, data.len());
+    let shards = (0..plan.shards.len()).map(|shard_idx| {
+        let shard_path = format!("{}{}", shard_prefix, shard_idx);
+        TrainedShard::read_from(&shard_path).unwrap_or_else(|_| {
+            panic!("Could not read the trained shard {}", shard_path)
+        })
+    }).collect();
+    return shard::merge_shards(&plan, shards);
+}
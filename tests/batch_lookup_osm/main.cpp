@@ -0,0 +1,44 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include "rmi.h"
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+  
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+
+  std::vector<uint64_t> guesses(size);
+  std::vector<size_t> errs(size);
+  rmi::lookup_batch(data.data(), size, guesses.data(), errs.data());
+  
+  size_t err;
+  for (uint64_t key_index = 0; key_index < size; key_index++) {
+    uint64_t lookup = data[key_index];
+    uint64_t rmi_guess = rmi::lookup(lookup, &err);
+    
+    if (rmi_guess != guesses[key_index] || err != errs[key_index]) {
+      std::cout << "Search key: " << lookup
+                << " RMI guess: " << rmi_guess << " +/- " << err
+                << " batch guess: " << guesses[key_index]
+                << " +/- " << errs[key_index] << std::endl;
+      exit(-1);
+    }
+  }
+  
+  rmi::cleanup();
+  exit(0);
+}
@@ -0,0 +1,71 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "rmi_soa.h"
+#include "rmi_eytzinger.h"
+
+typedef uint64_t (*lookup_fn)(uint64_t, size_t*);
+typedef void (*batch_fn)(const uint64_t*, size_t, uint64_t*, size_t*);
+
+static bool check(const char* layout, lookup_fn lookup, batch_fn lookup_batch,
+                  const std::vector<uint64_t>& data) {
+  const size_t batch_size = 4096;
+  std::vector<uint64_t> out(batch_size);
+  std::vector<size_t> errs(batch_size);
+  size_t err;
+
+  for (size_t start = 0; start < data.size(); start += batch_size) {
+    const size_t len = std::min(batch_size, data.size() - start);
+    lookup_batch(data.data() + start, len, out.data(), errs.data());
+
+    for (size_t i = 0; i < len; i++) {
+      uint64_t lookup_key = data[start + i];
+      uint64_t true_index = (uint64_t)
+        std::distance(data.begin(), std::lower_bound(data.begin(),
+                                                     data.end(),
+                                                     lookup_key));
+      uint64_t rmi_guess = lookup(lookup_key, &err);
+
+      uint64_t diff = (rmi_guess > true_index ? rmi_guess - true_index : true_index - rmi_guess);
+
+      if (diff > 8 || out[i] != rmi_guess || errs[i] != err) {
+        std::cout << layout << " search key: " << lookup_key
+                  << " Key at " << true_index << ": " << data[true_index]
+                  << " RMI guess: " << rmi_guess << " +/- " << err
+                  << " batch guess: " << out[i] << " +/- " << errs[i]
+                  << " diff: " << diff << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+  
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "SoA RMI status: " << rmi_soa::load("rmi_data") << std::endl;
+  std::cout << "Eytzinger RMI status: " << rmi_eytzinger::load("rmi_data") << std::endl;
+
+  if (!check("soa", rmi_soa::lookup, rmi_soa::lookup_batch, data)
+      || !check("eytzinger", rmi_eytzinger::lookup, rmi_eytzinger::lookup_batch, data))
+    exit(-1);
+
+  rmi_soa::cleanup();
+  rmi_eytzinger::cleanup();
+  exit(0);
+}
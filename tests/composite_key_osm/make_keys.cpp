@@ -0,0 +1,34 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+
+typedef unsigned __int128 uint128_t;
+
+// Builds (region, cell) keys from every fourth OSM cell ID: the high word
+// is the top 10 bits of the cell ID and the low word is the cell ID, like
+// a (tenant, timestamp) pair.
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cout << "Usage: " << argv[0] << " <uint64 input> <uint128 output>" << std::endl;
+    return -1;
+  }
+
+  std::vector<uint64_t> cells;
+  std::ifstream in(argv[1], std::ios::binary);
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  cells.resize(size);
+  in.read(reinterpret_cast<char*>(cells.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::vector<uint128_t> keys;
+  for (uint64_t i = 0; i < size; i += 4) {
+    keys.push_back(((uint128_t)(cells[i] >> 54) << 64) | cells[i]);
+  }
+
+  uint64_t num_keys = keys.size();
+  std::ofstream out(argv[2], std::ios::binary);
+  out.write(reinterpret_cast<const char*>(&num_keys), sizeof(uint64_t));
+  out.write(reinterpret_cast<const char*>(keys.data()), num_keys*sizeof(uint128_t));
+  return out.good() ? 0 : -1;
+}
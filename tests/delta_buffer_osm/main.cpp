@@ -0,0 +1,82 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "rmi_delta.h"
+
+const size_t NUM_INSERTS = 100000;
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  rmi_engine::RMI<uint64_t> engine;
+  bool engine_status = engine.load("rmi_data/rmi_PARAMETERS");
+  std::cout << "Engine status: " << engine_status << std::endl;
+  if (!engine_status) exit(-1);
+
+  // insert keys between the keys of the data (including copies of its
+  // keys) and keys after its last key
+  rmi_engine::DeltaRMI<uint64_t> index(engine, data.data(), size);
+  std::vector<uint64_t> inserted;
+  uint64_t key_index = 0;
+  for (size_t i = 0; i < NUM_INSERTS; i++) {
+    key_index = (key_index + 7919) % size;
+    inserted.push_back(data[key_index] + (i % 3));
+  }
+  for (uint64_t i = 1; i <= NUM_INSERTS && data.back() <= UINT64_MAX - i; i++)
+    inserted.push_back(data.back() + i);
+  for (uint64_t key : inserted) index.insert(key);
+
+  std::vector<uint64_t> merged;
+  index.merge(&merged);
+  std::vector<uint64_t> expected_merged(data);
+  expected_merged.insert(expected_merged.end(), inserted.begin(), inserted.end());
+  std::sort(expected_merged.begin(), expected_merged.end());
+  if (merged != expected_merged || index.size() != merged.size()) {
+    std::cout << "The merged keys are not the keys of the data and the inserted keys" << std::endl;
+    exit(-1);
+  }
+
+  // every key of the data, every inserted key, and the keys just before them
+  std::vector<uint64_t> queries(data);
+  queries.insert(queries.end(), inserted.begin(), inserted.end());
+  for (uint64_t key : inserted) queries.push_back(key - 1);
+  for (uint64_t lookup : queries) {
+    size_t expected = std::lower_bound(merged.begin(), merged.end(), lookup) - merged.begin();
+    size_t found = index.find(lookup);
+    if (found != expected) {
+      std::cout << "Search key: " << lookup
+                << " delta find: " << found
+                << " lower bound: " << expected << std::endl;
+      exit(-1);
+    }
+  }
+
+  for (size_t i = 0; i + 1 < inserted.size(); i += 101) {
+    uint64_t lo = std::min(inserted[i], inserted[i + 1]);
+    uint64_t hi = std::max(inserted[i], inserted[i + 1]);
+    size_t expected = std::lower_bound(merged.begin(), merged.end(), hi)
+      - std::lower_bound(merged.begin(), merged.end(), lo);
+    if (index.count(lo, hi) != expected) {
+      std::cout << "Range: " << lo << " to " << hi
+                << " delta count: " << index.count(lo, hi)
+                << " expected: " << expected << std::endl;
+      exit(-1);
+    }
+  }
+
+  exit(0);
+}
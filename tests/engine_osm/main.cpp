@@ -0,0 +1,64 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "rmi.h"
+#include "rmi_engine.h"
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+
+  rmi_engine::RMI<uint64_t> engine;
+  bool engine_status = engine.load("rmi_data/rmi_PARAMETERS");
+  std::cout << "Engine status: " << engine_status << std::endl;
+  if (!engine_status) exit(-1);
+
+  // the engine must agree with the generated code exactly
+  std::vector<uint64_t> batch_out(size);
+  std::vector<size_t> batch_errs(size);
+  engine.lookup_batch(data.data(), size, batch_out.data(), batch_errs.data());
+
+  size_t err, engine_err;
+  for (uint64_t key_index = 0; key_index < size; key_index++) {
+    uint64_t lookup = data[key_index];
+    uint64_t rmi_guess = rmi::lookup(lookup, &err);
+    uint64_t engine_guess = engine.lookup(lookup, &engine_err);
+
+    if (rmi_guess != engine_guess || err != engine_err
+        || batch_out[key_index] != engine_guess || batch_errs[key_index] != engine_err) {
+      std::cout << "Search key: " << lookup
+                << " RMI guess: " << rmi_guess << " +/- " << err
+                << " engine guess: " << engine_guess << " +/- " << engine_err
+                << " engine batch guess: " << batch_out[key_index]
+                << " +/- " << batch_errs[key_index] << std::endl;
+      exit(-1);
+    }
+
+    size_t expected = std::lower_bound(data.begin(), data.end(), lookup) - data.begin();
+    size_t found = engine.find(data.data(), size, lookup);
+    if (found != expected) {
+      std::cout << "Search key: " << lookup
+                << " engine find: " << found
+                << " lower bound: " << expected << std::endl;
+      exit(-1);
+    }
+  }
+
+  rmi::cleanup();
+  exit(0);
+}
@@ -0,0 +1,42 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "rmi.h"
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../wiki_ts_200M_uint64",
+                   std::ios::binary);
+  
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+
+  // the wiki data has many duplicate keys, so find must return the
+  // first occurrence of each key, not just any occurrence.
+  for (uint64_t key_index = 0; key_index < size; key_index++) {
+    uint64_t lookup = data[key_index];
+    size_t expected = std::lower_bound(data.begin(), data.end(), lookup) - data.begin();
+    size_t found = rmi::find(data.data(), size, lookup);
+    
+    if (found != expected) {
+      std::cout << "Search key: " << lookup
+                << " find: " << found
+                << " lower bound: " << expected << std::endl;
+      exit(-1);
+    }
+  }
+  
+  rmi::cleanup();
+  exit(0);
+}
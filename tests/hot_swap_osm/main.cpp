@@ -0,0 +1,69 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "rmi_hot_swap.h"
+
+const size_t NUM_READERS = 4;
+const size_t NUM_SWAPS = 50;
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  const char* paths[] = { "rmi_data/rmi_a_PARAMETERS", "rmi_data/rmi_b_PARAMETERS" };
+  rmi_engine::SwappableRMI<uint64_t> rmi;
+  std::cout << "RMI status: " << rmi.load(paths[0]) << std::endl;
+  if (!rmi.loaded()) exit(-1);
+
+  // the readers check every result while the RMI is swapped under them
+  std::atomic<bool> done(false);
+  std::atomic<size_t> failures(0);
+  std::vector<std::thread> readers;
+  for (size_t t = 0; t < NUM_READERS; t++) {
+    readers.emplace_back([&, t]() {
+      rmi_engine::SwappableRMI<uint64_t>::Reader reader(rmi);
+      uint64_t key_index = t;
+      while (!done.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < 256; i++) {
+          key_index = (key_index + 7919) % size;
+          uint64_t lookup = data[key_index];
+          size_t expected = std::lower_bound(data.begin(), data.end(), lookup) - data.begin();
+          if (reader.find(data.data(), size, lookup) != expected)
+            failures++;
+        }
+        reader.quiescent();
+      }
+    });
+  }
+
+  for (size_t i = 1; i <= NUM_SWAPS; i++) {
+    if (!rmi.load(paths[i % 2])) {
+      std::cout << "Could not load " << paths[i % 2] << std::endl;
+      failures++;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  rmi.synchronize();
+
+  done.store(true);
+  for (auto& t : readers) t.join();
+
+  std::cout << "Swaps: " << NUM_SWAPS << " failures: " << failures.load() << std::endl;
+  exit(failures.load() == 0 ? 0 : -1);
+}
@@ -0,0 +1,102 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include "rmi.h"
+
+struct Stats {
+  uint64_t lookups = 0;
+  uint64_t leaves = 0;
+  uint64_t errors = 0;
+};
+
+// sums the counts in a file written by dump_stats
+static Stats read_stats(const char* path) {
+  Stats stats;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    uint64_t a, b, count;
+    fields >> name;
+    if (name == "lookups") {
+      fields >> stats.lookups;
+    } else if (name == "leaf") {
+      fields >> a >> count;
+      stats.leaves += count;
+    } else if (name == "error") {
+      fields >> a >> b >> count;
+      stats.errors += count;
+    }
+  }
+  return stats;
+}
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+  
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+
+  // every thread counts its own lookups
+  const size_t num_threads = 4;
+  std::vector<size_t> bad(num_threads, 0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < data.size(); i += num_threads) {
+        uint64_t true_index = (uint64_t)
+          std::distance(data.begin(), std::lower_bound(data.begin(),
+                                                       data.end(),
+                                                       data[i]));
+        if (rmi::find(data.data(), data.size(), data[i]) != true_index)
+          bad[t]++;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  for (size_t t = 0; t < num_threads; t++) {
+    if (bad[t] > 0) {
+      std::cout << "Thread " << t << " found " << bad[t] << " keys at the wrong position" << std::endl;
+      exit(-1);
+    }
+  }
+
+  if (!rmi::dump_stats("stats.txt")) {
+    std::cout << "Could not write the statistics" << std::endl;
+    exit(-1);
+  }
+  Stats stats = read_stats("stats.txt");
+  std::cout << "Lookups: " << stats.lookups << " leaves: " << stats.leaves
+            << " errors: " << stats.errors << std::endl;
+  if (stats.lookups != data.size() || stats.leaves != data.size()
+      || stats.errors != data.size())
+    exit(-1);
+
+  rmi::reset_stats();
+  rmi::dump_stats("stats.txt");
+  if (read_stats("stats.txt").lookups != 0) {
+    std::cout << "Statistics were not reset" << std::endl;
+    exit(-1);
+  }
+
+  rmi::cleanup();
+  exit(0);
+}
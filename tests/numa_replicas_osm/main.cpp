@@ -0,0 +1,62 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include "rmi.h"
+
+// checks every key from a few threads, which may read different replicas
+static bool check_all(const std::vector<uint64_t>& data) {
+  const size_t num_threads = 4;
+  std::vector<size_t> bad(num_threads, 0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < data.size(); i += num_threads) {
+        uint64_t true_index = (uint64_t)
+          std::distance(data.begin(), std::lower_bound(data.begin(),
+                                                       data.end(),
+                                                       data[i]));
+        if (rmi::find(data.data(), data.size(), data[i]) != true_index)
+          bad[t]++;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  for (size_t t = 0; t < num_threads; t++) {
+    if (bad[t] > 0) {
+      std::cout << "Thread " << t << " found " << bad[t] << " keys at the wrong position" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+  
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+  if (!check_all(data)) exit(-1);
+
+  // the replicas are made again when the parameters are loaded again
+  rmi::cleanup();
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+  if (!check_all(data)) exit(-1);
+
+  rmi::cleanup();
+  exit(0);
+}
@@ -0,0 +1,62 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "rmi.h"
+
+// checks the sorted lookups of every `every`th key against lookup_batch
+static bool check_sorted(const std::vector<uint64_t>& data, size_t every) {
+  std::vector<uint64_t> keys;
+  for (size_t i = 0; i < data.size(); i += every) keys.push_back(data[i]);
+  const size_t n = keys.size();
+
+  std::vector<uint64_t> expected(n), guesses(n);
+  std::vector<size_t> expected_errs(n), errs(n), lo(n), hi(n);
+  rmi::lookup_batch(keys.data(), n, expected.data(), expected_errs.data());
+  rmi::lookup_sorted_batch(keys.data(), n, guesses.data(), errs.data());
+  rmi::lookup_sorted_ranges(keys.data(), n, lo.data(), hi.data());
+
+  for (size_t i = 0; i < n; i++) {
+    if (guesses[i] != expected[i] || errs[i] != expected_errs[i]) {
+      std::cout << "Search key: " << keys[i]
+                << " sorted guess: " << guesses[i] << " +/- " << errs[i]
+                << " batch guess: " << expected[i] << " +/- " << expected_errs[i] << std::endl;
+      return false;
+    }
+    const size_t true_index = std::lower_bound(data.begin(), data.end(), keys[i]) - data.begin();
+    const size_t found = std::lower_bound(data.begin() + lo[i], data.begin() + hi[i], keys[i]) - data.begin();
+    if (found != true_index) {
+      std::cout << "Search key: " << keys[i] << " Key at " << true_index
+                << " range: [" << lo[i] << ", " << hi[i] << ")" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../osm_cellids_200M_uint64",
+                   std::ios::binary);
+  
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+
+  // every key, runs of keys in the same leaf, and keys in different leaves
+  for (size_t every : {1, 7, 100003}) {
+    if (!check_sorted(data, every)) exit(-1);
+  }
+  
+  rmi::cleanup();
+  exit(0);
+}
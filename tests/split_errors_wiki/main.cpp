@@ -0,0 +1,60 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "rmi.h"
+
+int main() {
+  // load the data
+  std::vector<uint64_t> data;
+  std::ifstream in("../wiki_ts_200M_uint64",
+                   std::ios::binary);
+  
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  data.resize(size);
+  // Read values.
+  in.read(reinterpret_cast<char*>(data.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+
+  size_t err, lo, hi;
+  // the sizes of the windows given by the left and right errors, and by the
+  // symmetric error
+  double split_window = 0.0;
+  double symmetric_window = 0.0;
+  
+  for (uint64_t key_index = 0; key_index < size; key_index++) {
+    uint64_t lookup = data[key_index];
+    uint64_t true_index = (uint64_t)
+      std::distance(data.begin(), std::lower_bound(data.begin(),
+                                                   data.end(),
+                                                   lookup));
+    uint64_t rmi_guess = rmi::lookup(lookup, &lo, &hi);
+    uint64_t sym_guess = rmi::lookup(lookup, &err);
+    
+    bool in_window = (true_index <= rmi_guess
+                      ? rmi_guess - true_index <= lo
+                      : true_index - rmi_guess <= hi);
+    if (!in_window || sym_guess != rmi_guess || err != std::max(lo, hi)
+        || rmi::find(data.data(), size, lookup) != true_index) {
+      std::cout << "Search key: " << lookup
+                << " Key at " << true_index << ": " << data[true_index] 
+                << " RMI guess: " << rmi_guess << " -" << lo << " +" << hi
+                << " (+/- " << err << ")" << std::endl;
+      exit(-1);
+    }
+    split_window += lo + hi + 1;
+    symmetric_window += 2 * err + 1;
+  }
+
+  std::cout << "Average window: " << split_window / size
+            << " keys (symmetric: " << symmetric_window / size << ")" << std::endl;
+  
+  rmi::cleanup();
+  exit(0);
+}
@@ -0,0 +1,75 @@
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <string>
+#include "rmi.h"
+
+int main() {
+  // load the data
+  std::vector<std::string> strings;
+  std::ifstream in("osm_cells_50M_string",
+                   std::ios::binary);
+
+  // Read size.
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  strings.resize(size);
+  // Read values.
+  for (auto& s : strings) {
+    uint32_t len;
+    in.read(reinterpret_cast<char*>(&len), sizeof(uint32_t));
+    s.resize(len);
+    in.read(&s[0], len);
+  }
+  in.close();
+  std::vector<std::string_view> data(strings.begin(), strings.end());
+
+  std::cout << "Data loaded." << std::endl;
+
+  std::cout << "RMI status: " << rmi::load("rmi_data") << std::endl;
+
+  std::vector<uint64_t> batch_out(size);
+  std::vector<size_t> batch_errs(size);
+  rmi::lookup_batch(data.data(), size, batch_out.data(), batch_errs.data());
+
+  size_t err;
+  for (uint64_t key_index = 0; key_index < size; key_index++) {
+    std::string_view lookup = data[key_index];
+    uint64_t true_index = (uint64_t)
+      std::distance(data.begin(), std::lower_bound(data.begin(),
+                                                   data.end(),
+                                                   lookup));
+    uint64_t rmi_guess = rmi::lookup(lookup, &err);
+
+    uint64_t diff = (rmi_guess > true_index ? rmi_guess - true_index : true_index - rmi_guess);
+    if (diff > err || batch_out[key_index] != rmi_guess || batch_errs[key_index] != err) {
+      std::cout << "Search key: " << lookup
+                << " Key at " << true_index << ": " << data[true_index]
+                << " RMI guess: " << rmi_guess << " +/- " << err
+                << " batch guess: " << batch_out[key_index] << " +/- " << batch_errs[key_index]
+                << " diff: " << diff << std::endl;
+      exit(-1);
+    }
+
+    // absent keys, some of which collide with keys of the data in the
+    // encoding, must still find their lower bound
+    std::string key(lookup);
+    std::string shorter = key.substr(0, key.size() - 1);
+    std::string next = key;
+    next.back()++;
+    for (const std::string& absent : { key + "/", shorter, next }) {
+      size_t expected = std::lower_bound(data.begin(), data.end(), absent) - data.begin();
+      size_t found = rmi::find(data.data(), size, absent);
+      if (found != expected) {
+        std::cout << "Search key: " << absent
+                  << " find: " << found
+                  << " lower bound: " << expected << std::endl;
+        exit(-1);
+      }
+    }
+  }
+
+  rmi::cleanup();
+  exit(0);
+}
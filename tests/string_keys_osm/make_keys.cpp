@@ -0,0 +1,44 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+// Builds URL-like string keys from every fourth OSM cell ID, with the cell
+// ID zero padded so that the strings sort like the IDs. Every other key
+// gets a suffix, so some keys only differ after the bytes that the RMI
+// encodes. The suffix can put a key before a duplicate cell ID, so the keys
+// are sorted again.
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cout << "Usage: " << argv[0] << " <uint64 input> <string output>" << std::endl;
+    return -1;
+  }
+
+  std::vector<uint64_t> cells;
+  std::ifstream in(argv[1], std::ios::binary);
+  uint64_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+  cells.resize(size);
+  in.read(reinterpret_cast<char*>(cells.data()), size*sizeof(uint64_t));
+  in.close();
+
+  std::vector<std::string> keys;
+  for (uint64_t i = 0; i < size; i += 4) {
+    std::string id = std::to_string(cells[i]);
+    std::string key = "osm/cell/" + std::string(20 - id.size(), '0') + id;
+    if (i % 8 == 0) key += "/node";
+    keys.push_back(key);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  uint64_t num_keys = keys.size();
+  std::ofstream out(argv[2], std::ios::binary);
+  out.write(reinterpret_cast<const char*>(&num_keys), sizeof(uint64_t));
+  for (const std::string& key : keys) {
+    uint32_t len = key.size();
+    out.write(reinterpret_cast<const char*>(&len), sizeof(uint32_t));
+    out.write(key.data(), len);
+  }
+  return out.good() ? 0 : -1;
+}